@@ -0,0 +1,14 @@
+SOURCES=db/builder.cc db/c.cc db/db_bench.old.cc db/db_bench_original.cc db/db_impl.cc db/db_iter.cc db/dbformat.cc db/dumpfile.cc db/filename.cc db/log_reader.cc db/log_writer.cc db/memtable.cc db/repair.cc db/table_cache.cc db/version_edit.cc db/version_set.cc db/write_batch.cc nvm_library/arena.cc nvm_library/backgroundworker.cc nvm_library/backgroundwriter.cc nvm_library/backgroundwriter_lockfree.cc nvm_library/d2skiplist.cc nvm_library/d3skiplist.cc nvm_library/d4skiplist.cc nvm_library/delayer.cc nvm_library/epoch.cc nvm_library/global.cc nvm_library/hashtablehelper.cc nvm_library/index.cc nvm_library/info_collector.cc nvm_library/l2skiplist.cc nvm_library/linearhash.cc nvm_library/memtable_dram_skiplist.cc nvm_library/mixedskiplist.cc nvm_library/mixedskiplist_connector.cc nvm_library/multitable.cc nvm_library/multitable_root.cc nvm_library/murmurhash.cc nvm_library/nvfile.cc nvm_library/nvhash.cc nvm_library/nvhashtable.cc nvm_library/nvm_allocator.cc nvm_library/nvm_file.cc nvm_library/nvm_filesystem.cc nvm_library/nvm_library.cc nvm_library/nvm_manager.cc nvm_library/nvm_options.cc nvm_library/nvmemtable.cc nvm_library/nvskiplist.cc nvm_library/skiplist_kvindram.cc nvm_library/sysnvm.cc nvm_library/trie.cc nvm_library/trie_compressed.cc table/block.cc table/block_builder.cc table/filter_block.cc table/format.cc table/iterator.cc table/merger.cc table/table.cc table/table_builder.cc table/two_level_iterator.cc util/arena.cc util/bloom.cc util/cache.cc util/coding.cc util/comparator.cc util/crc32c.cc util/env.cc util/env_posix.cc util/filter_policy.cc util/hash.cc util/histogram.cc util/logging.cc util/options.cc util/status.cc  port/port_posix.cc port/port_posix_sse.cc
+MEMENV_SOURCES=helpers/memenv/memenv.cc
+CC=cc
+CXX=g++
+PLATFORM=OS_LINUX
+PLATFORM_LDFLAGS=-pthread
+PLATFORM_LIBS= -lnuma
+PLATFORM_CCFLAGS= -fno-builtin-memcmp -pthread -DOS_LINUX -DLEVELDB_PLATFORM_POSIX -DLEVELDB_ATOMIC_PRESENT -DLEVELDB_NUMA
+PLATFORM_CXXFLAGS=-std=c++0x -fno-builtin-memcmp -pthread -DOS_LINUX -DLEVELDB_PLATFORM_POSIX -DLEVELDB_ATOMIC_PRESENT -DLEVELDB_NUMA
+PLATFORM_SSEFLAGS=-msse4.2 -DLEVELDB_PLATFORM_POSIX_SSE
+PLATFORM_SHARED_CFLAGS=-fPIC
+PLATFORM_SHARED_EXT=so
+PLATFORM_SHARED_LDFLAGS=-shared -Wl,-soname -Wl,
+PLATFORM_SHARED_VERSIONED=true
@@ -0,0 +1,294 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "nvm_library/art_index.h"
+#include <iterator>
+#include <map>
+#include <stdint.h>
+#include "util/random.h"
+#include "util/testharness.h"
+
+namespace leveldb {
+
+typedef std::map<std::string, nvMemTable*> Model;
+
+// The index only keeps the pointers: any distinct values do.
+static nvMemTable* Data(int i) {
+  return reinterpret_cast<nvMemTable*>(static_cast<intptr_t>(i + 1) * 8);
+}
+
+class ARTIndexTest {
+ public:
+  Random rnd_;
+
+  ARTIndexTest() : rnd_(301) { }
+
+  // Short keys over a few bytes, high ones included, so that keys are
+  // often prefixes of each other and nodes of every size show up.
+  std::string RandomKey() {
+    static const char kBytes[] = { 'a', 'b', 'c', '\x7f', '\x80', '\xff' };
+    std::string key;
+    const int len = 1 + rnd_.Uniform(6);
+    for (int i = 0; i < len; i++) {
+      if (rnd_.OneIn(8)) {
+        key.push_back(static_cast<char>(rnd_.Uniform(256)));
+      } else {
+        key.push_back(kBytes[rnd_.Uniform(sizeof(kBytes))]);
+      }
+    }
+    return key;
+  }
+
+  // Seek() finds the last key <= target; "" is always there.
+  static Model::const_iterator Floor(const Model& model, const std::string& target) {
+    Model::const_iterator i = model.upper_bound(target);
+    return --i;
+  }
+
+  void CheckGet(ARTIndex* index, const Model& model, const std::string& key) {
+    nvMemTable* data = NULL;
+    Model::const_iterator i = model.find(key);
+    if (i == model.end()) {
+      ASSERT_TRUE(!index->Get(key, &data));
+    } else {
+      ASSERT_TRUE(index->Get(key, &data));
+      ASSERT_TRUE(data == i->second);
+    }
+  }
+
+  void CheckSeek(ARTIndex* index, const Model& model, const std::string& target) {
+    IndexIterator* iter = index->NewIterator();
+    Model::const_iterator i = Floor(model, target);
+    iter->Seek(target);
+    ASSERT_TRUE(iter->Valid());
+    ASSERT_EQ(i->first, iter->key().ToString());
+    ASSERT_TRUE(iter->Data() == i->second);
+    ASSERT_TRUE(index->FuzzyFind(target) == i->second);
+    std::string bound;
+    index->FuzzyLeftBoundary(target, &bound);
+    ASSERT_EQ(i->first, bound);
+
+    // A few steps either way from there.
+    Model::const_iterator next = i;
+    for (int k = 0; k < 3 && iter->Valid(); k++) {
+      iter->Next();
+      ++next;
+      if (next == model.end()) {
+        ASSERT_TRUE(!iter->Valid());
+      } else {
+        ASSERT_TRUE(iter->Valid());
+        ASSERT_EQ(next->first, iter->key().ToString());
+      }
+    }
+    index->FuzzyRightBoundary(target, &bound);
+    ++i;
+    ASSERT_EQ(i == model.end() ? std::string() : i->first, bound);
+    --i;
+    iter->Seek(target);
+    for (int k = 0; k < 3 && iter->Valid(); k++) {
+      iter->Prev();
+      if (i == model.begin()) {
+        ASSERT_TRUE(!iter->Valid());
+      } else {
+        --i;
+        ASSERT_TRUE(iter->Valid());
+        ASSERT_EQ(i->first, iter->key().ToString());
+      }
+    }
+    delete iter;
+  }
+
+  // Everything, both ways, and some lookups.
+  void Check(ARTIndex* index, const Model& model) {
+    IndexIterator* iter = index->NewIterator();
+    Model::const_iterator i = model.begin();
+    for (iter->SeekToFirst(); iter->Valid(); iter->Next(), ++i) {
+      ASSERT_TRUE(i != model.end());
+      ASSERT_EQ(i->first, iter->key().ToString());
+      ASSERT_TRUE(iter->Data() == i->second);
+    }
+    ASSERT_TRUE(i == model.end());
+    Model::const_reverse_iterator r = model.rbegin();
+    for (iter->SeekToLast(); iter->Valid(); iter->Prev(), ++r) {
+      ASSERT_TRUE(r != model.rend());
+      ASSERT_EQ(r->first, iter->key().ToString());
+    }
+    ASSERT_TRUE(r == model.rend());
+    delete iter;
+
+    for (int k = 0; k < 50; k++) {
+      const std::string key = RandomKey();
+      CheckGet(index, model, key);
+      CheckSeek(index, model, key);
+    }
+    CheckSeek(index, model, "");
+    CheckSeek(index, model, std::string(8, '\xff'));
+  }
+
+  // Random changes to both; "" stays.
+  void Change(ARTIndex* index, Model* model, int n, int* next_data) {
+    for (int k = 0; k < n; k++) {
+      const uint32_t op = rnd_.Uniform(10);
+      if (op < 6) {
+        const std::string key = RandomKey();
+        nvMemTable* data = Data((*next_data)++);
+        index->Add(key, data);
+        (*model)[key] = data;
+      } else if (op < 9) {
+        // An existing key, most of the time.
+        std::string key = RandomKey();
+        Model::iterator i = model->lower_bound(key);
+        if (i != model->end() && !i->first.empty() && !rnd_.OneIn(5)) {
+          key = i->first;
+        }
+        nvMemTable* data = NULL;
+        const bool found = model->count(key) > 0;
+        ASSERT_EQ(found, index->Delete(key, &data));
+        if (found) {
+          ASSERT_TRUE(data == (*model)[key]);
+          model->erase(key);
+        }
+      } else if (model->size() > 1) {
+        // "" takes over the data of the key after it, which goes.
+        Model::iterator first = model->begin();
+        Model::iterator second = first;
+        ++second;
+        nvMemTable* data = NULL;
+        ASSERT_TRUE(index->Delete("", &data));
+        ASSERT_TRUE(data == first->second);
+        first->second = second->second;
+        model->erase(second);
+      }
+    }
+  }
+};
+
+TEST(ARTIndexTest, Empty) {
+  ARTIndex index(Data(0));
+  Model model;
+  model[""] = Data(0);
+  Check(&index, model);
+
+  IndexIterator* iter = index.NewIterator();
+  iter->Seek("anything");
+  ASSERT_TRUE(iter->Valid());
+  ASSERT_EQ("", iter->key().ToString());
+  iter->Next();
+  ASSERT_TRUE(!iter->Valid());
+  iter->Seek("anything");
+  iter->Prev();
+  ASSERT_TRUE(!iter->Valid());
+  delete iter;
+}
+
+TEST(ARTIndexTest, AddAndSeek) {
+  ARTIndex index(Data(0));
+  Model model;
+  model[""] = Data(0);
+  const char* keys[] = { "b", "ba", "bab", "c", "a", "\xff", "\x80\x01", "ab" };
+  for (size_t i = 0; i < sizeof(keys) / sizeof(keys[0]); i++) {
+    index.Add(keys[i], Data(i + 1));
+    model[keys[i]] = Data(i + 1);
+  }
+  Check(&index, model);
+
+  IndexIterator* iter = index.NewIterator();
+  iter->Seek("baa");            // Between a key and its extension.
+  ASSERT_EQ("ba", iter->key().ToString());
+  iter->Seek("bb");
+  ASSERT_EQ("bab", iter->key().ToString());
+  iter->Seek("\x7f");
+  ASSERT_EQ("c", iter->key().ToString());
+  iter->Seek("\x80");
+  ASSERT_EQ("c", iter->key().ToString());
+  iter->Seek(Slice("\x80\x01\x00", 3));
+  ASSERT_EQ("\x80\x01", iter->key().ToString());
+  delete iter;
+
+  // A new leaf replaces the old one.
+  index.Add("ba", Data(100));
+  model["ba"] = Data(100);
+  Check(&index, model);
+}
+
+TEST(ARTIndexTest, DeleteEmptyKey) {
+  ARTIndex index(Data(0));
+  index.Add("m", Data(1));
+  index.Add("t", Data(2));
+  nvMemTable* data = NULL;
+  ASSERT_TRUE(index.Delete("", &data));
+  ASSERT_TRUE(data == Data(0));
+
+  Model model;
+  model[""] = Data(1);
+  model["t"] = Data(2);
+  Check(&index, model);
+
+  ASSERT_TRUE(index.Delete("", &data));
+  ASSERT_TRUE(data == Data(1));
+  model.clear();
+  model[""] = Data(2);
+  Check(&index, model);
+  ASSERT_TRUE(!index.Delete("missing", &data));
+}
+
+TEST(ARTIndexTest, RandomAgainstMap) {
+  ARTIndex index(Data(0));
+  Model model;
+  model[""] = Data(0);
+  int next_data = 1;
+  for (int round = 0; round < 100; round++) {
+    Change(&index, &model, 100, &next_data);
+    Check(&index, model);
+  }
+  // Down to "" alone, and back.
+  while (model.size() > 1) {
+    Model::iterator i = model.begin();
+    std::advance(i, 1 + rnd_.Uniform(model.size() - 1));
+    nvMemTable* data = NULL;
+    ASSERT_TRUE(index.Delete(i->first, &data));
+    ASSERT_TRUE(data == i->second);
+    model.erase(i);
+    if (model.size() % 16 == 0) {
+      Check(&index, model);
+    }
+  }
+  Check(&index, model);
+  Change(&index, &model, 500, &next_data);
+  Check(&index, model);
+}
+
+TEST(ARTIndexTest, SnapshotIsolation) {
+  ARTIndex index(Data(0));
+  Model model;
+  model[""] = Data(0);
+  int next_data = 1;
+  Change(&index, &model, 300, &next_data);
+  for (int round = 0; round < 20; round++) {
+    // A view does not see the changes after it, the index does.
+    ARTIndex* view = index.Snapshot();
+    const Model seen = model;
+    Check(view, seen);
+    Change(&index, &model, 200, &next_data);
+    Check(view, seen);
+    Check(&index, model);
+
+    // Several views at once, as long as the oldest goes first.
+    ARTIndex* newer = index.Snapshot();
+    const Model seen_newer = model;
+    Change(&index, &model, 50, &next_data);
+    Check(view, seen);
+    Check(newer, seen_newer);
+    delete view;
+    Check(newer, seen_newer);
+    delete newer;
+    Check(&index, model);
+  }
+}
+
+}  // namespace leveldb
+
+int main(int argc, char** argv) {
+  return leveldb::test::RunAllTests();
+}
@@ -38,6 +38,7 @@
 //      seekrandom    -- N random seeks
 //      open          -- cost of opening a DB
 //      crc32c        -- repeated crc32c of 4K of data
+//      crc32c_portable -- crc32c without the SSE4.2 path, for comparison
 //      acquireload   -- load N*1000 times
 //   Meta operations:
 //      compact     -- Compact the entire DB
@@ -568,6 +569,8 @@ class Benchmark {
         method = &Benchmark::Compact;
       } else if (name == Slice("crc32c")) {
         method = &Benchmark::Crc32c;
+      } else if (name == Slice("crc32c_portable")) {
+        method = &Benchmark::Crc32cPortable;
       } else if (name == Slice("acquireload")) {
         method = &Benchmark::AcquireLoad;
       } else if (name == Slice("snappycomp")) {
@@ -727,6 +730,15 @@ class Benchmark {
   }
 
   void Crc32c(ThreadState* thread) {
+    DoCrc32c(thread, &crc32c::Extend);
+  }
+
+  void Crc32cPortable(ThreadState* thread) {
+    DoCrc32c(thread, &crc32c::PortableExtend);
+  }
+
+  void DoCrc32c(ThreadState* thread,
+                uint32_t (*extend)(uint32_t, const char*, size_t)) {
     // Checksum about 500MB of data total
     const int size = 4096;
     const char* label = "(4K per op)";
@@ -734,7 +746,7 @@ class Benchmark {
     int64_t bytes = 0;
     uint32_t crc = 0;
     while (bytes < 500 * 1048576) {
-      crc = crc32c::Value(data.data(), size);
+      crc = (*extend)(0, data.data(), size);
       thread->stats.FinishedSingleOp();
       bytes += size;
     }
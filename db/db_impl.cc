@@ -7,6 +7,7 @@
 #include <algorithm>
 #include <set>
 #include <string>
+#include <thread>
 #include <stdint.h>
 #include <stdio.h>
 #include <vector>
@@ -119,6 +120,18 @@ Options SanitizeOptions(const std::string& dbname,
   return result;
 }
 
+// The options to build a table for level with: options.compression is
+// replaced by the level's entry in compression_per_level, if any.
+static Options TableOptionsForLevel(const Options& options, int level) {
+  Options result = options;
+  const std::vector<CompressionType>& per_level = options.compression_per_level;
+  if (!per_level.empty()) {
+    result.compression =
+        per_level[std::min<size_t>(level, per_level.size() - 1)];
+  }
+  return result;
+}
+
 DBImpl::DBImpl(const Options& raw_options, const std::string& dbname)
     : env_(raw_options.env),
       internal_comparator_(raw_options.comparator),
@@ -141,6 +154,7 @@ DBImpl::DBImpl(const Options& raw_options, const std::string& dbname)
       seed_(0),
       tmp_batch_(new WriteBatch),
       bg_compaction_scheduled_(false),
+      level0_flush_micros_(0),
       manual_compaction_(NULL) {
   has_imm_.Release_Store(NULL);
   nvmems_ = new nvMultiTable(this, raw_options, dbname_);
@@ -170,6 +184,8 @@ DBImpl::~DBImpl() {
   //if (mem_ != NULL) mem_->Unref();
 
   delete nvmems_;
+  if (env_->NVM_Env() != nullptr)
+    env_->NVM_Env()->mng_->Checkpoint();
   if (imm_ != NULL) imm_->Unref();
   delete tmp_batch_;
   delete log_;
@@ -303,12 +319,14 @@ Status DBImpl::Recover(VersionEdit* edit, bool *save_manifest) {
     return s;
   }
 
+  bool created = false;
   if (!env_->FileExists(CurrentFileName(dbname_))) {
     if (options_.create_if_missing) {
       s = NewDB();
       if (!s.ok()) {
         return s;
       }
+      created = true;
     } else {
       return Status::InvalidArgument(
           dbname_, "does not exist (create_if_missing is false)");
@@ -324,6 +342,11 @@ Status DBImpl::Recover(VersionEdit* edit, bool *save_manifest) {
   if (!s.ok()) {
     return s;
   }
+  // nvMemTables are not logged; they are rebuilt from their NVM images.
+  s = nvmems_->Recover(created);
+  if (!s.ok()) {
+    return s;
+  }
   SequenceNumber max_sequence(0);
 
   // Recover from all newer log files than the ones named in the
@@ -532,7 +555,8 @@ Status DBImpl::WriteLevel0Table(MemTable* mem, VersionEdit* edit,
   Status s;
   {
     mutex_.Unlock();
-    s = BuildTable(dbname_, env_, options_, table_cache_, iter, &meta);
+    s = BuildTable(dbname_, env_, TableOptionsForLevel(options_, 0),
+                   table_cache_, iter, &meta);
     mutex_.Lock();
   }
 
@@ -760,11 +784,20 @@ void DBImpl::BackgroundCompaction() {
 
   uint64_t temp_timer1 = 0;
   if (nvmems_->level0_.Size() > 0) {
+      // The writers that pushed memtables to level 0 leave their filters
+      // to us, so that they do not read NVM under rwlock_.
+      mutex_.Unlock();
+      nvmems_->BuildLevel0Filters();
+      mutex_.Lock();
       if (options_.TEST_no_double_level0) {
-          nvMemTable* mem = nullptr;
-          nvmems_->level0_.Front(&mem);
+          std::vector<Compaction*> group;
+          PickLevel0Group(&group);
+          if (group.size() > 1) {
+              FlushLevel0Group(group);
+              return;
+          }
           //nvmems_->level0_.front();
-          Compaction* c = versions_->PickLevel0Compaction(mem);
+          Compaction* c = group[0];
           CompactionState* compact = new CompactionState(c);
           Status status = DoCompactionWork(compact);
 
@@ -790,9 +823,9 @@ void DBImpl::BackgroundCompaction() {
           nvmems_->level0_.Front(&mem);
           imm_ = mem->Immutable(mem->Seq());
           CompactMemTable();
-          nvmems_->level0_.PopFront(&mem);
+          mem = nvmems_->PopFromLevel0();
           //nvmems_->level0_.pop_front();
-          mem->Unref();
+          nvmems_->ReleaseLevel0(mem);
       }
     return;
   }
@@ -920,7 +953,9 @@ Status DBImpl::OpenCompactionOutputFile(CompactionState* compact) {
   s = env_->NewWritableFile(fname, &compact->outfile);
 
   if (s.ok()) {
-    compact->builder = new TableBuilder(options_, compact->outfile);
+    compact->builder = new TableBuilder(
+        TableOptionsForLevel(options_, compact->compaction->level() + 1),
+        compact->outfile);
   }
   return s;
 }
@@ -999,44 +1034,10 @@ Status DBImpl::InstallCompactionResults(CompactionState* compact) {
   return versions_->LogAndApply(compact->compaction->edit(), &mutex_);
 }
 
-Status DBImpl::DoCompactionWork(CompactionState* compact) {
-  const uint64_t start_micros = env_->NowMicros();
-  int64_t imm_micros = 0;  // Micros spent doing imm_ compactions
-
-  Log(options_.info_log,  "Compacting %d@%d + %d@%d files",
-      compact->compaction->num_input_files(0),
-      compact->compaction->level(),
-      compact->compaction->num_input_files(1),
-      compact->compaction->level() + 1);
-
-  if (compact->compaction->level() == 0 && options_.TEST_no_double_level0)
-      ;
-  else
-      assert(versions_->NumLevelFiles(compact->compaction->level()) > 0);
-  assert(compact->builder == NULL);
-  assert(compact->outfile == NULL);
-  if (snapshots_.empty()) {
-    compact->smallest_snapshot = versions_->LastSequence();
-  } else {
-    compact->smallest_snapshot = snapshots_.oldest()->number_;
-  }
-
-  // Release mutex while we're actually doing the compaction work
-
-
-  Iterator* input = nullptr;
-  nvMemTable* mem = nullptr;
-  if (compact->compaction->level() == 0 && options_.TEST_no_double_level0) {
-      nvmems_->level0_.lock_.ReadLock();
-      nvmems_->level0_.Front(&mem);
-      nvmems_->level0_.lock_.Unlock();
-      input = versions_->MakeInputIteratorWithoutLevel0(compact->compaction, mem, compact->smallest_snapshot);
-      nvmems_->isCompactingLevel0_ = true;
-      mutex_.Unlock();
-  } else {
-      mutex_.Unlock();
-      input = versions_->MakeInputIterator(compact->compaction);
-  }
+// Writes the entries of input, which it deletes, to the output files of
+// compact.  Several may run at once on disjoint compactions.
+Status DBImpl::CompactInput(CompactionState* compact, Iterator* input,
+                            int64_t* imm_micros) {
   input->SeekToFirst();
   Status status;
   ParsedInternalKey ikey;
@@ -1068,11 +1069,11 @@ Status DBImpl::DoCompactionWork(CompactionState* compact) {
         mutex_.Lock();
         CompactMemTable();
         //nvmems_->level0_.pop_front();
-        nvmems_->level0_.PopFront(&mem);
-        mem->Unref();
+        mem = nvmems_->PopFromLevel0();
+        nvmems_->ReleaseLevel0(mem);
         mutex_.Unlock();
 
-        imm_micros += (env_->NowMicros() - imm_start);
+        *imm_micros += (env_->NowMicros() - imm_start);
     }
 
     Slice key = input->key();
@@ -1167,6 +1168,171 @@ Status DBImpl::DoCompactionWork(CompactionState* compact) {
   }
   delete input;
   input = NULL;
+  return status;
+}
+
+// Picks the oldest memtables of level 0, up to TEST_flush_threads of them,
+// as long as their compactions into level 1 cover disjoint ranges.
+void DBImpl::PickLevel0Group(std::vector<Compaction*>* group) {
+  mutex_.AssertHeld();
+  std::vector<nvMemTable*> mems;
+  nvmems_->Level0Front(std::max(options_.TEST_flush_threads, 1u), &mems);
+  std::vector<std::pair<std::string, std::string> > ranges;
+  for (size_t i = 0; i < mems.size(); ++i) {
+    Compaction* c = versions_->PickLevel0Compaction(mems[i]);
+    std::string smallest = mems[i]->Min(), largest = mems[i]->Max();
+    for (int j = 0; j < c->num_input_files(1); ++j) {
+      Slice lo = c->input(1, j)->smallest.user_key();
+      Slice hi = c->input(1, j)->largest.user_key();
+      if (user_comparator()->Compare(lo, smallest) < 0) smallest = lo.ToString();
+      if (user_comparator()->Compare(hi, largest) > 0) largest = hi.ToString();
+    }
+    bool overlap = false;
+    for (size_t j = 0; j < ranges.size() && !overlap; ++j) {
+      overlap = user_comparator()->Compare(smallest, ranges[j].second) <= 0 &&
+                user_comparator()->Compare(ranges[j].first, largest) <= 0;
+    }
+    if (i > 0 && overlap) {
+      // Keep level 0 in order: a later memtable waits for the older ones.
+      delete c;
+      break;
+    }
+    group->push_back(c);
+    ranges.push_back(std::make_pair(smallest, largest));
+  }
+}
+
+// Compacts the memtables of group, the oldest of level 0, into level 1 on
+// a thread each, and installs all the results in one VersionEdit.
+void DBImpl::FlushLevel0Group(const std::vector<Compaction*>& group) {
+  mutex_.AssertHeld();
+  const uint64_t start_micros = env_->NowMicros();
+  const size_t n = group.size();
+  // The ranges are disjoint, so the memtables may share one sequence.
+  versions_->SetLastSequence(versions_->LastSequence() + 1);
+  std::vector<nvMemTable*> mems;
+  nvmems_->Level0Front(n, &mems);
+  assert(mems.size() == n);
+
+  std::vector<CompactionState*> compacts(n);
+  std::vector<Iterator*> inputs(n);
+  for (size_t i = 0; i < n; ++i) {
+    Log(options_.info_log,  "Compacting nvMemTable %llu + %d@1 files",
+        (unsigned long long) mems[i]->Seq(), group[i]->num_input_files(1));
+    compacts[i] = new CompactionState(group[i]);
+    compacts[i]->smallest_snapshot = (snapshots_.empty() ? versions_->LastSequence()
+                                                          : snapshots_.oldest()->number_);
+    inputs[i] = versions_->MakeInputIteratorWithoutLevel0(group[i], mems[i], versions_->LastSequence());
+  }
+  nvmems_->isCompactingLevel0_ = true;
+  mutex_.Unlock();
+
+  std::vector<Status> status(n);
+  std::vector<int64_t> imm_micros(n, 0);
+  std::vector<std::thread> workers;
+  for (size_t i = 1; i < n; ++i)
+    workers.push_back(std::thread([&, i]() {
+      status[i] = CompactInput(compacts[i], inputs[i], &imm_micros[i]);
+    }));
+  status[0] = CompactInput(compacts[0], inputs[0], &imm_micros[0]);
+  for (size_t i = 0; i < workers.size(); ++i)
+    workers[i].join();
+
+  mutex_.Lock();
+  Status s;
+  CompactionStats stats;
+  stats.micros = env_->NowMicros() - start_micros;
+  for (size_t i = 0; i < n; ++i) {
+    if (s.ok()) s = status[i];
+    stats.bytes_read += mems[i]->StorageUsage();
+    for (int j = 0; j < group[i]->num_input_files(1); j++)
+      stats.bytes_read += group[i]->input(1, j)->file_size;
+    for (size_t j = 0; j < compacts[i]->outputs.size(); j++)
+      stats.bytes_written += compacts[i]->outputs[j].file_size;
+  }
+  stats_[1].Add(stats);
+
+  if (s.ok()) {
+    VersionEdit* edit = group[0]->edit();
+    for (size_t i = 0; i < n; ++i) {
+      group[i]->AddInputDeletions(edit);
+      for (size_t j = 0; j < compacts[i]->outputs.size(); j++) {
+        const CompactionState::Output& out = compacts[i]->outputs[j];
+        edit->AddFile(1, out.number, out.file_size, out.smallest, out.largest);
+      }
+    }
+    s = versions_->LogAndApply(edit, &mutex_);
+  }
+  if (s.ok()) {
+    for (size_t i = 0; i < n; ++i) {
+      nvMemTable* tmp = nvmems_->PopFromLevel0();
+      assert(tmp == mems[i]);
+    }
+    for (size_t i = 0; i < n; ++i)
+      nvmems_->ReleaseLevel0(mems[i]);
+    RecordLevel0Flush(n, stats.micros);
+  } else if (!shutting_down_.Acquire_Load()) {
+    RecordBackgroundError(s);
+    Log(options_.info_log, "Compaction error: %s", s.ToString().c_str());
+  }
+  // The memtables stay in level 0 on an error, but no flush is running.
+  nvmems_->isCompactingLevel0_ = false;
+  for (size_t i = 0; i < n; ++i) {
+    CleanupCompaction(compacts[i]);
+    group[i]->ReleaseInputs();
+    delete group[i];
+  }
+  DeleteObsoleteFiles();
+  VersionSet::LevelSummaryStorage tmp;
+  Log(options_.info_log,
+      "compacted to: %s", versions_->LevelSummary(&tmp));
+}
+
+Status DBImpl::DoCompactionWork(CompactionState* compact) {
+  const uint64_t start_micros = env_->NowMicros();
+  int64_t imm_micros = 0;  // Micros spent doing imm_ compactions
+
+  Log(options_.info_log,  "Compacting %d@%d + %d@%d files",
+      compact->compaction->num_input_files(0),
+      compact->compaction->level(),
+      compact->compaction->num_input_files(1),
+      compact->compaction->level() + 1);
+
+  if (compact->compaction->level() == 0 && options_.TEST_no_double_level0)
+      ;
+  else
+      assert(versions_->NumLevelFiles(compact->compaction->level()) > 0);
+  assert(compact->builder == NULL);
+  assert(compact->outfile == NULL);
+  if (compact->compaction->level() == 0 && options_.TEST_no_double_level0) {
+    // A memtable has no sequence numbers of its own: all its entries get
+    // a new one, newer than anything in the levels, or a deletion would
+    // lose to an older value of its key that has the same sequence.
+    versions_->SetLastSequence(versions_->LastSequence() + 1);
+  }
+  if (snapshots_.empty()) {
+    compact->smallest_snapshot = versions_->LastSequence();
+  } else {
+    compact->smallest_snapshot = snapshots_.oldest()->number_;
+  }
+
+  // Release mutex while we're actually doing the compaction work
+
+
+  Iterator* input = nullptr;
+  nvMemTable* mem = nullptr;
+  if (compact->compaction->level() == 0 && options_.TEST_no_double_level0) {
+      nvmems_->level0_.lock_.ReadLock();
+      nvmems_->level0_.Front(&mem);
+      nvmems_->level0_.lock_.Unlock();
+      input = versions_->MakeInputIteratorWithoutLevel0(compact->compaction, mem, versions_->LastSequence());
+      nvmems_->isCompactingLevel0_ = true;
+      mutex_.Unlock();
+  } else {
+      mutex_.Unlock();
+      input = versions_->MakeInputIterator(compact->compaction);
+  }
+  Status status = CompactInput(compact, input, &imm_micros);
 
   CompactionStats stats;
   stats.micros = env_->NowMicros() - start_micros - imm_micros;
@@ -1194,17 +1360,17 @@ Status DBImpl::DoCompactionWork(CompactionState* compact) {
   if (status.ok()) {
     status = InstallCompactionResults(compact);
     if (mem != nullptr) {
-        nvMemTable* tmp = nullptr;
-        nvmems_->level0_.lock_.WriteLock();
-        nvmems_->level0_.PopFront(&tmp);
-        nvmems_->level0_.lock_.Unlock();
+        nvMemTable* tmp = nvmems_->PopFromLevel0();
         assert( mem == tmp );
         //assert( mem == nvmems_->level0_.front() );
         //nvmems_->level0_.pop_front();
-        mem->Unref();   // Delete level 0 file.
-        nvmems_->isCompactingLevel0_ = false;
+        nvmems_->ReleaseLevel0(mem);   // Delete level 0 file.
+        RecordLevel0Flush(1, stats.micros);
     }
   }
+  if (mem != nullptr) {
+    nvmems_->isCompactingLevel0_ = false;
+  }
   if (!status.ok()) {
     RecordBackgroundError(status);
   }
@@ -1284,17 +1450,19 @@ Iterator* DBImpl::NewInternalIterator_MultiVersion(const ReadOptions& options,
                                       SequenceNumber* latest_snapshot,
                                       uint32_t* seed) {
   IterState_MultiVersion* cleanup = new IterState_MultiVersion;
-  nvmems_->rwlock_.WriteLock();
-  mutex_.Lock();
   if (options_.TEST_nvm_accelerate_method == BUFFER_WITH_LOG) {
+      // Buffered writes reach the memtables only once drained.
+      nvmems_->rwlock_.WriteLock();
       nvmems_->ClearWriteBuffer();
+      nvmems_->rwlock_.Unlock();
   }
-  *latest_snapshot = versions_->LastSequence();
+  mutex_.Lock();
 
-  // Collect together all needed child iterators
+  // Collect together all needed child iterators.  The memtables are pinned
+  // by reference, writers go on; mutex_ keeps a level 0 flush from
+  // finishing between them and the version.
   std::vector<Iterator*> list;
-  list.push_back(nvmems_->NewIterator());
-  //nvmems_->ProtectAllMemtable();
+  *latest_snapshot = nvmems_->AddIterators(versions_->LastSequence(), &list);
 
   if (imm_ != NULL) {
     list.push_back(imm_->NewIterator());
@@ -1314,7 +1482,6 @@ Iterator* DBImpl::NewInternalIterator_MultiVersion(const ReadOptions& options,
 
   *seed = ++seed_;
   mutex_.Unlock();
-  nvmems_->rwlock_.Unlock();
   return internal_iter;
 }
 
@@ -1329,6 +1496,10 @@ int64_t DBImpl::TEST_MaxNextLevelOverlappingBytes() {
   return versions_->MaxNextLevelOverlappingBytes();
 }
 
+size_t DBImpl::TEST_NumLevel0MemTables() {
+  return nvmems_->level0_.Size();
+}
+
 Status DBImpl::GetOld(const ReadOptions& options,
                       const Slice& key,
                       std::string* value) {
@@ -1457,30 +1628,104 @@ Status DBImpl::Get(const ReadOptions& options,
                 versions_->LastSequence();
 
     LookupKey lkey(key, snapshot);
-    nvmems_->rwlock_.ReadLock();
-    nvMemTable* mem = nvmems_->WhereIs(key);
-    if (mem->Get(lkey, value, &s)) {
-        nvmems_->rwlock_.Unlock();
-    } else if (nvmems_->GetInLevel0(lkey, value, &s)) {
-        nvmems_->rwlock_.Unlock();
-    } else {
-        nvmems_->rwlock_.Unlock();
+    if (!nvmems_->Get(lkey, value, &s))
+        s = GetFromVersion(options, lkey, value);
+    return s;
+}
 
-        mutex_.Lock();
-        Version* current = versions_->current();
-        Version::GetStats stats;
-        current->Ref();
-        mutex_.Unlock();
+// Values in the nvMemTables are pinned in place; those in table files are
+// copied, the block cache may drop their blocks at any time.
+Status DBImpl::Get(const ReadOptions& options,
+                   const Slice& key,
+                   PinnableSlice* value) {
+    if (options_.TEST_nvm_accelerate_method != MULTI_MEMTABLE)
+        return DB::Get(options, key, value);
+    value->Reset();
+    Status s = Status::OK();
+    SequenceNumber snapshot = options.snapshot != NULL ?
+                reinterpret_cast<const SnapshotImpl*>(options.snapshot)->number_ :
+                versions_->LastSequence();
 
-        s = current->Get(options, lkey, value, &stats);
+    LookupKey lkey(key, snapshot);
+    if (!nvmems_->Get(lkey, value, &s)) {
+        s = GetFromVersion(options, lkey, value->GetSelf());
+        if (s.ok())
+            value->PinSelf();
+    }
+    return s;
+}
 
-        mutex_.Lock();
-        if (current->UpdateStats(stats))
-          MaybeScheduleCompaction();
+namespace {
+bool UserKeyLess(const KeyContext& a, const KeyContext& b) {
+    return a.key->user_key().compare(b.key->user_key()) < 0;
+}
+}
 
-        current->Unref();
-        mutex_.Unlock();
+// The keys go through the memtables, level 0 and the table files in user
+// key order, so that each memtable and each file is visited once.
+std::vector<Status> DBImpl::MultiGet(const ReadOptions& options,
+                                     const std::vector<Slice>& keys,
+                                     std::vector<std::string>* values) {
+    if (options_.TEST_nvm_accelerate_method != MULTI_MEMTABLE)
+        return DB::MultiGet(options, keys, values);
+    size_t n = keys.size();
+    std::vector<Status> s(n);
+    values->resize(n);
+    if (n == 0)
+        return s;
+    SequenceNumber snapshot = options.snapshot != NULL ?
+                reinterpret_cast<const SnapshotImpl*>(options.snapshot)->number_ :
+                versions_->LastSequence();
+
+    std::deque<LookupKey> lkeys;    // LookupKey can not be copied.
+    std::vector<KeyContext> ctx(n);
+    for (size_t i = 0; i < n; ++i) {
+        lkeys.emplace_back(keys[i], snapshot);
+        ctx[i].key = &lkeys.back();
+        ctx[i].value = &(*values)[i];
+        ctx[i].s = &s[i];
+        ctx[i].found = false;
     }
+    std::sort(ctx.begin(), ctx.end(), UserKeyLess);
+
+    if (nvmems_->MultiGet(&ctx[0], n))
+        return s;
+
+    mutex_.Lock();
+    Version* current = versions_->current();
+    current->Ref();
+    mutex_.Unlock();
+
+    std::vector<Version::GetStats> stats(n);
+    current->MultiGet(options, &ctx[0], n, &stats[0]);
+
+    mutex_.Lock();
+    bool schedule = false;
+    for (size_t i = 0; i < n; ++i)
+        schedule |= current->UpdateStats(stats[i]);
+    if (schedule)
+        MaybeScheduleCompaction();
+    current->Unref();
+    mutex_.Unlock();
+    return s;
+}
+
+Status DBImpl::GetFromVersion(const ReadOptions& options, const LookupKey& lkey,
+                              std::string* value) {
+    mutex_.Lock();
+    Version* current = versions_->current();
+    Version::GetStats stats;
+    current->Ref();
+    mutex_.Unlock();
+
+    Status s = current->Get(options, lkey, value, &stats);
+
+    mutex_.Lock();
+    if (current->UpdateStats(stats))
+      MaybeScheduleCompaction();
+
+    current->Unref();
+    mutex_.Unlock();
     return s;
 }
 
@@ -1590,14 +1835,28 @@ Status DBImpl::WriteLogFree(const WriteOptions& options, WriteBatch* my_batch) {
             mem->Unlock();
 
             nvmems_->rwlock_.Unlock();
+            DelayLevel0Write();
             {
                 nvmems_->rwlock_.WriteLock();
                 mutex_.Lock();
                 mem = nvmems_->WhereIs(key);
                 mem->Lock();
 
-                MakeRoomForWrite(mem->LeftBound());
-                nvmems_->Pop(versions_->current(), mem->LeftBound());
+                Status s = MakeRoomForWrite(mem->LeftBound());
+                if (!s.ok()) {
+                    // No room will come after a background error: thaw the
+                    // memtable, so that the writers spinning on it fail too.
+                    mem->SetImmutable(false);
+                    mem->Unlock();
+                    mutex_.Unlock();
+                    nvmems_->rwlock_.Unlock();
+                    return s;
+                }
+                const bool popped = nvmems_->Pop(versions_->current(), mem->LeftBound());
+                if (!popped) {
+                    mem->Ref();
+                    mem->Unlock();
+                }
                 MaybeScheduleCompaction();
 
                 ll freeze_end = GetNano();
@@ -1605,6 +1864,10 @@ Status DBImpl::WriteLogFree(const WriteOptions& options, WriteBatch* my_batch) {
 
                 mutex_.Unlock();
                 nvmems_->rwlock_.Unlock();
+                if (!popped) {
+                    nvmems_->CollectGarbage(mem);
+                    mem->Unref();
+                }
             }
         }
 
@@ -1666,7 +1929,7 @@ Status DBImpl::WriteMultiCache(const WriteOptions& options, WriteBatch* my_batch
         input.remove_prefix(12);
         Slice key, value;
         int found = 0;
-        while (!input.empty()) {
+        while (status.ok() && !input.empty()) {
           found++;
           char tag = input[0];
           input.remove_prefix(1);
@@ -1714,6 +1977,7 @@ Status DBImpl::WriteMultiCache(const WriteOptions& options, WriteBatch* my_batch
               }
               //nvmems_->oprs_++;
               nvmems_->rwlock_.Unlock();
+              DelayLevel0Write();
 
               nvmems_->rwlock_.WriteLock();
               mutex_.Lock();
@@ -1722,8 +1986,16 @@ Status DBImpl::WriteMultiCache(const WriteOptions& options, WriteBatch* my_batch
               //current->Ref();
               //mutex_.Unlock();
               nvmems_->ClearWriteBuffer();
-              MakeRoomForWrite(mem->LeftBound());
-              nvmems_->Pop(current, mem->LeftBound());
+              status = MakeRoomForWrite(mem->LeftBound());
+              if (!status.ok()) {
+                  mutex_.Unlock();
+                  nvmems_->rwlock_.Unlock();
+                  break;
+              }
+              // Background writers add without locks: compact mem while
+              // their queues are drained.
+              if (!nvmems_->Pop(current, mem->LeftBound()))
+                  mem->GarbageCollection();
               MaybeScheduleCompaction();
               //MakeRoomForWrite(false);
               //mutex_.Lock();
@@ -1734,10 +2006,8 @@ Status DBImpl::WriteMultiCache(const WriteOptions& options, WriteBatch* my_batch
               nvmems_->rwlock_.Unlock();
           }
         }
-        if (found != counts) {
+        if (status.ok() && found != counts) {
           status = Status::Corruption("WriteBatch has wrong count");
-        } else {
-          status = Status::OK();
         }
         if (updates == tmp_batch_)
             tmp_batch_->Clear();
@@ -1802,10 +2072,18 @@ Status DBImpl::WriteMultiMemTableSequentially(const WriteOptions& options, Write
             if (mem->HasRoomForWrite(key, value, level0_size == 0))
                 break;
             ll freeze_start = GetNano();
+            bool popped;
             {
                 mutex_.Lock();
-                MakeRoomForWrite(mem->LeftBound());
-                nvmems_->Pop(versions_->current(), mem->LeftBound());
+                Status s = MakeRoomForWrite(mem->LeftBound());
+                if (!s.ok()) {
+                    mutex_.Unlock();
+                    nvmems_->rwlock_.Unlock();
+                    return s;
+                }
+                popped = nvmems_->Pop(versions_->current(), mem->LeftBound());
+                if (!popped)
+                    mem->Ref();
                 MaybeScheduleCompaction();
                 mutex_.Unlock();
             }
@@ -1813,6 +2091,10 @@ Status DBImpl::WriteMultiMemTableSequentially(const WriteOptions& options, Write
             nvmems_->global_ic_.CompactionTime(freeze_end - freeze_start);
 
             nvmems_->rwlock_.Unlock();
+            if (!popped) {
+                nvmems_->CollectGarbage(mem);
+                mem->Unref();
+            }
         }
 
         nvmems_->ByteCount(key.size() + (tag == kTypeDeletion ? 0 : value.size()) + 32);
@@ -1824,6 +2106,91 @@ Status DBImpl::WriteMultiMemTableSequentially(const WriteOptions& options, Write
     assert(found == total);
     return Status::OK();
 }
+Status DBImpl::LockMemTableForWrite(const Slice& key, const Slice& value,
+                                    nvMemTable** result) {
+    nvMemTable* mem = nullptr;
+    while (true) {
+        nvmems_->rwlock_.ReadLock();
+        mem = nvmems_->WhereIs(key);
+
+        const bool shared = mem->ConcurrentAdd();
+        if (shared)
+            mem->SharedLock();
+        else
+            mem->Lock();
+        if (mem->Immutable()) {
+            mem->Unlock();
+            nvmems_->rwlock_.Unlock();
+            env_->SleepForMicroseconds(1);
+            continue;
+        }
+
+        mem->Ref();
+        if (mem->HasRoomForWrite(key, value, nvmems_->level0_.Size() == 0))
+            break;
+        if (shared) {
+            // Only one writer may freeze the table: wait for the others
+            // to finish their adds and check again.
+            mem->Unlock();
+            mem->Lock();
+            if (mem->Immutable()) {
+                mem->Unref();
+                mem->Unlock();
+                nvmems_->rwlock_.Unlock();
+                env_->SleepForMicroseconds(1);
+                continue;
+            }
+            if (mem->HasRoomForWrite(key, value, nvmems_->level0_.Size() == 0))
+                break;
+        }
+        ll freeze_start = GetNano();
+        mem->SetImmutable(true);
+        mem->Unref();
+
+        mem->Unlock();
+
+        nvmems_->rwlock_.Unlock();
+        DelayLevel0Write();
+        {
+            nvmems_->rwlock_.WriteLock();
+            mutex_.Lock();
+            mem = nvmems_->WhereIs(key);
+            mem->Lock();
+
+            Status s = MakeRoomForWrite(mem->LeftBound());
+            if (!s.ok()) {
+                // No room will come after a background error: thaw the
+                // memtable, so that the writers spinning on it fail too.
+                mem->SetImmutable(false);
+                mem->Unlock();
+                mutex_.Unlock();
+                nvmems_->rwlock_.Unlock();
+                return s;
+            }
+            const bool popped = nvmems_->Pop(versions_->current(), mem->LeftBound());
+            if (!popped) {
+                mem->Ref();
+                mem->Unlock();
+            }
+            MaybeScheduleCompaction();
+
+            ll freeze_end = GetNano();
+            nvmems_->global_ic_.CompactionTime(freeze_end - freeze_start);
+
+            mutex_.Unlock();
+            nvmems_->rwlock_.Unlock();
+            if (!popped) {
+                nvmems_->CollectGarbage(mem);
+                mem->Unref();
+            }
+        }
+    }
+
+    nvmems_->ByteCount(key.size() + value.size() + 32);
+    nvmems_->rwlock_.Unlock();
+    *result = mem;
+    return Status::OK();
+}
 Status DBImpl::WriteMultiMemTable(const WriteOptions& options, WriteBatch* my_batch) {
     size_t total = WriteBatchInternal::Count(my_batch);
     Slice input(my_batch->rep_);
@@ -1851,60 +2218,162 @@ Status DBImpl::WriteMultiMemTable(const WriteOptions& options, WriteBatch* my_ba
             value = Slice();
         }
         nvMemTable* mem = nullptr;
-        while (true) {
-            nvmems_->rwlock_.ReadLock();
-            mem = nvmems_->WhereIs(key);
+        Status s = LockMemTableForWrite(key, value, &mem);
+        if (!s.ok())
+            return s;
 
-            mem->Lock();
-            if (mem->Immutable()) {
-                mem->Unlock();
-                nvmems_->rwlock_.Unlock();
-                env_->SleepForMicroseconds(1);
-                continue;
-            }
+        //write_mutex_.Unlock();
 
-            mem->Ref();
-            if (mem->HasRoomForWrite(key, value, nvmems_->level0_.Size() == 0))
-                break;
-            ll freeze_start = GetNano();
-            mem->SetImmutable(true);
-            mem->Unref();
+        mem->Add(0, tag == kTypeValue ? kTypeValue : kTypeDeletion,
+                 key, value);
+        mem->Unref();
+        mem->Unlock();
 
-            mem->Unlock();
+    }
 
-            nvmems_->rwlock_.Unlock();
-            {
-                nvmems_->rwlock_.WriteLock();
-                mutex_.Lock();
-                mem = nvmems_->WhereIs(key);
-                mem->Lock();
+    assert(found == total);
+    return Status::OK();
+}
 
-                MakeRoomForWrite(mem->LeftBound());
-                nvmems_->Pop(versions_->current(), mem->LeftBound());
-                MaybeScheduleCompaction();
+namespace {
+// One update of a grouped MULTI_MEMTABLE write.
+struct GroupUpdate {
+    ValueType type;
+    Slice key;
+    Slice value;
+    nvMemTable* mem;    // Where key went when the group was sorted.
+};
+struct GroupUpdateMemTableLess {
+    bool operator()(const GroupUpdate& a, const GroupUpdate& b) const {
+        return std::less<nvMemTable*>()(a.mem, b.mem);
+    }
+};
+void SortByMemTable(nvMultiTable* nvmems, std::vector<GroupUpdate>::iterator begin,
+                    std::vector<GroupUpdate>::iterator end) {
+    for (std::vector<GroupUpdate>::iterator u = begin; u != end; ++u)
+        u->mem = nvmems->WhereIs(u->key);
+    // Stable: updates of one key keep their order.
+    std::stable_sort(begin, end, GroupUpdateMemTableLess());
+}
+}  // namespace
 
-                ll freeze_end = GetNano();
-                nvmems_->global_ic_.CompactionTime(freeze_end - freeze_start);
+Status DBImpl::ApplyMultiMemTableGroup(WriteBatch* updates) {
+    const int total = WriteBatchInternal::Count(updates);
+    Slice input(updates->rep_);
+    static const int kHeader = 12;
+    input.remove_prefix(kHeader); // kHeader = 12;
+    std::vector<GroupUpdate> group(total);
+    std::vector<std::string> key_hashed(options_.TEST_key_hash ? total : 0);
+    int found = 0;
+    while (!input.empty()) {
+        if (found == total)
+            return Status::Corruption("WriteBatch has wrong count");
+        GroupUpdate& u = group[found];
+        char tag = input[0];
+        input.remove_prefix(1);
+        if (!GetLengthPrefixedSlice(&input, &u.key))
+            return Status::Corruption("bad WriteBatch Put");
+        if (options_.TEST_key_hash) {
+            KeyHash(u.key.ToString(), &key_hashed[found]);
+            u.key = key_hashed[found];
+        }
+        if (tag == kTypeValue) {
+            if (!GetLengthPrefixedSlice(&input, &u.value))
+                return Status::Corruption("bad WriteBatch Put");
+            u.type = kTypeValue;
+        } else {
+            u.value = Slice();
+            u.type = kTypeDeletion;
+        }
+        found++;
+    }
+    if (found != total)
+        return Status::Corruption("WriteBatch has wrong count");
 
-                mutex_.Unlock();
-                nvmems_->rwlock_.Unlock();
+    // Holding rwlock_ keeps the key -> memtable mapping of the sort valid.
+    nvmems_->rwlock_.ReadLock();
+    SortByMemTable(nvmems_, group.begin(), group.end());
+    const bool nearly_full = nvmems_->level0_.Size() == 0;
+    std::vector<GroupUpdate>::iterator u = group.begin();
+    while (u != group.end()) {
+        nvMemTable* mem = u->mem;
+        std::vector<GroupUpdate>::iterator v = u;
+        if (mem->ConcurrentAdd())
+            mem->SharedLock();
+        else
+            mem->Lock();
+        if (!mem->Immutable()) {
+            mem->Ref();
+            for (; v != group.end() && v->mem == mem &&
+                   mem->HasRoomForWrite(v->key, v->value, nearly_full); ++v) {
+                nvmems_->ByteCount(v->key.size() + v->value.size() + 32);
+                mem->Add(0, v->type, v->key, v->value);
             }
+            mem->Unref();
         }
-
-        nvmems_->ByteCount(key.size() + (tag == kTypeDeletion ? 0 : value.size()) + 32);
+        mem->Unlock();
+        if (v != u) {
+            u = v;
+            continue;
+        }
+        // The memtable is full or being replaced: write this update on its
+        // own, which makes room, and sort the rest again.
         nvmems_->rwlock_.Unlock();
-
-        //write_mutex_.Unlock();
-
-        mem->Add(0, tag == kTypeValue ? kTypeValue : kTypeDeletion,
-                 key, value);
+        Status s = LockMemTableForWrite(u->key, u->value, &mem);
+        if (!s.ok())
+            return s;
+        mem->Add(0, u->type, u->key, u->value);
         mem->Unref();
         mem->Unlock();
+        ++u;
+        nvmems_->rwlock_.ReadLock();
+        SortByMemTable(nvmems_, u, group.end());
+    }
+    nvmems_->rwlock_.Unlock();
+    return Status::OK();
+}
+
+Status DBImpl::WriteMultiMemTableGroup(const WriteOptions& options, WriteBatch* my_batch) {
+    Writer w(&write_mutex_);
+    w.batch = my_batch;
+    w.sync = options.sync;
+    w.done = false;
 
+    MutexLock l(&write_mutex_);
+    writers_.push_back(&w);
+    while (!w.done && &w != writers_.front()) {
+        w.cv.Wait();
+    }
+    if (w.done) {
+        return w.status;
     }
 
-    assert(found == total);
-    return Status::OK();
+    Writer* last_writer = &w;
+    WriteBatch* updates = BuildBatchGroup(&last_writer);
+    // Later writers queue up meanwhile and form the next group.
+    write_mutex_.Unlock();
+    Status status = ApplyMultiMemTableGroup(updates);
+    write_mutex_.Lock();
+    if (updates == tmp_batch_)
+        tmp_batch_->Clear();
+
+    while (true) {
+        Writer* ready = writers_.front();
+        writers_.pop_front();
+        if (ready != &w) {
+            ready->status = status;
+            ready->done = true;
+            ready->cv.Signal();
+        }
+        if (ready == last_writer) break;
+    }
+
+    // Notify new head of write queue
+    if (!writers_.empty()) {
+        writers_.front()->cv.Signal();
+    }
+
+    return status;
 }
 Status DBImpl::Write(const WriteOptions& options, WriteBatch* my_batch) {
     if (my_batch == nullptr)
@@ -1914,6 +2383,8 @@ Status DBImpl::Write(const WriteOptions& options, WriteBatch* my_batch) {
         ul level0_size = nvmems_->level0_.Size();
         if (level0_size * 2 >= nvmems_->cache_policy_.standard_immutablequeue_size_)
             return WriteMultiMemTableSequentially(options, my_batch, level0_size);
+        else if (options_.TEST_group_commit)
+            return WriteMultiMemTableGroup(options, my_batch);
         else
             return WriteMultiMemTable(options, my_batch);
     }
@@ -1973,33 +2444,67 @@ WriteBatch* DBImpl::BuildBatchGroup(Writer** last_writer) {
   return result;
 }
 
+// Used until a level 0 flush has been timed.
+static const uint64_t kDefaultLevel0FlushMicros = 1000;
+
+uint64_t DBImpl::Level0SlowdownMicros() {
+  mutex_.AssertHeld();
+  const ll standard = nvmems_->cache_policy_.standard_immutablequeue_size_;
+  const ll size = std::max<ll>(nvmems_->level0_.Size(),
+                               standard - 1 - nvmems_->RoomForNewMems());
+  if (size * 2 < standard || size >= standard)
+    return 0;
+  const double flush_micros = level0_flush_micros_ > 0 ? level0_flush_micros_
+                                                       : kDefaultLevel0FlushMicros;
+  const ll half = standard / 2;
+  return static_cast<uint64_t>(flush_micros * (size - half + 1) / (standard - half + 1));
+}
+
+void DBImpl::DelayLevel0Write() {
+  mutex_.Lock();
+  const uint64_t delay = Level0SlowdownMicros();
+  if (delay > 0 && nvmems_->isCompactingLevel0_ == false)
+    MaybeScheduleCompaction();
+  mutex_.Unlock();
+  if (delay > 0)
+    env_->SleepForMicroseconds(delay);
+}
+
+void DBImpl::RecordLevel0Flush(size_t n, uint64_t micros) {
+  mutex_.AssertHeld();
+  const double flush_micros = 1. * micros / n;
+  if (level0_flush_micros_ == 0)
+    level0_flush_micros_ = flush_micros;
+  else
+    level0_flush_micros_ = 0.75 * level0_flush_micros_ + 0.25 * flush_micros;
+  bg_cv_.SignalAll();  // Wakeup MakeRoomForWrite() if necessary
+}
+
 // REQUIRES: mutex_ is held
 // REQUIRES: this thread is currently at the front of the writer queue
 Status DBImpl::MakeRoomForWrite(const Slice& except) {
   mutex_.AssertHeld();
   ul standard = nvmems_->cache_policy_.standard_immutablequeue_size_;
-  if (nvmems_->level0_.Size() * 2 >= standard) {
-      if (nvmems_->isCompactingLevel0_ == false)
-          MaybeScheduleCompaction();
-      mutex_.Unlock();
-      env_->SleepForMicroseconds(1000);
-      mutex_.Lock();
-  }
-  while (nvmems_->level0_.Size() >= standard || !nvmems_->HasRoomForNewMem()) {
+  bool stalled = false;
+  while (bg_error_.ok() &&
+         (nvmems_->level0_.Size() >= standard || !nvmems_->HasRoomForNewMem())) {
       if (nvmems_->level0_.Size() == 0 && !nvmems_->HasRoomForNewMem()) {
           Slice exc = except;
           nvmems_->ForcePop(nullptr, &exc);
+          // An empty victim is dropped without queueing a flush, and then
+          // nothing would wake us: check again before waiting.
+          continue;
       }
       if (nvmems_->isCompactingLevel0_ == false)
           MaybeScheduleCompaction();
-      fprintf(stderr, "Level 0 Full. Triger delay = 100ms.\n");
-      fflush(stderr);
-      mutex_.Unlock();
-      env_->SleepForMicroseconds(100000);
-      mutex_.Lock();
+      if (!stalled) {
+          Log(options_.info_log, "Level 0 full, waiting for a flush...\n");
+          stalled = true;
+      }
+      bg_cv_.Wait();
   }
 
-  return Status::OK();
+  return bg_error_;
 }
 
 bool DBImpl::GetProperty(const Slice& property, std::string* value) {
@@ -2111,12 +2616,39 @@ Status DB::Delete(const WriteOptions& opt, const Slice& key) {
   return Write(opt, &batch);
 }
 
+std::vector<Status> DB::MultiGet(const ReadOptions& options,
+                                 const std::vector<Slice>& keys,
+                                 std::vector<std::string>* values) {
+  values->resize(keys.size());
+  std::vector<Status> s(keys.size());
+  for (size_t i = 0; i < keys.size(); i++) {
+    s[i] = Get(options, keys[i], &(*values)[i]);
+  }
+  return s;
+}
+
+Status DB::Get(const ReadOptions& options, const Slice& key, PinnableSlice* value) {
+  value->Reset();
+  Status s = Get(options, key, value->GetSelf());
+  if (s.ok()) {
+    value->PinSelf();
+  }
+  return s;
+}
+
 DB::~DB() { }
 
 Status DB::Open(const Options& options, const std::string& dbname,
                 DB** dbptr) {
   *dbptr = NULL;
 
+  if (!options.TEST_nvm_file_path.empty()) {
+    Status s = options.env->UseNVMFile(options.TEST_nvm_file_path,
+                                       options.TEST_nvm_file_size);
+    if (!s.ok()) {
+      return s;
+    }
+  }
   DBImpl* impl = new DBImpl(options, dbname);
   impl->mutex_.Lock();
   VersionEdit edit;
@@ -2154,6 +2686,13 @@ Snapshot::~Snapshot() {
 
 Status DestroyDB(const std::string& dbname, const Options& options) {
   Env* env = options.env;
+  if (!options.TEST_nvm_file_path.empty()) {
+    Status s = env->UseNVMFile(options.TEST_nvm_file_path,
+                               options.TEST_nvm_file_size);
+    if (!s.ok()) {
+      return s;
+    }
+  }
   std::vector<std::string> filenames;
   // Ignore error in case directory does not exist
   env->GetChildren(dbname, &filenames);
@@ -2165,6 +2704,8 @@ Status DestroyDB(const std::string& dbname, const Options& options) {
   const std::string lockname = LockFileName(dbname);
   Status result = env->LockFile(lockname, &lock);
   if (result.ok()) {
+    if (env->NVM_Env() != nullptr)
+      nvMultiTableRoot::Destroy(env->NVM_Env()->mng_, dbname);
     uint64_t number;
     FileType type;
     for (size_t i = 0; i < filenames.size(); i++) {
@@ -39,7 +39,12 @@ class DBImpl : public DB {
   virtual Status WriteMultiCache(const WriteOptions& options, WriteBatch* updates);
   virtual Status WriteMultiMemTable(const WriteOptions& options, WriteBatch* updates);
   virtual Status WriteMultiMemTableSequentially(const WriteOptions& options, WriteBatch* updates, ul level0_size);
+  virtual Status WriteMultiMemTableGroup(const WriteOptions& options, WriteBatch* updates);
   virtual Status Get(const ReadOptions& options, const Slice& key, std::string* value);
+  virtual Status Get(const ReadOptions& options, const Slice& key, PinnableSlice* value);
+  virtual std::vector<Status> MultiGet(const ReadOptions& options,
+                                       const std::vector<Slice>& keys,
+                                       std::vector<std::string>* values);
   virtual Status GetOld(const ReadOptions& options, const Slice& key, std::string* value);
   virtual Iterator* NewIterator(const ReadOptions&);
   virtual const Snapshot* GetSnapshot();
@@ -71,6 +76,9 @@ class DBImpl : public DB {
   // file at a level >= 1.
   int64_t TEST_MaxNextLevelOverlappingBytes();
 
+  // Return the number of nvMemTables waiting in level 0.
+  size_t TEST_NumLevel0MemTables();
+
   // Record a sample of bytes read at the specified internal key.
   // Samples are taken approximately once every config::kReadBytesPeriod
   // bytes.
@@ -90,6 +98,10 @@ class DBImpl : public DB {
 
   Status NewDB();
 
+  // Look lkey up in the table files of the current version.
+  Status GetFromVersion(const ReadOptions& options, const LookupKey& lkey,
+                        std::string* value);
+
   // Recover the descriptor from persistent storage.  May do a significant
   // amount of work to recover recently logged updates.  Any changes to
   // be made to the descriptor are added to *edit.
@@ -116,7 +128,25 @@ class DBImpl : public DB {
 
   Status MakeRoomForWrite(const Slice& except);
       EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  // Microseconds a writer waits before it queues one more memtable into
+  // level 0: none below half full, then a growing share of the time a
+  // flush takes, so writers slow down to the flush rate before they stop.
+  // NVM running out of room for memtables counts as level 0 filling up.
+  uint64_t Level0SlowdownMicros() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  // Waits Level0SlowdownMicros() holding no lock, so that only the writers
+  // of the memtable being frozen wait with it.
+  void DelayLevel0Write();
+  // Account n level 0 memtables flushed in micros and wake up the writers
+  // waiting for room in level 0.
+  void RecordLevel0Flush(size_t n, uint64_t micros)
+      EXCLUSIVE_LOCKS_REQUIRED(mutex_);
   WriteBatch* BuildBatchGroup(Writer** last_writer);
+  // Stores in *result the memtable key goes to, referenced and locked for
+  // an Add() of key and value, freezing and replacing it first if it is
+  // full. Returns the background error if there is no room for a new one.
+  Status LockMemTableForWrite(const Slice& key, const Slice& value,
+                              nvMemTable** result);
+  Status ApplyMultiMemTableGroup(WriteBatch* updates);
 
   void RecordBackgroundError(const Status& s);
 
@@ -129,6 +159,12 @@ class DBImpl : public DB {
       EXCLUSIVE_LOCKS_REQUIRED(mutex_);
   Status DoCompactionWork(CompactionState* compact)
       EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  Status CompactInput(CompactionState* compact, Iterator* input,
+                      int64_t* imm_micros);
+  void PickLevel0Group(std::vector<Compaction*>* group)
+      EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  void FlushLevel0Group(const std::vector<Compaction*>& group)
+      EXCLUSIVE_LOCKS_REQUIRED(mutex_);
 
   Status OpenCompactionOutputFile(CompactionState* compact);
   Status FinishCompactionOutputFile(CompactionState* compact, Iterator* input);
@@ -181,6 +217,10 @@ class DBImpl : public DB {
   // Has a background compaction been scheduled or is running?
   bool bg_compaction_scheduled_;
 
+  // Microseconds a level 0 flush takes per memtable, a moving average;
+  // 0 until the first flush.
+  double level0_flush_micros_;
+
   // Information for a manual compaction
   struct ManualCompaction {
     int level;
@@ -226,6 +226,16 @@ inline LookupKey::~LookupKey() {
   if (start_ != space_) delete[] start_;
 }
 
+// One key of a batched lookup (DB::MultiGet()).  Each stage of the lookup
+// skips the keys already found and sets found once *s, and *value if *s
+// is OK, hold the answer.
+struct KeyContext {
+  const LookupKey* key;
+  std::string* value;
+  Status* s;
+  bool found;
+};
+
 }  // namespace leveldb
 
 #endif  // STORAGE_LEVELDB_DB_DBFORMAT_H_
@@ -0,0 +1,211 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "leveldb/db.h"
+#include "db/db_impl.h"
+#include "util/random.h"
+#include "util/testharness.h"
+#include "util/testutil.h"
+
+namespace leveldb {
+
+// DB::MultiGet() against one Get() per key, over the memtables, level 0
+// and the table files.
+class MultiGetTest {
+ public:
+  std::string dbname_;
+  Options options_;
+  DB* db_;
+  Random rnd_;
+
+  MultiGetTest() : rnd_(test::RandomSeed()) {
+    dbname_ = test::TmpDir() + "/multiget_test";
+    DestroyDB(dbname_, Options());
+    options_.create_if_missing = true;
+    options_.TEST_max_nvm_buffer_size = 32ULL << 20;
+    options_.TEST_nvm_buffer_reserved = 8ULL << 20;
+    options_.TEST_max_dram_buffer_size = 4ULL << 20;
+    db_ = NULL;
+    ASSERT_OK(DB::Open(options_, dbname_, &db_));
+  }
+
+  ~MultiGetTest() {
+    delete db_;
+    DestroyDB(dbname_, Options());
+  }
+
+  DBImpl* dbfull() {
+    return reinterpret_cast<DBImpl*>(db_);
+  }
+
+  std::string Key(int i) {
+    char buf[100];
+    snprintf(buf, sizeof(buf), "key%07d", i);
+    return std::string(buf);
+  }
+
+  std::string Value(int i, int round) {
+    char buf[100];
+    snprintf(buf, sizeof(buf), "%07d.%d.", i, round);
+    return std::string(buf) + std::string(100, 'a' + round % 26);
+  }
+
+  int NumTableFiles() {
+    int result = 0;
+    for (int level = 0; level < config::kNumLevels; level++) {
+      std::string property;
+      ASSERT_TRUE(db_->GetProperty(
+          "leveldb.num-files-at-level" + NumberToString(level), &property));
+      result += atoi(property.c_str());
+    }
+    return result;
+  }
+
+  // Look keys up with both and compare every status and value.
+  void Check(const std::vector<std::string>& keys) {
+    std::vector<Slice> slices(keys.begin(), keys.end());
+    std::vector<std::string> values(3, "junk");
+    std::vector<Status> s = db_->MultiGet(ReadOptions(), slices, &values);
+    ASSERT_EQ(keys.size(), s.size());
+    ASSERT_EQ(keys.size(), values.size());
+    for (size_t i = 0; i < keys.size(); i++) {
+      std::string expected;
+      Status e = db_->Get(ReadOptions(), keys[i], &expected);
+      ASSERT_EQ(e.ToString(), s[i].ToString());
+      if (e.ok()) {
+        ASSERT_EQ(expected, values[i]);
+      }
+    }
+  }
+
+  // A batch of n keys below limit in random order, with duplicates and
+  // keys that were never written.
+  void CheckRandom(int n, int limit) {
+    std::vector<std::string> keys;
+    for (int i = 0; i < n; i++) {
+      if (i > 0 && rnd_.OneIn(10)) {
+        keys.push_back(keys[rnd_.Uniform(i)]);
+      } else if (rnd_.OneIn(10)) {
+        keys.push_back(Key(rnd_.Uniform(limit)) + "x");
+      } else {
+        keys.push_back(Key(rnd_.Uniform(limit)));
+      }
+    }
+    Check(keys);
+  }
+};
+
+TEST(MultiGetTest, Empty) {
+  std::vector<Slice> keys;
+  std::vector<std::string> values(2);
+  std::vector<Status> s = db_->MultiGet(ReadOptions(), keys, &values);
+  ASSERT_TRUE(s.empty());
+  ASSERT_TRUE(values.empty());
+
+  keys.push_back("foo");
+  s = db_->MultiGet(ReadOptions(), keys, &values);
+  ASSERT_EQ(1, s.size());
+  ASSERT_TRUE(s[0].IsNotFound());
+}
+
+TEST(MultiGetTest, MemTables) {
+  ASSERT_OK(db_->Put(WriteOptions(), "a", "va"));
+  ASSERT_OK(db_->Put(WriteOptions(), "b", "vb"));
+  ASSERT_OK(db_->Put(WriteOptions(), "b", "vb2"));
+  ASSERT_OK(db_->Put(WriteOptions(), "c", "vc"));
+  ASSERT_OK(db_->Delete(WriteOptions(), "c"));
+  ASSERT_OK(db_->Delete(WriteOptions(), "d"));
+
+  std::vector<Slice> keys;
+  keys.push_back("c");
+  keys.push_back("b");
+  keys.push_back("missing");
+  keys.push_back("a");
+  keys.push_back("b");
+  keys.push_back("d");
+  keys.push_back("");
+  std::vector<std::string> values;
+  std::vector<Status> s = db_->MultiGet(ReadOptions(), keys, &values);
+  ASSERT_EQ(7, s.size());
+  ASSERT_TRUE(s[0].IsNotFound());
+  ASSERT_OK(s[1]);
+  ASSERT_EQ("vb2", values[1]);
+  ASSERT_TRUE(s[2].IsNotFound());
+  ASSERT_OK(s[3]);
+  ASSERT_EQ("va", values[3]);
+  ASSERT_OK(s[4]);
+  ASSERT_EQ("vb2", values[4]);
+  ASSERT_TRUE(s[5].IsNotFound());
+  ASSERT_TRUE(s[6].IsNotFound());
+
+  for (int i = 0; i < 1000; i++) {
+    ASSERT_OK(db_->Put(WriteOptions(), Key(i), Value(i, 0)));
+  }
+  for (int i = 0; i < 1000; i += 7) {
+    ASSERT_OK(db_->Delete(WriteOptions(), Key(i)));
+  }
+  for (int i = 0; i < 20; i++) {
+    CheckRandom(1 + rnd_.Uniform(200), 1100);
+  }
+}
+
+TEST(MultiGetTest, AllLevels) {
+  const int kKeys = 100000;
+  // Old values, deleted or overwritten later, until some reach the table
+  // files.
+  int round = 0;
+  while (NumTableFiles() == 0) {
+    ASSERT_LT(round, 20);
+    for (int i = 0; i < kKeys; i++) {
+      ASSERT_OK(db_->Put(WriteOptions(), Key(i), Value(i, round)));
+    }
+    round++;
+  }
+  for (int i = 0; i < 20; i++) {
+    CheckRandom(1 + rnd_.Uniform(200), kKeys + 100);
+  }
+
+  // Deletions and new values in front of them, until level 0 fills up.
+  round++;
+  int written = 0;
+  while (dbfull()->TEST_NumLevel0MemTables() == 0) {
+    ASSERT_LT(written, 20 * kKeys);
+    const int i = rnd_.Uniform(kKeys);
+    if (rnd_.OneIn(5)) {
+      ASSERT_OK(db_->Delete(WriteOptions(), Key(i)));
+    } else {
+      ASSERT_OK(db_->Put(WriteOptions(), Key(i), Value(i, round)));
+    }
+    written++;
+  }
+  for (int i = 0; i < 20; i++) {
+    CheckRandom(1 + rnd_.Uniform(200), kKeys + 100);
+  }
+
+  // A few changes that stay in the memtables.
+  round++;
+  for (int i = 0; i < kKeys; i += 101) {
+    if (i % 2 == 0) {
+      ASSERT_OK(db_->Delete(WriteOptions(), Key(i)));
+    } else {
+      ASSERT_OK(db_->Put(WriteOptions(), Key(i), Value(i, round)));
+    }
+  }
+  std::vector<std::string> keys;
+  for (int i = 0; i < kKeys; i += 101) {
+    keys.push_back(Key(i));
+    keys.push_back(Key(i + 1));
+    keys.push_back(Key(i));
+  }
+  Check(keys);
+  for (int i = 0; i < 20; i++) {
+    CheckRandom(1 + rnd_.Uniform(200), kKeys + 100);
+  }
+}
+
+}  // namespace leveldb
+
+int main(int argc, char** argv) {
+  return leveldb::test::RunAllTests();
+}
@@ -0,0 +1,185 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "nvm_library/myqueue.h"
+#include <atomic>
+#include <thread>
+#include <vector>
+#include "util/testharness.h"
+
+namespace leveldb {
+
+// An element knows who pushed it and carries a check of both in every
+// word, so that a torn copy shows; it is large to make one likelier.
+struct Element {
+  uint32_t producer;
+  uint32_t seq;
+  uint64_t check[127];
+};
+
+static uint64_t Check(uint32_t producer, uint32_t seq) {
+  return (static_cast<uint64_t>(producer) << 32 | seq) * 0x9e3779b97f4a7c15ULL;
+}
+
+static Element MakeElement(uint32_t producer, uint32_t seq) {
+  Element e;
+  e.producer = producer;
+  e.seq = seq;
+  for (int i = 0; i < 127; i++) {
+    e.check[i] = Check(producer, seq);
+  }
+  return e;
+}
+
+static bool Intact(const Element& e) {
+  for (int i = 0; i < 127; i++) {
+    if (e.check[i] != Check(e.producer, e.seq)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+class MyQueueTest { };
+
+TEST(MyQueueTest, Empty) {
+  MyQueue q(4, sizeof(Element));
+  Element e;
+  ASSERT_TRUE(q.Empty());
+  ASSERT_EQ(0, q.Size());
+  ASSERT_TRUE(!q.TryPopFront(&e));
+  ASSERT_TRUE(!q.Ready(q.Head()));
+}
+
+TEST(MyQueueTest, FirstInFirstOut) {
+  const int N = 4;
+  MyQueue q(N, sizeof(Element));
+  Element e;
+  for (int round = 0; round < 3; round++) {
+    for (int i = 0; i < N; i++) {
+      e = MakeElement(round, i);
+      ASSERT_TRUE(q.TryPushBack(&e));
+      ASSERT_EQ(i + 1, q.Size());
+    }
+    ASSERT_TRUE(q.Full());
+    e = MakeElement(round, N);
+    ASSERT_TRUE(!q.TryPushBack(&e));
+
+    q.Front(&e);
+    ASSERT_EQ(0, e.seq);
+    q.Back(&e);
+    ASSERT_EQ(N - 1, e.seq);
+    int seen = 0;
+    for (ull i = q.Head(); i != q.Tail(); i = (i + 1) % q.size_) {
+      ASSERT_TRUE(q.Ready(i));
+      ASSERT_EQ(seen++, reinterpret_cast<Element*>(q[i])->seq);
+    }
+    ASSERT_EQ(N, seen);
+
+    for (int i = 0; i < N; i++) {
+      ASSERT_TRUE(q.TryPopFront(&e));
+      ASSERT_EQ(round, e.producer);
+      ASSERT_EQ(i, e.seq);
+      ASSERT_TRUE(Intact(e));
+    }
+    ASSERT_TRUE(q.Empty());
+    ASSERT_TRUE(!q.TryPopFront(&e));
+  }
+}
+
+// Producers push and consumers pop at once, while a reader walks the queue
+// under lock_ as nvMultiTable does with level 0: pops take lock_ for
+// writing, pushes do not.
+class ConcurrentQueueTest {
+ public:
+  enum { kProducers = 4, kConsumers = 4, kPerProducer = 50000 };
+  MyQueue q_;
+  std::atomic<bool> done_;
+  std::atomic<int> torn_;
+  std::vector<std::vector<int> > count_;  // Per consumer, times popped.
+
+  ConcurrentQueueTest()
+      : q_(16, sizeof(Element)), done_(false), torn_(0), count_(kConsumers) {
+    for (int i = 0; i < kConsumers; i++) {
+      count_[i].assign(kProducers * kPerProducer, 0);
+    }
+  }
+
+  void Produce(uint32_t producer) {
+    for (uint32_t seq = 0; seq < kPerProducer; seq++) {
+      Element e = MakeElement(producer, seq);
+      q_.PushBack(&e);
+    }
+  }
+
+  void Consume(int consumer, int n) {
+    std::vector<int64_t> last(kProducers, -1);
+    for (int i = 0; i < n; i++) {
+      Element e;
+      q_.lock_.WriteLock();
+      q_.PopFront(&e);
+      q_.lock_.Unlock();
+      if (!Intact(e) || e.producer >= kProducers || e.seq >= kPerProducer) {
+        torn_++;
+        continue;
+      }
+      // One producer's elements leave in the order they came.
+      if (static_cast<int64_t>(e.seq) <= last[e.producer]) {
+        torn_++;
+      }
+      last[e.producer] = e.seq;
+      count_[consumer][e.producer * kPerProducer + e.seq]++;
+    }
+  }
+
+  void Read() {
+    while (!done_.load(std::memory_order_acquire)) {
+      q_.lock_.ReadLock();
+      ull tail = q_.Tail();
+      for (ull i = q_.Head(); i != tail && q_.Ready(i); i = (i + 1) % q_.size_) {
+        Element e;
+        memcpy(&e, q_[i], sizeof(e));
+        if (!Intact(e)) {
+          torn_++;
+        }
+      }
+      q_.lock_.Unlock();
+    }
+  }
+};
+
+TEST(ConcurrentQueueTest, PushPop) {
+  const int total = kProducers * kPerProducer;
+  std::vector<std::thread> threads;
+  std::thread reader(&ConcurrentQueueTest::Read, this);
+  for (int i = 0; i < kProducers; i++) {
+    threads.push_back(std::thread(&ConcurrentQueueTest::Produce, this, i));
+  }
+  for (int i = 0; i < kConsumers; i++) {
+    const int n = total / kConsumers + (i < total % kConsumers ? 1 : 0);
+    threads.push_back(std::thread(&ConcurrentQueueTest::Consume, this, i, n));
+  }
+  for (size_t i = 0; i < threads.size(); i++) {
+    threads[i].join();
+  }
+  done_.store(true, std::memory_order_release);
+  reader.join();
+
+  ASSERT_EQ(0, torn_.load());
+  ASSERT_TRUE(q_.Empty());
+  // Every element is popped exactly once.
+  for (int k = 0; k < total; k++) {
+    int n = 0;
+    for (int i = 0; i < kConsumers; i++) {
+      n += count_[i][k];
+    }
+    ASSERT_EQ(1, n);
+  }
+}
+
+}  // namespace leveldb
+
+int main(int argc, char** argv) {
+  return leveldb::test::RunAllTests();
+}
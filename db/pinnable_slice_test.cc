@@ -0,0 +1,363 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "leveldb/pinnable_slice.h"
+#include <vector>
+#include "leveldb/db.h"
+#include "db/dbformat.h"
+#include "nvm_library/d4skiplist.h"
+#include "util/testharness.h"
+#include "util/testutil.h"
+
+namespace leveldb {
+
+static void CountRelease(void* arg1, void* arg2) {
+  ++*reinterpret_cast<int*>(arg1);
+}
+
+class PinnableSliceTest { };
+
+TEST(PinnableSliceTest, PinSliceAndReset) {
+  int released = 0;
+  std::string storage = "pinned";
+  {
+    PinnableSlice s;
+    ASSERT_TRUE(!s.IsPinned());
+    s.PinSlice(storage, &CountRelease, &released, NULL);
+    ASSERT_TRUE(s.IsPinned());
+    ASSERT_EQ(storage.data(), s.data());
+    ASSERT_EQ(0, released);
+
+    s.Reset();
+    ASSERT_EQ(1, released);
+    ASSERT_TRUE(!s.IsPinned());
+    ASSERT_TRUE(s.empty());
+    s.Reset();
+    ASSERT_EQ(1, released);
+
+    // Pinning again, or a copy, releases what was pinned before.
+    s.PinSlice(storage, &CountRelease, &released, NULL);
+    s.PinSlice(storage, &CountRelease, &released, NULL);
+    ASSERT_EQ(2, released);
+    s.PinSelf(Slice("copy"));
+    ASSERT_EQ(3, released);
+    ASSERT_TRUE(!s.IsPinned());
+    ASSERT_EQ("copy", s.ToString());
+
+    s.PinSlice(storage, &CountRelease, &released, NULL);
+  }
+  // The destructor releases.
+  ASSERT_EQ(4, released);
+}
+
+TEST(PinnableSliceTest, PinSelf) {
+  PinnableSlice s;
+  std::string storage = "value";
+  s.PinSelf(storage);
+  storage[0] = 'V';
+  ASSERT_EQ("value", s.ToString());
+  ASSERT_TRUE(!s.IsPinned());
+
+  s.GetSelf()->assign("other");
+  s.PinSelf();
+  ASSERT_EQ("other", s.ToString());
+  s.Reset();
+  ASSERT_TRUE(s.empty());
+  ASSERT_TRUE(s.GetSelf()->empty());
+}
+
+// A pinned value in a D5MemTable, and the reuse it holds back.
+class PinnedMemTableTest {
+ public:
+  NVM_Manager* mng_;
+  D5MemTable* mem_;
+
+  PinnedMemTableTest() {
+    mng_ = new NVM_Manager(64 * MB);
+    CachePolicy cp(4 * MB, 3 * MB, 16 * MB, 64 * MB, 10, 16);
+    mem_ = new D5MemTable(mng_, cp, test::TmpDir() + "/pinnable_slice_test", 1);
+    mem_->Ref();
+  }
+
+  ~PinnedMemTableTest() {
+    mem_->Unref();
+    delete mng_;
+  }
+
+  void Add(SequenceNumber seq, const std::string& k, const std::string& v) {
+    ASSERT_TRUE(mem_->HasRoomForWrite(k, v, false));
+    mem_->Add(seq, kTypeValue, k, v);
+  }
+
+  // Run collection steps until one reports done or blocked.
+  void CollectGarbage() {
+    mem_->Lock();
+    while (!mem_->GarbageCollectionStep(4 * KB)) { }
+    mem_->Unlock();
+  }
+};
+
+TEST(PinnedMemTableTest, SurvivesUpdateAndCollection) {
+  const std::string v1(100, 'a'), v2(100, 'b');
+  SequenceNumber seq = 1;
+  for (int i = 0; i < 100; i++) {
+    Add(seq++, "key" + NumberToString(i), v1);
+  }
+
+  PinnableSlice pinned;
+  Status s;
+  ASSERT_TRUE(mem_->Get(LookupKey("key7", seq), &pinned, &s));
+  ASSERT_OK(s);
+  ASSERT_TRUE(pinned.IsPinned());
+  ASSERT_EQ(v1, pinned.ToString());
+  ASSERT_TRUE(!mem_->GarbageCollectionBlocked());
+
+  // Overwrite everything twice, the old values become garbage; the space
+  // of the pinned one must not be reused.
+  for (int i = 0; i < 100; i++) {
+    Add(seq++, "key" + NumberToString(i), v2);
+  }
+  for (int i = 0; i < 100; i++) {
+    Add(seq++, "key" + NumberToString(i), i == 7 ? v2 : v1);
+  }
+  ASSERT_EQ(v1, pinned.ToString());
+
+  // The collection starts, then waits for the reader.
+  const ull before = mem_->StorageUsage();
+  CollectGarbage();
+  ASSERT_TRUE(mem_->GarbageCollectionBlocked());
+  ASSERT_EQ(v1, pinned.ToString());
+  ASSERT_EQ(before, mem_->StorageUsage());
+
+  std::string value;
+  ASSERT_TRUE(mem_->Get(LookupKey("key7", seq), &value, &s));
+  ASSERT_EQ(v2, value);
+
+  // Reset() unpins: the collection goes through and frees the old values.
+  pinned.Reset();
+  ASSERT_TRUE(!mem_->GarbageCollectionBlocked());
+  CollectGarbage();
+  ASSERT_TRUE(!mem_->GarbageCollectionBlocked());
+  ASSERT_LT(mem_->StorageUsage(), before);
+  for (int i = 0; i < 100; i++) {
+    ASSERT_TRUE(mem_->Get(LookupKey("key" + NumberToString(i), seq), &value, &s));
+    ASSERT_OK(s);
+    ASSERT_EQ(i == 7 ? v2 : v1, value);
+  }
+}
+
+TEST(PinnedMemTableTest, NothingPinnedWhenNotFound) {
+  Add(1, "a", "va");
+  mem_->Add(2, kTypeDeletion, "a", Slice());
+
+  PinnableSlice value;
+  Status s;
+  ASSERT_TRUE(mem_->Get(LookupKey("a", 3), &value, &s));
+  ASSERT_TRUE(s.IsNotFound());
+  ASSERT_TRUE(!value.IsPinned());
+  ASSERT_TRUE(!mem_->Get(LookupKey("b", 3), &value, &s));
+  ASSERT_TRUE(!mem_->GarbageCollectionBlocked());
+}
+
+// Small steps, scans included, with adds between them.
+TEST(PinnedMemTableTest, CollectsInSmallSteps) {
+  const int kKeys = 1000;
+  std::vector<std::string> model(kKeys);
+  SequenceNumber seq = 1;
+  for (int round = 0; round < 3; round++) {
+    for (int i = 0; i < kKeys; i++) {
+      model[i] = std::string(50 + (i + round) % 100, 'a' + round);
+      Add(seq++, "key" + NumberToString(i), model[i]);
+    }
+  }
+  const ull before = mem_->StorageUsage();
+
+  int steps = 0;
+  bool done = false;
+  while (!done) {
+    mem_->Lock();
+    done = mem_->GarbageCollectionStep(256);
+    mem_->Unlock();
+    ASSERT_TRUE(!mem_->GarbageCollectionBlocked());
+    steps++;
+    const int i = (steps * 7919) % kKeys;
+    model[i] = std::string(50 + steps % 100, 'A' + steps % 26);
+    Add(seq++, "key" + NumberToString(i), model[i]);
+  }
+  // A step visits 16 nodes at most: the scan of the first pass alone
+  // takes kKeys / 16 of them.
+  ASSERT_GT(steps, kKeys / 16);
+  ASSERT_LT(mem_->StorageUsage(), before);
+
+  std::string value;
+  Status s;
+  for (int i = 0; i < kKeys; i++) {
+    ASSERT_TRUE(mem_->Get(LookupKey("key" + NumberToString(i), seq), &value, &s));
+    ASSERT_OK(s);
+    ASSERT_EQ(model[i], value);
+  }
+}
+
+// DB::Get() into a PinnableSlice, against the std::string Get().
+class PinnedGetTest {
+ public:
+  std::string dbname_;
+  Options options_;
+  DB* db_;
+
+  PinnedGetTest() : db_(NULL) {
+    dbname_ = test::TmpDir() + "/pinned_get_test";
+    options_.create_if_missing = true;
+    options_.TEST_max_nvm_buffer_size = 128ULL << 20;
+    options_.TEST_nvm_buffer_reserved = 32ULL << 20;
+    options_.TEST_max_dram_buffer_size = 16ULL << 20;
+  }
+
+  ~PinnedGetTest() {
+    delete db_;
+    DestroyDB(dbname_, Options());
+  }
+
+  void Open(ListType type) {
+    delete db_;
+    db_ = NULL;
+    DestroyDB(dbname_, Options());
+    options_.TEST_nvskiplist_type = type;
+    ASSERT_OK(DB::Open(options_, dbname_, &db_));
+  }
+
+  std::string Key(int i) {
+    char buf[100];
+    snprintf(buf, sizeof(buf), "key%06d", i);
+    return std::string(buf);
+  }
+
+  std::string Value(int i, int round) {
+    return Key(i) + std::string(100, 'a' + round % 26);
+  }
+
+  std::string Get(const std::string& k) {
+    std::string result;
+    Status s = db_->Get(ReadOptions(), k, &result);
+    return s.IsNotFound() ? "NOT_FOUND" : (s.ok() ? result : s.ToString());
+  }
+};
+
+TEST(PinnedGetTest, PinnedValueSurvivesUpdates) {
+  Open(kTypePureSkiplist);
+  const int kKeys = 20000;
+  for (int i = 0; i < kKeys; i++) {
+    ASSERT_OK(db_->Put(WriteOptions(), Key(i), Value(i, 0)));
+  }
+
+  PinnableSlice pinned;
+  ASSERT_OK(db_->Get(ReadOptions(), Key(7), &pinned));
+  ASSERT_TRUE(pinned.IsPinned());
+  ASSERT_EQ(Value(7, 0), pinned.ToString());
+
+  // Enough overwrites for the memtables to fill up and be collected,
+  // split or pushed to level 0 under the pinned value.
+  for (int round = 1; round <= 20; round++) {
+    for (int i = 0; i < kKeys; i++) {
+      ASSERT_OK(db_->Put(WriteOptions(), Key(i), Value(i, round)));
+    }
+    ASSERT_EQ(Value(7, 0), pinned.ToString());
+  }
+
+  pinned.Reset();
+  ASSERT_TRUE(!pinned.IsPinned());
+  ASSERT_TRUE(pinned.empty());
+  for (int i = 0; i < kKeys; i += 97) {
+    PinnableSlice value;
+    ASSERT_OK(db_->Get(ReadOptions(), Key(i), &value));
+    ASSERT_EQ(Get(Key(i)), value.ToString());
+    ASSERT_EQ(Value(i, 20), value.ToString());
+  }
+}
+
+// An iterator keeps the values of the memtables it shows in place.
+TEST(PinnedGetTest, IteratorValuesSurviveUpdates) {
+  Open(kTypePureSkiplist);
+  // Few keys, so that the memtable stays and reuses the freed space.
+  const int kKeys = 2000;
+  for (int i = 0; i < kKeys; i++) {
+    ASSERT_OK(db_->Put(WriteOptions(), Key(i), Value(i, 0)));
+  }
+
+  Iterator* iter = db_->NewIterator(ReadOptions());
+  iter->Seek(Key(7));
+  ASSERT_TRUE(iter->Valid());
+  ASSERT_EQ(Key(7), iter->key().ToString());
+  const Slice held = iter->value();
+  ASSERT_EQ(Value(7, 0), held.ToString());
+
+  for (int round = 1; round <= 20; round++) {
+    for (int i = 0; i < kKeys; i++) {
+      ASSERT_OK(db_->Put(WriteOptions(), Key(i), Value(i, round)));
+    }
+    ASSERT_EQ(Value(7, 0), held.ToString());
+    ASSERT_EQ(held.ToString(), iter->value().ToString());
+  }
+  // Whatever version the next entries show, each is whole.
+  for (int i = 8; i < 100; i++) {
+    iter->Next();
+    ASSERT_TRUE(iter->Valid());
+    ASSERT_EQ(Key(i), iter->key().ToString());
+    const std::string v = iter->value().ToString();
+    ASSERT_EQ(Key(i), v.substr(0, Key(i).size()));
+    ASSERT_EQ(std::string(100, v[v.size() - 1]), v.substr(Key(i).size()));
+  }
+  delete iter;
+  ASSERT_EQ(Value(7, 20), Get(Key(7)));
+}
+
+TEST(PinnedGetTest, NotFound) {
+  Open(kTypePureSkiplist);
+  ASSERT_OK(db_->Put(WriteOptions(), "foo", "v1"));
+  ASSERT_OK(db_->Put(WriteOptions(), "bar", "v1"));
+  ASSERT_OK(db_->Delete(WriteOptions(), "bar"));
+
+  PinnableSlice value;
+  ASSERT_OK(db_->Get(ReadOptions(), "foo", &value));
+  ASSERT_EQ("v1", value.ToString());
+  ASSERT_TRUE(db_->Get(ReadOptions(), "bar", &value).IsNotFound());
+  ASSERT_TRUE(!value.IsPinned());
+  ASSERT_TRUE(value.empty());
+  ASSERT_TRUE(db_->Get(ReadOptions(), "missing", &value).IsNotFound());
+  ASSERT_TRUE(value.empty());
+}
+
+// D2 memtables can not pin: Get() falls back to a copy.
+TEST(PinnedGetTest, CopiesFromOtherMemTables) {
+  Open(kTypeD2SkipList);
+  const int kKeys = 5000;
+  for (int i = 0; i < kKeys; i++) {
+    ASSERT_OK(db_->Put(WriteOptions(), Key(i), Value(i, 0)));
+  }
+  ASSERT_OK(db_->Delete(WriteOptions(), Key(3)));
+
+  PinnableSlice value;
+  ASSERT_OK(db_->Get(ReadOptions(), Key(7), &value));
+  ASSERT_TRUE(!value.IsPinned());
+  ASSERT_EQ(Value(7, 0), value.ToString());
+
+  // The copy is the slice's own: later writes do not show through.
+  ASSERT_OK(db_->Put(WriteOptions(), Key(7), Value(7, 1)));
+  ASSERT_EQ(Value(7, 0), value.ToString());
+  ASSERT_EQ(Value(7, 1), Get(Key(7)));
+
+  ASSERT_TRUE(db_->Get(ReadOptions(), Key(3), &value).IsNotFound());
+  ASSERT_TRUE(db_->Get(ReadOptions(), Key(kKeys), &value).IsNotFound());
+  for (int i = 0; i < kKeys; i += 37) {
+    ASSERT_OK(db_->Get(ReadOptions(), Key(i), &value));
+    ASSERT_TRUE(!value.IsPinned());
+    ASSERT_EQ(Get(Key(i)), value.ToString());
+  }
+}
+
+}  // namespace leveldb
+
+int main(int argc, char** argv) {
+  return leveldb::test::RunAllTests();
+}
@@ -118,6 +118,29 @@ Status TableCache::Get(const ReadOptions& options,
   return s;
 }
 
+void TableCache::MultiGet(const ReadOptions& options,
+                          uint64_t file_number,
+                          uint64_t file_size,
+                          size_t n,
+                          const Slice* keys,
+                          void* const* args,
+                          Status* s,
+                          void (*saver)(void*, const Slice&, const Slice&)) {
+  Cache::Handle* handle = NULL;
+  Status open = FindTable(file_number, file_size, &handle);
+  if (!open.ok()) {
+    for (size_t i = 0; i < n; i++) {
+      s[i] = open;
+    }
+    return;
+  }
+  Table* t = reinterpret_cast<TableAndFile*>(cache_->Value(handle))->table;
+  for (size_t i = 0; i < n; i++) {
+    s[i] = t->InternalGet(options, keys[i], args[i], saver);
+  }
+  cache_->Release(handle);
+}
+
 void TableCache::Evict(uint64_t file_number) {
   char buf[sizeof(file_number)];
   EncodeFixed64(buf, file_number);
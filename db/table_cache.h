@@ -44,6 +44,17 @@ class TableCache {
              void* arg,
              void (*handle_result)(void*, const Slice&, const Slice&));
 
+  // Get() for keys[0,n-1] of the same file, keys[i] with args[i]; looks
+  // the table up once.  Sets s[i] to the status of keys[i].
+  void MultiGet(const ReadOptions& options,
+                uint64_t file_number,
+                uint64_t file_size,
+                size_t n,
+                const Slice* keys,
+                void* const* args,
+                Status* s,
+                void (*handle_result)(void*, const Slice&, const Slice&));
+
   // Evict any entry for the specified file number
   void Evict(uint64_t file_number);
 
@@ -431,6 +431,143 @@ Status Version::Get(const ReadOptions& options,
   return Status::NotFound(Slice());  // Use an empty error message for speed
 }
 
+void Version::MultiGet(const ReadOptions& options,
+                       KeyContext* keys, size_t n,
+                       GetStats* stats) {
+  const Comparator* ucmp = vset_->icmp_.user_comparator();
+  std::vector<GetStats> last_read(n);
+  std::vector<size_t> pending;
+  for (size_t i = 0; i < n; i++) {
+    stats[i].seek_file = NULL;
+    stats[i].seek_file_level = -1;
+    last_read[i] = stats[i];
+    if (!keys[i].found) {
+      pending.push_back(i);
+    }
+  }
+
+  std::vector<size_t> group;
+  for (int level = 0; level < config::kNumLevels && !pending.empty(); level++) {
+    size_t num_files = files_[level].size();
+    if (num_files == 0) continue;
+
+    if (level == 0) {
+      // Newest file first, as in Get(); a key found in one is not looked
+      // for in the older ones.
+      std::vector<FileMetaData*> tmp(files_[0]);
+      std::sort(tmp.begin(), tmp.end(), NewestFirst);
+      for (size_t i = 0; i < tmp.size(); i++) {
+        FileMetaData* f = tmp[i];
+        group.clear();
+        for (size_t j = 0; j < pending.size(); j++) {
+          Slice user_key = keys[pending[j]].key->user_key();
+          if (!keys[pending[j]].found &&
+              ucmp->Compare(user_key, f->smallest.user_key()) >= 0 &&
+              ucmp->Compare(user_key, f->largest.user_key()) <= 0) {
+            group.push_back(pending[j]);
+          }
+        }
+        if (!group.empty()) {
+          MultiGetFromFile(options, f, level, keys, group, stats, &last_read[0]);
+        }
+      }
+    } else {
+      // Files do not overlap and the keys are sorted: the keys of one file
+      // come one after another.
+      size_t j = 0;
+      while (j < pending.size()) {
+        uint32_t index = FindFile(vset_->icmp_, files_[level],
+                                  keys[pending[j]].key->internal_key());
+        if (index >= num_files) {
+          break;  // Every key left is past the last file.
+        }
+        FileMetaData* f = files_[level][index];
+        group.clear();
+        for (; j < pending.size(); j++) {
+          Slice user_key = keys[pending[j]].key->user_key();
+          if (ucmp->Compare(user_key, f->largest.user_key()) > 0) {
+            break;
+          }
+          if (ucmp->Compare(user_key, f->smallest.user_key()) >= 0) {
+            group.push_back(pending[j]);
+          }
+        }
+        if (!group.empty()) {
+          MultiGetFromFile(options, f, level, keys, group, stats, &last_read[0]);
+        }
+      }
+    }
+
+    size_t left = 0;
+    for (size_t j = 0; j < pending.size(); j++) {
+      if (!keys[pending[j]].found) {
+        pending[left++] = pending[j];
+      }
+    }
+    pending.resize(left);
+  }
+
+  for (size_t j = 0; j < pending.size(); j++) {
+    *keys[pending[j]].s = Status::NotFound(Slice());
+    keys[pending[j]].found = true;
+  }
+}
+
+void Version::MultiGetFromFile(const ReadOptions& options,
+                               FileMetaData* f, int level,
+                               KeyContext* keys,
+                               const std::vector<size_t>& group,
+                               GetStats* stats, GetStats* last_read) {
+  const Comparator* ucmp = vset_->icmp_.user_comparator();
+  size_t n = group.size();
+  std::vector<Slice> ikeys(n);
+  std::vector<Saver> savers(n);
+  std::vector<void*> args(n);
+  std::vector<Status> s(n);
+  for (size_t j = 0; j < n; j++) {
+    size_t i = group[j];
+    if (last_read[i].seek_file != NULL && stats[i].seek_file == NULL) {
+      // We have had more than one seek for this read.  Charge the 1st file.
+      stats[i] = last_read[i];
+    }
+    last_read[i].seek_file = f;
+    last_read[i].seek_file_level = level;
+
+    ikeys[j] = keys[i].key->internal_key();
+    savers[j].state = kNotFound;
+    savers[j].ucmp = ucmp;
+    savers[j].user_key = keys[i].key->user_key();
+    savers[j].value = keys[i].value;
+    args[j] = &savers[j];
+  }
+  vset_->table_cache_->MultiGet(options, f->number, f->file_size, n,
+                                &ikeys[0], &args[0], &s[0], SaveValue);
+  for (size_t j = 0; j < n; j++) {
+    KeyContext* k = &keys[group[j]];
+    if (!s[j].ok()) {
+      *k->s = s[j];
+      k->found = true;
+      continue;
+    }
+    switch (savers[j].state) {
+      case kNotFound:
+        break;      // Keep searching in other files
+      case kFound:
+        *k->s = Status::OK();
+        k->found = true;
+        break;
+      case kDeleted:
+        *k->s = Status::NotFound(Slice());
+        k->found = true;
+        break;
+      case kCorrupt:
+        *k->s = Status::Corruption("corrupted key for ", savers[j].user_key);
+        k->found = true;
+        break;
+    }
+  }
+}
+
 bool Version::UpdateStats(const GetStats& stats) {
   FileMetaData* f = stats.seek_file;
   if (f != NULL) {
@@ -74,6 +74,13 @@ class Version {
   Status Get(const ReadOptions&, const LookupKey& key, std::string* val,
              GetStats* stats);
 
+  // Get() for the keys[0,n-1] not found yet, which are sorted by user key.
+  // Each file is looked up once for all of its keys.  Finds every key and
+  // fills stats[0,n-1].
+  // REQUIRES: lock is not held
+  void MultiGet(const ReadOptions&, KeyContext* keys, size_t n,
+                GetStats* stats);
+
   // Adds "stats" into the current state.  Returns true if a new
   // compaction may need to be triggered, false otherwise.
   // REQUIRES: lock is held
@@ -133,6 +140,12 @@ class Version {
                           void* arg,
                           bool (*func)(void*, int, FileMetaData*));
 
+  // Part of MultiGet(): look keys[group[i]] up in f.  last_read holds the
+  // last file read for each key, as in Get().
+  void MultiGetFromFile(const ReadOptions& options, FileMetaData* f, int level,
+                        KeyContext* keys, const std::vector<size_t>& group,
+                        GetStats* stats, GetStats* last_read);
+
   VersionSet* vset_;            // VersionSet to which this Version belongs
   Version* next_;               // Next version in linked list
   Version* prev_;               // Previous version in linked list
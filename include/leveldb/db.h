@@ -7,8 +7,10 @@
 
 #include <stdint.h>
 #include <stdio.h>
+#include <vector>
 #include "leveldb/iterator.h"
 #include "leveldb/options.h"
+#include "leveldb/pinnable_slice.h"
 
 namespace leveldb {
 
@@ -83,10 +85,35 @@ class DB {
   virtual Status Get(const ReadOptions& options,
                      const Slice& key, std::string* value) = 0;
 
+  // Like Get() above, but *value may point straight into the DB's storage
+  // instead of a copy; the storage stays valid until value->Reset() or
+  // the destruction of *value, which must come before the DB is deleted.
+  // While it is pinned, the memtables do not reuse the space of the values
+  // they free, so it should not be held for long.
+  // The default implementation copies.
+  virtual Status Get(const ReadOptions& options,
+                     const Slice& key, PinnableSlice* value);
+
+  // Get() for each of keys, all read at the same snapshot.  Resizes
+  // *values to keys.size() and stores the value of keys[i] in (*values)[i];
+  // returns the status of keys[i] at index i.
+  // The default implementation calls Get() for each key.
+  virtual std::vector<Status> MultiGet(const ReadOptions& options,
+                                       const std::vector<Slice>& keys,
+                                       std::vector<std::string>* values);
+
   // Return a heap-allocated iterator over the contents of the database.
   // The result of NewIterator() is initially invalid (caller must
   // call one of the Seek methods on the iterator before using it).
   //
+  // The memtables keep one version of each key and take writes while the
+  // iterator walks them, so the iterator is not a point-in-time view: an
+  // entry written after NewIterator() may or may not show, and
+  // options.snapshot only applies to the table files.  Each value stays
+  // valid until the iterator is deleted.  While it lives, the memtables
+  // do not reuse the space of the values they free, so it should not be
+  // held for long.
+  //
   // Caller should delete the iterator when it is no longer needed.
   // The returned iterator should be deleted before this db is deleted.
   virtual Iterator* NewIterator(const ReadOptions& options) = 0;
@@ -42,6 +42,12 @@ class Env {
   static Env* Default();
 
   virtual NVM_Library* NVM_Env() = 0;
+  // Back the region returned by NVM_Env() with the file fname, creating it
+  // with size bytes if it does not exist.  Must be called before the region
+  // is first used; naming the file already in use is a no-op.
+  // The default implementation returns NotSupported.
+  virtual Status UseNVMFile(const std::string& fname, uint64_t size);
+
   // Create a brand new sequentially-readable file with the specified name.
   // On success, stores a pointer to the new file in *result and returns OK.
   // On failure stores NULL in *result and returns non-OK.  If the file does
@@ -6,6 +6,8 @@
 #define STORAGE_LEVELDB_INCLUDE_OPTIONS_H_
 
 #include <stddef.h>
+#include <string>
+#include <vector>
 
 namespace leveldb {
 
@@ -24,7 +26,9 @@ enum CompressionType {
   // NOTE: do not change the values of existing entries, as these are
   // part of the persistent format on disk.
   kNoCompression     = 0x0,
-  kSnappyCompression = 0x1
+  kSnappyCompression = 0x1,
+  kLZ4Compression    = 0x2,
+  kZstdCompression   = 0x3
 };
 
 enum ListType {
@@ -156,8 +160,22 @@ struct Options {
   // worth switching to kNoCompression.  Even if the input data is
   // incompressible, the kSnappyCompression implementation will
   // efficiently detect that and will switch to uncompressed mode.
+  //
+  // kLZ4Compression is about as fast and kZstdCompression compresses
+  // better at several times the CPU cost.  Blocks are stored uncompressed
+  // if the chosen codec was not available when leveldb was built.
   CompressionType compression;
 
+  // If non-empty, compression_per_level[n] replaces compression for the
+  // tables written to level n, and the last entry is used for the levels
+  // past the end.  Tables flushed from a memtable use entry 0.  E.g.
+  // {kNoCompression, kNoCompression, kLZ4Compression, kZstdCompression}
+  // leaves the levels kept in NVM uncompressed and spends CPU only where
+  // it saves I/O.
+  //
+  // Default: empty
+  std::vector<CompressionType> compression_per_level;
+
   // EXPERIMENTAL: If true, append to existing MANIFEST and log files
   // when a database is opened.  This can significantly speed up open.
   //
@@ -204,6 +222,18 @@ struct Options {
 
   bool TEST_no_double_level0;
 
+  // EXPERIMENTAL: With TEST_no_double_level0, compact up to this many
+  // nvMemTables of level 0 into level 1 at once, one thread each, as long
+  // as their key ranges in level 1 are disjoint.
+  // Default: 1
+  unsigned int TEST_flush_threads;
+
+  // EXPERIMENTAL: Bits per key of the bloom filter built for an nvMemTable
+  // when it moves to level 0; Get() skips level 0 memtables whose filter
+  // rules the key out.  0 builds no filters.
+  // Default: 10
+  int TEST_level0_filter_bits_per_key;
+
   ListType TEST_nvskiplist_type;
 
   bool TEST_background_lock_free;
@@ -217,6 +247,40 @@ struct Options {
   unsigned long TEST_hash_div;
   unsigned long long TEST_hash_size;
   double TEST_hash_full_limit;
+
+  // EXPERIMENTAL: With kTypeHashedSkipList, keep a DRAM copy of each
+  // nvMemTable's hash buckets, loaded when the memtable is recovered, so
+  // that point lookups and updates read NVM only for the nodes themselves.
+  // Costs 4 bytes of DRAM per bucket, TEST_hash_div-th of the NVM used by
+  // the memtables.
+  // Default: false
+  bool TEST_dram_hash_mirror;
+
+  // EXPERIMENTAL: In MULTI_MEMTABLE mode, queue concurrent writes and let
+  // the writer at the front apply the whole group, memtable by memtable,
+  // holding each memtable's lock once.  If false every writer adds its own
+  // keys, several at once into memtables that support it.
+  // Default: true
+  bool TEST_group_commit;
+
+  // EXPERIMENTAL: If true and the NVM region is split over several NUMA
+  // nodes, every key range of the nvMemTable index gets a home node: the
+  // memtables that take over the range are allocated from that node, and in
+  // BUFFER_WITH_LOG mode its writes are applied by a writer thread that runs
+  // there.  Otherwise memory comes from the node of the allocating thread.
+  // Default: false
+  bool TEST_numa_home_ranges;
+
+  // EXPERIMENTAL: If not empty, the NVM region of env is this file, mapped
+  // with MAP_SYNC where the file system supports DAX and written back with
+  // msync() otherwise, so that NVM memtables survive a restart.  If the file
+  // does not exist it is created with TEST_nvm_file_size bytes, otherwise
+  // its own size is used.  The region belongs to the Env: it must be chosen
+  // by the first DB opened with that Env.
+  // Default: empty (anonymous memory, lost on exit).
+  std::string TEST_nvm_file_path;
+  unsigned long long TEST_nvm_file_size;
+
   // Create an Options object with default values for all fields.
   Options();
 };
@@ -0,0 +1,75 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+//
+// A PinnableSlice is a Slice that either refers to storage pinned inside
+// the DB, released by Reset() or the destructor, or to a copy it owns.
+// DB::Get() fills one without copying when the value allows it.
+//
+// Like Slice, a PinnableSlice needs external synchronization if several
+// threads may call a non-const method on it.
+
+#ifndef STORAGE_LEVELDB_INCLUDE_PINNABLE_SLICE_H_
+#define STORAGE_LEVELDB_INCLUDE_PINNABLE_SLICE_H_
+
+#include <string>
+#include "leveldb/slice.h"
+
+namespace leveldb {
+
+class PinnableSlice : public Slice {
+ public:
+  typedef void (*ReleaseFunction)(void* arg1, void* arg2);
+
+  PinnableSlice() : release_(NULL), arg1_(NULL), arg2_(NULL) { }
+  ~PinnableSlice() { Reset(); }
+
+  // Refer to s, which stays valid until (*release)(arg1, arg2) is called.
+  void PinSlice(const Slice& s, ReleaseFunction release, void* arg1, void* arg2) {
+    Reset();
+    Slice::operator=(s);
+    release_ = release;
+    arg1_ = arg1;
+    arg2_ = arg2;
+  }
+
+  // Refer to a copy of s.
+  void PinSelf(const Slice& s) {
+    Reset();
+    self_.assign(s.data(), s.size());
+    Slice::operator=(self_);
+  }
+
+  // Refer to what the caller stored in *GetSelf().
+  void PinSelf() {
+    Slice::operator=(self_);
+  }
+  std::string* GetSelf() { return &self_; }
+
+  // Whether the data lives inside the DB rather than in a copy.
+  bool IsPinned() const { return release_ != NULL; }
+
+  // Release the pinned storage, if any; the slice becomes empty.
+  void Reset() {
+    if (release_ != NULL) {
+      (*release_)(arg1_, arg2_);
+      release_ = NULL;
+    }
+    self_.clear();
+    Slice::clear();
+  }
+
+ private:
+  std::string self_;
+  ReleaseFunction release_;
+  void* arg1_;
+  void* arg2_;
+
+  // No copying allowed
+  PinnableSlice(const PinnableSlice&);
+  void operator=(const PinnableSlice&);
+};
+
+}  // namespace leveldb
+
+#endif  // STORAGE_LEVELDB_INCLUDE_PINNABLE_SLICE_H_
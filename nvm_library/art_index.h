@@ -0,0 +1,805 @@
+#ifndef ART_INDEX_H
+#define ART_INDEX_H
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <assert.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "leveldb/slice.h"
+#include "leveldb/iterator.h"
+#include "index.h"
+
+namespace leveldb {
+struct nvMemTable;
+
+// An adaptive radix tree over the left bounds of the memtables.  Inner nodes
+// grow from 4 to 16, 48 and 256 children and keep the bytes all their keys
+// share as a compressed path, so a lookup touches one small node per
+// distinguishing byte instead of one std::map per character as in CTrie.
+// Leaves keep the whole key.  A key that is a prefix of another one ends at
+// an inner node (value_) and sorts before its children.  Like CTrie, "" is
+// always present and Seek() finds the last key <= target.
+//
+// Snapshot() gives a read-only view that shares the nodes with the index.
+// Changes after it copy every node they touch that is older than the last
+// view, leaves included, so that the view never sees them.
+struct ARTIndex : public AbstractIndex {
+private:
+    enum NodeType { kLeaf, kNode4, kNode16, kNode48, kNode256 };
+
+    struct Node {
+        const NodeType type_;
+        uint32_t version_;      // version_ of the index when made.
+        explicit Node(NodeType type) : type_(type), version_(0) {}
+    };
+    struct Leaf : public Node {
+        const std::string key_;
+        nvMemTable* const data_;
+        Leaf(const Slice& key, nvMemTable* data) :
+            Node(kLeaf), key_(key.data(), key.size()), data_(data) {}
+    };
+    struct Inner : public Node {
+        uint16_t count_;
+        std::string prefix_;
+        Leaf* value_;
+        explicit Inner(NodeType type) : Node(type), count_(0), value_(nullptr) {}
+        // Takes over the prefix, the count and the value of a node that is
+        // being replaced by a bigger or smaller one.
+        void MoveHeader(Inner* from) {
+            count_ = from->count_;
+            prefix_.swap(from->prefix_);
+            value_ = from->value_;
+        }
+    };
+    struct Node4 : public Inner {
+        uint8_t keys_[4];
+        Node* child_[4];
+        Node4() : Inner(kNode4) {}
+    };
+    struct Node16 : public Inner {
+        uint8_t keys_[16];
+        Node* child_[16];
+        Node16() : Inner(kNode16) { memset(keys_, 0, sizeof(keys_)); }
+    };
+    struct Node48 : public Inner {
+        uint8_t index_[256];    // Slot + 1 of each byte, 0 if absent.
+        Node* child_[48];
+        Node48() : Inner(kNode48) {
+            memset(index_, 0, sizeof(index_));
+            memset(child_, 0, sizeof(child_));
+        }
+    };
+    struct Node256 : public Inner {
+        Node* child_[256];
+        Node256() : Inner(kNode256) { memset(child_, 0, sizeof(child_)); }
+    };
+
+    Node* root_;
+    uint32_t version_;          // Number of views taken so far.
+    const bool owner_;          // False for a view.
+    // Nodes that the changes since the last view took out of the tree.
+    // Older views may still read them: the next view frees them.
+    std::vector<Node*> retired_;
+
+    static uint8_t Byte(const Slice& key, size_t i) { return static_cast<uint8_t>(key[i]); }
+
+    // Index of the first of the sorted keys_ of n that is greater than c.
+    static int Node16Upper(const Node16* n, uint8_t c) {
+#ifdef __SSE2__
+        // SSE2 only compares signed bytes, so flip the sign bits first.
+        const __m128i bias = _mm_set1_epi8(static_cast<char>(0x80));
+        __m128i keys = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(n->keys_)), bias);
+        __m128i target = _mm_xor_si128(_mm_set1_epi8(static_cast<char>(c)), bias);
+        int mask = _mm_movemask_epi8(_mm_cmplt_epi8(target, keys)) & ((1 << n->count_) - 1);
+        return mask ? __builtin_ctz(mask) : n->count_;
+#else
+        int i = 0;
+        while (i < n->count_ && n->keys_[i] <= c) ++i;
+        return i;
+#endif
+    }
+
+    static Node** FindChild(Inner* in, uint8_t c) {
+        switch (in->type_) {
+        case kNode4: {
+            Node4* n = static_cast<Node4*>(in);
+            for (int i = 0; i < n->count_; ++i)
+                if (n->keys_[i] == c) return &n->child_[i];
+            return nullptr;
+        }
+        case kNode16: {
+            Node16* n = static_cast<Node16*>(in);
+#ifdef __SSE2__
+            __m128i cmp = _mm_cmpeq_epi8(_mm_set1_epi8(static_cast<char>(c)),
+                                         _mm_loadu_si128(reinterpret_cast<const __m128i*>(n->keys_)));
+            int mask = _mm_movemask_epi8(cmp) & ((1 << n->count_) - 1);
+            return mask ? &n->child_[__builtin_ctz(mask)] : nullptr;
+#else
+            for (int i = 0; i < n->count_; ++i)
+                if (n->keys_[i] == c) return &n->child_[i];
+            return nullptr;
+#endif
+        }
+        case kNode48: {
+            Node48* n = static_cast<Node48*>(in);
+            return n->index_[c] ? &n->child_[n->index_[c] - 1] : nullptr;
+        }
+        case kNode256: {
+            Node256* n = static_cast<Node256*>(in);
+            return n->child_[c] ? &n->child_[c] : nullptr;
+        }
+        default:
+            assert(false);
+            return nullptr;
+        }
+    }
+
+    // The child with the smallest byte greater than c, or the first child
+    // if first is set.
+    static Node* NextChild(Inner* in, uint8_t c, bool first) {
+        switch (in->type_) {
+        case kNode4: {
+            Node4* n = static_cast<Node4*>(in);
+            for (int i = 0; i < n->count_; ++i)
+                if (first || n->keys_[i] > c) return n->child_[i];
+            return nullptr;
+        }
+        case kNode16: {
+            Node16* n = static_cast<Node16*>(in);
+            if (first) return n->count_ ? n->child_[0] : nullptr;
+            int i = Node16Upper(n, c);
+            return i < n->count_ ? n->child_[i] : nullptr;
+        }
+        case kNode48: {
+            Node48* n = static_cast<Node48*>(in);
+            for (int i = first ? 0 : c + 1; i < 256; ++i)
+                if (n->index_[i]) return n->child_[n->index_[i] - 1];
+            return nullptr;
+        }
+        case kNode256: {
+            Node256* n = static_cast<Node256*>(in);
+            for (int i = first ? 0 : c + 1; i < 256; ++i)
+                if (n->child_[i]) return n->child_[i];
+            return nullptr;
+        }
+        default:
+            assert(false);
+            return nullptr;
+        }
+    }
+
+    // The child with the greatest byte less than c; c = 256 gives the last
+    // child.
+    static Node* PrevChild(Inner* in, int c) {
+        switch (in->type_) {
+        case kNode4: {
+            Node4* n = static_cast<Node4*>(in);
+            for (int i = n->count_ - 1; i >= 0; --i)
+                if (n->keys_[i] < c) return n->child_[i];
+            return nullptr;
+        }
+        case kNode16: {
+            Node16* n = static_cast<Node16*>(in);
+            for (int i = n->count_ - 1; i >= 0; --i)
+                if (n->keys_[i] < c) return n->child_[i];
+            return nullptr;
+        }
+        case kNode48: {
+            Node48* n = static_cast<Node48*>(in);
+            for (int i = c - 1; i >= 0; --i)
+                if (n->index_[i]) return n->child_[n->index_[i] - 1];
+            return nullptr;
+        }
+        case kNode256: {
+            Node256* n = static_cast<Node256*>(in);
+            for (int i = c - 1; i >= 0; --i)
+                if (n->child_[i]) return n->child_[i];
+            return nullptr;
+        }
+        default:
+            assert(false);
+            return nullptr;
+        }
+    }
+
+    template <typename T>
+    T* Fresh(T* n) {
+        n->version_ = version_;
+        return n;
+    }
+
+    // The inner node *ref points to, copied first if a view may share it.
+    // REQUIRES: the node holding *ref is not shared.
+    Inner* Writable(Node** ref) {
+        Inner* in = static_cast<Inner*>(*ref);
+        if (in->version_ == version_)
+            return in;
+        Inner* copy;
+        switch (in->type_) {
+        case kNode4: copy = new Node4(*static_cast<Node4*>(in)); break;
+        case kNode16: copy = new Node16(*static_cast<Node16*>(in)); break;
+        case kNode48: copy = new Node48(*static_cast<Node48*>(in)); break;
+        case kNode256: copy = new Node256(*static_cast<Node256*>(in)); break;
+        default: assert(false); return in;
+        }
+        copy->version_ = version_;
+        retired_.push_back(in);
+        *ref = copy;
+        return copy;
+    }
+
+    // n left the tree: free it now, or with the next view if an older
+    // one may still read it.
+    void Discard(Node* n) {
+        if (n->version_ == version_)
+            FreeNode(n);
+        else
+            retired_.push_back(n);
+    }
+
+    // Adds child under byte c of in, which *ref points to; a full node is
+    // replaced by the next bigger kind.  REQUIRES: in is not shared.
+    void AddChild(Node** ref, Inner* in, uint8_t c, Node* child) {
+        switch (in->type_) {
+        case kNode4: {
+            Node4* n = static_cast<Node4*>(in);
+            if (n->count_ < 4) {
+                int i = 0;
+                while (i < n->count_ && n->keys_[i] < c) ++i;
+                memmove(n->keys_ + i + 1, n->keys_ + i, n->count_ - i);
+                memmove(n->child_ + i + 1, n->child_ + i, (n->count_ - i) * sizeof(Node*));
+                n->keys_[i] = c;
+                n->child_[i] = child;
+                n->count_++;
+                return;
+            }
+            Node16* g = Fresh(new Node16());
+            g->MoveHeader(n);
+            memcpy(g->keys_, n->keys_, n->count_);
+            memcpy(g->child_, n->child_, n->count_ * sizeof(Node*));
+            *ref = g;
+            delete n;
+            AddChild(ref, g, c, child);
+            return;
+        }
+        case kNode16: {
+            Node16* n = static_cast<Node16*>(in);
+            if (n->count_ < 16) {
+                int i = Node16Upper(n, c);
+                memmove(n->keys_ + i + 1, n->keys_ + i, n->count_ - i);
+                memmove(n->child_ + i + 1, n->child_ + i, (n->count_ - i) * sizeof(Node*));
+                n->keys_[i] = c;
+                n->child_[i] = child;
+                n->count_++;
+                return;
+            }
+            Node48* g = Fresh(new Node48());
+            g->MoveHeader(n);
+            for (int i = 0; i < n->count_; ++i) {
+                g->child_[i] = n->child_[i];
+                g->index_[n->keys_[i]] = i + 1;
+            }
+            *ref = g;
+            delete n;
+            AddChild(ref, g, c, child);
+            return;
+        }
+        case kNode48: {
+            Node48* n = static_cast<Node48*>(in);
+            if (n->count_ < 48) {
+                int slot = 0;
+                while (n->child_[slot] != nullptr) ++slot;
+                n->child_[slot] = child;
+                n->index_[c] = slot + 1;
+                n->count_++;
+                return;
+            }
+            Node256* g = Fresh(new Node256());
+            g->MoveHeader(n);
+            for (int i = 0; i < 256; ++i)
+                if (n->index_[i]) g->child_[i] = n->child_[n->index_[i] - 1];
+            *ref = g;
+            delete n;
+            AddChild(ref, g, c, child);
+            return;
+        }
+        case kNode256: {
+            Node256* n = static_cast<Node256*>(in);
+            n->child_[c] = child;
+            n->count_++;
+            return;
+        }
+        default:
+            assert(false);
+        }
+    }
+
+    // Removes byte c from in, which *ref points to, and shrinks the node if
+    // it became sparse enough.  REQUIRES: in is not shared.
+    void RemoveChild(Node** ref, Inner* in, uint8_t c) {
+        switch (in->type_) {
+        case kNode4: {
+            Node4* n = static_cast<Node4*>(in);
+            int i = 0;
+            while (n->keys_[i] != c) ++i;
+            memmove(n->keys_ + i, n->keys_ + i + 1, n->count_ - i - 1);
+            memmove(n->child_ + i, n->child_ + i + 1, (n->count_ - i - 1) * sizeof(Node*));
+            n->count_--;
+            Collapse(ref, n);
+            return;
+        }
+        case kNode16: {
+            Node16* n = static_cast<Node16*>(in);
+            int i = 0;
+            while (n->keys_[i] != c) ++i;
+            memmove(n->keys_ + i, n->keys_ + i + 1, n->count_ - i - 1);
+            memmove(n->child_ + i, n->child_ + i + 1, (n->count_ - i - 1) * sizeof(Node*));
+            n->count_--;
+            if (n->count_ > 3) return;
+            Node4* s = Fresh(new Node4());
+            s->MoveHeader(n);
+            memcpy(s->keys_, n->keys_, n->count_);
+            memcpy(s->child_, n->child_, n->count_ * sizeof(Node*));
+            *ref = s;
+            delete n;
+            Collapse(ref, s);
+            return;
+        }
+        case kNode48: {
+            Node48* n = static_cast<Node48*>(in);
+            n->child_[n->index_[c] - 1] = nullptr;
+            n->index_[c] = 0;
+            n->count_--;
+            if (n->count_ > 12) return;
+            Node16* s = Fresh(new Node16());
+            s->MoveHeader(n);
+            int k = 0;
+            for (int i = 0; i < 256; ++i)
+                if (n->index_[i]) {
+                    s->keys_[k] = i;
+                    s->child_[k++] = n->child_[n->index_[i] - 1];
+                }
+            *ref = s;
+            delete n;
+            return;
+        }
+        case kNode256: {
+            Node256* n = static_cast<Node256*>(in);
+            n->child_[c] = nullptr;
+            n->count_--;
+            if (n->count_ > 37) return;
+            Node48* s = Fresh(new Node48());
+            s->MoveHeader(n);
+            int k = 0;
+            for (int i = 0; i < 256; ++i)
+                if (n->child_[i]) {
+                    s->child_[k] = n->child_[i];
+                    s->index_[i] = ++k;
+                }
+            *ref = s;
+            delete n;
+            return;
+        }
+        default:
+            assert(false);
+        }
+    }
+
+    // A Node4 left with a single entry is replaced by it: by its value, or
+    // by its only child with the path of both joined.  REQUIRES: n is not
+    // shared.
+    void Collapse(Node** ref, Node4* n) {
+        if (n->count_ + (n->value_ ? 1 : 0) > 1) return;
+        if (n->count_ == 0) {
+            *ref = n->value_;
+        } else {
+            if (n->child_[0]->type_ != kLeaf) {
+                Inner* c = Writable(&n->child_[0]);
+                n->prefix_.push_back(static_cast<char>(n->keys_[0]));
+                n->prefix_.append(c->prefix_);
+                c->prefix_.swap(n->prefix_);
+            }
+            *ref = n->child_[0];
+        }
+        delete n;
+    }
+
+    // Hangs x below byte key[depth] of the fresh node *ref, or makes it the
+    // value of that node if its key ends there.
+    void Place(Node** ref, Leaf* x, size_t depth) {
+        Inner* in = static_cast<Inner*>(*ref);
+        if (x->key_.size() == depth) {
+            assert(in->value_ == nullptr);
+            in->value_ = x;
+        } else {
+            AddChild(ref, in, Byte(x->key_, depth), x);
+        }
+    }
+
+    // Copies the nodes on the path to leaf that a view may share.
+    void Insert(Node** ref, Leaf* leaf, size_t depth) {
+        const Slice key(leaf->key_);
+        while (true) {
+            Node* n = *ref;
+            if (n == nullptr) {
+                *ref = leaf;
+                return;
+            }
+            if (n->type_ == kLeaf) {
+                Leaf* old = static_cast<Leaf*>(n);
+                size_t end = depth;
+                size_t limit = std::min(old->key_.size(), key.size());
+                while (end < limit && old->key_[end] == key[end]) ++end;
+                Node4* split = Fresh(new Node4());
+                split->prefix_.assign(key.data() + depth, end - depth);
+                Node* fresh = split;
+                Place(&fresh, old, end);
+                Place(&fresh, leaf, end);
+                *ref = fresh;
+                return;
+            }
+            Inner* in = Writable(ref);
+            const std::string& prefix = in->prefix_;
+            size_t p = 0;
+            while (p < prefix.size() && depth + p < key.size() && prefix[p] == key[depth + p]) ++p;
+            if (p < prefix.size()) {
+                Node4* split = Fresh(new Node4());
+                split->prefix_.assign(prefix, 0, p);
+                uint8_t c = static_cast<uint8_t>(prefix[p]);
+                in->prefix_.erase(0, p + 1);
+                Node* fresh = split;
+                AddChild(&fresh, split, c, in);
+                Place(&fresh, leaf, depth + p);
+                *ref = fresh;
+                return;
+            }
+            depth += prefix.size();
+            if (depth == key.size()) {
+                assert(in->value_ == nullptr);
+                in->value_ = leaf;
+                return;
+            }
+            Node** child = FindChild(in, Byte(key, depth));
+            if (child == nullptr) {
+                AddChild(ref, in, Byte(key, depth), leaf);
+                return;
+            }
+            ref = child;
+            depth++;
+        }
+    }
+
+    // Unhooks the leaf of key from the tree below *ref and returns it,
+    // copying the nodes on its path that a view may share.
+    // REQUIRES: key is in the tree.
+    Leaf* Remove(Node** ref, const Slice& key, size_t depth) {
+        if ((*ref)->type_ == kLeaf) {
+            Leaf* l = static_cast<Leaf*>(*ref);
+            assert(Slice(l->key_) == key);
+            *ref = nullptr;
+            return l;
+        }
+        Inner* in = Writable(ref);
+        depth += in->prefix_.size();
+        if (depth == key.size()) {
+            Leaf* l = in->value_;
+            in->value_ = nullptr;
+            if (in->type_ == kNode4)
+                Collapse(ref, static_cast<Node4*>(in));
+            return l;
+        }
+        uint8_t c = Byte(key, depth);
+        Node** child = FindChild(in, c);
+        Leaf* l = Remove(child, key, depth + 1);
+        if (*child == nullptr)
+            RemoveChild(ref, in, c);
+        return l;
+    }
+
+    static Leaf* Minimum(Node* n) {
+        while (n->type_ != kLeaf) {
+            Inner* in = static_cast<Inner*>(n);
+            if (in->value_) return in->value_;
+            n = NextChild(in, 0, true);
+        }
+        return static_cast<Leaf*>(n);
+    }
+
+    static Leaf* Maximum(Node* n) {
+        while (n->type_ != kLeaf) {
+            Inner* in = static_cast<Inner*>(n);
+            Node* last = PrevChild(in, 256);
+            if (last == nullptr) return in->value_;
+            n = last;
+        }
+        return static_cast<Leaf*>(n);
+    }
+
+    // The first leaf below n whose key is >= key, or nullptr.
+    static Leaf* LowerBound(Node* n, const Slice& key, size_t depth) {
+        if (n == nullptr)
+            return nullptr;
+        if (n->type_ == kLeaf) {
+            Leaf* l = static_cast<Leaf*>(n);
+            return Slice(l->key_).compare(key) >= 0 ? l : nullptr;
+        }
+        Inner* in = static_cast<Inner*>(n);
+        const std::string& prefix = in->prefix_;
+        for (size_t i = 0; i < prefix.size(); ++i) {
+            if (depth + i == key.size())
+                return Minimum(in);
+            uint8_t a = static_cast<uint8_t>(prefix[i]), b = Byte(key, depth + i);
+            if (a != b)
+                return a > b ? Minimum(in) : nullptr;
+        }
+        depth += prefix.size();
+        if (depth == key.size())
+            return Minimum(in);
+        uint8_t c = Byte(key, depth);
+        Node** child = FindChild(in, c);
+        if (child != nullptr) {
+            Leaf* l = LowerBound(*child, key, depth + 1);
+            if (l != nullptr) return l;
+        }
+        Node* next = NextChild(in, c, false);
+        return next ? Minimum(next) : nullptr;
+    }
+
+    // The last leaf below n whose key is <= key, or < key unless
+    // inclusive; nullptr if there is none.
+    static Leaf* Floor(Node* n, const Slice& key, size_t depth, bool inclusive) {
+        if (n == nullptr)
+            return nullptr;
+        if (n->type_ == kLeaf) {
+            Leaf* l = static_cast<Leaf*>(n);
+            int r = Slice(l->key_).compare(key);
+            return r < 0 || (inclusive && r == 0) ? l : nullptr;
+        }
+        Inner* in = static_cast<Inner*>(n);
+        const std::string& prefix = in->prefix_;
+        for (size_t i = 0; i < prefix.size(); ++i) {
+            if (depth + i == key.size())
+                return nullptr;     // key is a prefix of all keys below n.
+            uint8_t a = static_cast<uint8_t>(prefix[i]), b = Byte(key, depth + i);
+            if (a != b)
+                return a < b ? Maximum(in) : nullptr;
+        }
+        depth += prefix.size();
+        if (depth == key.size())
+            return inclusive ? in->value_ : nullptr;
+        uint8_t c = Byte(key, depth);
+        Node** child = FindChild(in, c);
+        if (child != nullptr) {
+            Leaf* l = Floor(*child, key, depth + 1, inclusive);
+            if (l != nullptr) return l;
+        }
+        Node* prev = PrevChild(in, c);
+        return prev ? Maximum(prev) : in->value_;
+    }
+
+    Leaf* Find(const Slice& key) const {
+        Node* n = root_;
+        size_t depth = 0;
+        while (n != nullptr && n->type_ != kLeaf) {
+            Inner* in = static_cast<Inner*>(n);
+            const std::string& prefix = in->prefix_;
+            if (key.size() - depth < prefix.size() ||
+                memcmp(prefix.data(), key.data() + depth, prefix.size()) != 0)
+                return nullptr;
+            depth += prefix.size();
+            if (depth == key.size())
+                return in->value_;
+            Node** child = FindChild(in, Byte(key, depth));
+            n = child ? *child : nullptr;
+            depth++;
+        }
+        Leaf* l = static_cast<Leaf*>(n);
+        return (l != nullptr && Slice(l->key_) == key) ? l : nullptr;
+    }
+
+    Leaf* LocateLessOrEqual(const Slice& key, bool* equal) const {
+        Leaf* l = Floor(root_, key, 0, true);
+        *equal = (l != nullptr && Slice(l->key_) == key);
+        return l;
+    }
+    // The first leaf after key.  Every longer key that starts with key
+    // sorts before the other greater ones.
+    Leaf* Successor(const Slice& key) const {
+        std::string next(key.data(), key.size());
+        next.push_back('\0');
+        return LowerBound(root_, next, 0);
+    }
+    Leaf* Predecessor(const Slice& key) const {
+        return Floor(root_, key, 0, false);
+    }
+
+    static void FreeNode(Node* n) {
+        switch (n->type_) {
+        case kLeaf: delete static_cast<Leaf*>(n); return;
+        case kNode4: delete static_cast<Node4*>(n); return;
+        case kNode16: delete static_cast<Node16*>(n); return;
+        case kNode48: delete static_cast<Node48*>(n); return;
+        case kNode256: delete static_cast<Node256*>(n); return;
+        }
+    }
+
+    static void Free(Node* n) {
+        if (n == nullptr)
+            return;
+        switch (n->type_) {
+        case kLeaf:
+            break;
+        case kNode4: {
+            Node4* in = static_cast<Node4*>(n);
+            for (int i = 0; i < in->count_; ++i) Free(in->child_[i]);
+            Free(in->value_);
+            break;
+        }
+        case kNode16: {
+            Node16* in = static_cast<Node16*>(n);
+            for (int i = 0; i < in->count_; ++i) Free(in->child_[i]);
+            Free(in->value_);
+            break;
+        }
+        case kNode48: {
+            Node48* in = static_cast<Node48*>(n);
+            for (int i = 0; i < 48; ++i) Free(in->child_[i]);
+            Free(in->value_);
+            break;
+        }
+        case kNode256: {
+            Node256* in = static_cast<Node256*>(n);
+            for (int i = 0; i < 256; ++i) Free(in->child_[i]);
+            Free(in->value_);
+            break;
+        }
+        }
+        FreeNode(n);
+    }
+
+    // A view of root that takes over retired, and frees only those nodes.
+    ARTIndex(Node* root, std::vector<Node*>* retired) : root_(root), version_(0), owner_(false) {
+        retired_.swap(*retired);
+    }
+
+public:
+    ARTIndex(nvMemTable* data) : root_(nullptr), version_(0), owner_(true) {
+        Add("", data);
+    }
+    virtual ~ARTIndex() {
+        if (owner_)
+            Free(root_);
+        for (size_t i = 0; i < retired_.size(); ++i)
+            FreeNode(retired_[i]);
+    }
+
+    // A read-only view of the index as it is now.  It takes the nodes the
+    // changes before it replaced, which older views may still read, and
+    // frees them when deleted.  REQUIRES: the view goes before the index,
+    // and before the next one is taken only if no view older than it is
+    // still read.
+    ARTIndex* Snapshot() {
+        ARTIndex* view = new ARTIndex(root_, &retired_);
+        version_++;
+        return view;
+    }
+
+    virtual void Add(const Slice& key, nvMemTable* data) {
+        assert(owner_);
+        // Leaves do not change: a new one replaces the old one.
+        if (Find(key) != nullptr)
+            Discard(Remove(&root_, key, 0));
+        Insert(&root_, Fresh(new Leaf(key, data)), 0);
+    }
+
+    virtual bool Delete(const Slice& key, nvMemTable* *data = nullptr) {
+        assert(owner_);
+        if (key.size() == 0) {
+            // As in CTrie, "" never leaves the index: it keeps the data of
+            // its next and that one is removed instead.
+            Leaf* first = Minimum(root_);
+            Leaf* n = Successor(first->key_);
+            if (n == nullptr) {
+                printf("Error : Trie is becoming empty.\n");
+                return 0;
+            }
+            if (data != nullptr)
+                *data = first->data_;
+            nvMemTable* next = n->data_;
+            Discard(Remove(&root_, n->key_, 0));
+            Add("", next);
+            return 1;
+        }
+        if (Find(key) == nullptr)
+            return false;
+        Leaf* l = Remove(&root_, key, 0);
+        if (data)
+            *data = l->data_;
+        Discard(l);
+        return 1;
+    }
+
+    virtual bool Get(const Slice& key, nvMemTable* *data) {
+        Leaf* l = Find(key);
+        if (l == nullptr) return false;
+        *data = l->data_;
+        return true;
+    }
+
+    virtual nvMemTable* FuzzyFind(const Slice& key) {
+        bool equal = false;
+        Leaf* l = LocateLessOrEqual(key, &equal);
+        if (l == nullptr) {
+            printf("Error : Fuzzy Not Found.\n");
+            return nullptr;
+        }
+        return l->data_;
+    }
+    virtual void FuzzyLeftBoundary(const Slice& key, std::string *value) {
+        bool equal = false;
+        Leaf* l = LocateLessOrEqual(key, &equal);
+        if (l == nullptr)
+            value->assign("");
+        else
+            value->assign(l->key_);
+    }
+    virtual void FuzzyRightBoundary(const Slice& key, std::string *value) {
+        bool equal = false;
+        Leaf* l = LocateLessOrEqual(key, &equal);
+        Leaf* next = l ? Successor(l->key_) : nullptr;
+        if (next == nullptr)
+            value->assign("");
+        else
+            value->assign(next->key_);
+    }
+
+    // Next() and Prev() search the tree again from the root.  Changes to
+    // the index invalidate its iterators, not those of a view.
+    class ARTIndexIterator : public IndexIterator {
+     public:
+        ARTIndexIterator(const ARTIndex* main) : main_(main), current_(nullptr) {}
+        virtual ~ARTIndexIterator() {}
+
+        virtual bool Valid() const { return current_ != nullptr; }
+        virtual void SeekToFirst() { current_ = main_->root_ ? Minimum(main_->root_) : nullptr; }
+        virtual void SeekToLast() { current_ = main_->root_ ? Maximum(main_->root_) : nullptr; }
+        // Positions at the last key <= target, i.e. at the memtable whose
+        // range covers target.
+        virtual void Seek(const Slice& target) {
+            bool equal;
+            current_ = main_->LocateLessOrEqual(target, &equal);
+        }
+        virtual void Next() { current_ = main_->Successor(current_->key_); }
+        virtual void Prev() { current_ = main_->Predecessor(current_->key_); }
+        virtual Slice key() const { return current_->key_; }
+        virtual Slice value() const { return Slice(); }
+        virtual nvMemTable* Data() const { return current_->data_; }
+        virtual Status status() const { return Status::OK(); }
+
+     private:
+        const ARTIndex* main_;
+        Leaf* current_;
+
+        // No copying allowed
+        ARTIndexIterator(const ARTIndexIterator&);
+        void operator=(const ARTIndexIterator&);
+    };
+    virtual IndexIterator* NewIterator() {
+        return new ARTIndexIterator(this);
+    }
+
+private:
+    // No copying allowed
+    ARTIndex(const ARTIndex&);
+    void operator=(const ARTIndex&);
+};
+
+}
+
+#endif // ART_INDEX_H
@@ -51,10 +51,10 @@ void BackgroundWriter_LockFree::PthreadCall(const char* label, int result) {
     }
 }
 
-BackgroundWriter_LockFree::BackgroundWriter_LockFree(NVM_Manager* mng, size_t id) :
+BackgroundWriter_LockFree::BackgroundWriter_LockFree(NVM_Manager* mng, size_t id, int node) :
     mng_(mng),
     bgthread_created_(false), shutdown_(false),
-    bgthread_id_(0), id_(threads_count_++),
+    bgthread_id_(0), id_(threads_count_++), node_(node),
     queue_(1 * MB, sizeof(WorkType))
     {
 }
@@ -88,10 +88,13 @@ void BackgroundWriter_LockFree::DoWrite(WorkType* work) {
 
 void BackgroundWriter_LockFree::BackgroundWork() {     // Background work, can not be called.
     //size_t last_work = 0;
+    if (node_ >= 0) {
+        sys_nvm_run_on_node(node_);
+        NVM_Manager::SetHomeNode(node_);
+    }
     WorkType work;
     while (true) {
-        while (queue_.Empty() && !shutdown_) {
-            usleep(5);
+        while (!queue_.WaitForData(1000) && !shutdown_) {
         }
         if (shutdown_) break;
         queue_.PopFront(&work);
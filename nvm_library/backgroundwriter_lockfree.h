@@ -29,6 +29,7 @@ private:
     pthread_t bgthread_id_;
     static size_t threads_count_;
     size_t id_;
+    int node_;          // Where the thread runs and allocates, -1 for anywhere.
     struct WorkType {
         nvMemTable* mem_;       // if mem_ == nullptr, it means "I locked for you, just finish all your jobs and clean your log&hash."
         nvAddr block_addr_;
@@ -49,13 +50,14 @@ private:
     void DoWrite(WorkType* work);
     void BackgroundWork();
 public:
-    BackgroundWriter_LockFree(NVM_Manager* mng, size_t id);
+    BackgroundWriter_LockFree(NVM_Manager* mng, size_t id, int node = -1);
     ~BackgroundWriter_LockFree() {
         ShutdownWorkerThread();
     }
     void StartWorkerThread();
     void ShutdownWorkerThread() {
         shutdown_ = true;
+        queue_.WakeUp();
         usleep(100);
     }
     void Lock() { mu_.Lock(); }
@@ -64,8 +66,8 @@ public:
     //bool GetClearMark() const { return clear_mark_; }
     //void SetClearMark(bool mark) { clear_mark_ = mark; }
     bool CheckClear() const {
-        while (!queue_.Empty())
-            usleep(1);
+        queue_.WaitUntilEmpty();
+        return true;
     }
 
     //void SetClearForce();
@@ -87,21 +87,30 @@ void D2MemTable::Add(SequenceNumber seq, ValueType type,
         cache_.Add(key, y, height, dprev);
 }
 
-bool D2MemTable::Get(const Slice& key, std::string* value, Status* s) {
-    nvOffset x = cache_.Head(), y = table_->Head();
-    byte height = table_->max_height_ - 1;
+// Where the search for key starts in table_: the node the cache leads to
+// and the level below the cached ones.
+void D2MemTable::SeekStart(const Slice& key, nvOffset* y, byte* height) {
+    nvOffset x = cache_.Head();
+    *y = table_->Head();
+    *height = table_->max_height_ - 1;
     if (cache_enabled_) {
         byte min_level = 0;
         if (st_height_ > 1) min_level = st_height_ - 1;
         cache_.Seek(key, x, cache_.max_height_-1, min_level, nullptr);
         if (x != cache_.head_)
-            y = cache_.GetValue(x);
+            *y = cache_.GetValue(x);
         if (st_height_ < table_->max_height_) {
-            height = (st_height_ == 0 ? 0 : st_height_ - 1);
+            *height = (st_height_ == 0 ? 0 : st_height_ - 1);
         }
         //byte height = (st_height_ > table_->max_height_ ? table_->max_height_-1 : (st_height_ == 0 ? 0 : st_height_-1));
 
     }
+}
+
+bool D2MemTable::Get(const Slice& key, std::string* value, Status* s) {
+    nvOffset y;
+    byte height;
+    SeekStart(key, &y, &height);
     if (table_->Seek(key, y, height, nullptr, nullptr)) {
         if (!table_->GetValue(y, value))
             *s = Status::NotFound(Slice());
@@ -109,14 +118,37 @@ bool D2MemTable::Get(const Slice& key, std::string* value, Status* s) {
     }
     return false;
 }
+// The cache lookups stay in DRAM; the searches below them in a large
+// table_ go through BatchSeek().
+void D2MemTable::MultiGet(KeyContext* keys, size_t n) {
+    if (n <= 1 || table_->StorageUsage() < LowerD1Skiplist::kBatchSeekBytes) {
+        nvMemTable::MultiGet(keys, n);
+        return;
+    }
+    std::vector<Slice> key(n);
+    std::vector<nvOffset> y(n);
+    std::vector<byte> height(n);
+    for (size_t i = 0; i < n; ++i) {
+        key[i] = keys[i].key->user_key();
+        SeekStart(key[i], &y[i], &height[i]);
+    }
+    table_->BatchSeek(&key[0], n, &height[0], &y[0]);
+    for (size_t i = 0; i < n; ++i) {
+        KeyContext& c = keys[i];
+        c.found = y[i] != nulloffset;
+        if (c.found && !table_->GetValue(y[i], c.value))
+            *c.s = Status::NotFound(Slice());
+    }
+}
 bool D2MemTable::Get(const LookupKey& key, std::string* value, Status* s) {
     return Get(key.user_key(), value, s);
 }
 
 void D2MemTable::Ref() {refs__++;}
 void D2MemTable::Unref() {
-    assert(refs__ > 0);
-    if (--refs__ == 0)
+    int refs = --refs__;
+    assert(refs >= 0);
+    if (refs == 0)
         delete this;
 }
 void D2MemTable::GarbageCollection() {
@@ -4,6 +4,8 @@
 #include "db/dbformat.h"
 #include "leveldb/env.h"
 #include <string>
+#include <atomic>
+#include <vector>
 #include "port/port_posix.h"
 
 namespace leveldb {
@@ -284,6 +286,10 @@ private:
     byte max_height_;
     enum { HeightKeySize = 0, ValueOffset = 4, NextOffset = 8 };
     enum { kMaxHeight = 12 };
+    // As in L4SkipList: BatchSeek() interleaves up to kBatchSeek searches,
+    // worth it once the table is kBatchSeekBytes or larger.
+    enum { kBatchSeek = 16 };
+    static const nvOffset kBatchSeekBytes = 32 << 20;
     enum { VersionNumber = 0, NextValueOffset = 8, ValueSize = 12, ValueDataOffset = 16 };
     //L2SkipList* msl_;
     nvAddr mem() const { return arena_.Main(); }
@@ -438,6 +444,58 @@ public:
         assert(false);
         return nulloffset;
     }
+    // Seek() for keys[0,n-1] at once; the search for keys[i] starts from
+    // x[i] on level[i], and x[i] is set to its node or nulloffset.  Up to
+    // kBatchSeek searches take one step each in turn and prefetch the node
+    // they read next, so that their cache misses overlap.
+    void BatchSeek(const Slice* keys, size_t n, const byte* level, nvOffset* x) {
+        struct Search {
+            size_t i;
+            byte level;
+            nvOffset x, next;
+        };
+        Search searches[kBatchSeek];
+        size_t m = 0, pending = 0;
+        while (m < kBatchSeek && pending < n) {
+            Search& t = searches[m++];
+            t.i = pending++;
+            t.level = level[t.i];
+            t.x = x[t.i];
+            t.next = GetNext(t.x, t.level);
+            PrefetchNode(t.next);
+        }
+        size_t active = m;
+        while (active > 0) {
+            for (size_t s = 0; s < m; ++s) {
+                Search& t = searches[s];
+                if (t.i == n)
+                    continue;
+                int cmp = t.next == nulloffset ? -1 : keys[t.i].compare(GetKey(t.next));
+                if (cmp > 0) {
+                    t.x = t.next;       // Right.
+                } else if (t.level > 0) {
+                    t.level--;          // Down.
+                } else {
+                    x[t.i] = cmp == 0 ? t.next : nulloffset;
+                    if (pending == n) {
+                        t.i = n;
+                        --active;
+                        continue;
+                    }
+                    t.i = pending++;
+                    t.level = level[t.i];
+                    t.x = x[t.i];
+                }
+                t.next = GetNext(t.x, t.level);
+                PrefetchNode(t.next);
+            }
+        }
+    }
+    // The header, links and a short key of x.
+    void PrefetchNode(nvOffset x) {
+        if (x != nulloffset)
+            mng_->Prefetch(mem() + x, NextOffset + 4 * 2 + 16);
+    }
     nvOffset GetPrev(nvOffset x) {
         Slice target = GetKey(x);
         nvOffset next = nulloffset;
@@ -485,7 +543,7 @@ public:
         SetValuePtr(x, new_v);
         if (old_v == nulloffset) return;
 #ifdef NO_READ_DELAY
-        nvOffset size = *reinterpret_cast<nvOffset*>(arena_.main_ + old_v);
+        nvOffset size = *reinterpret_cast<nvOffset*>(mng_->main_block_->Decode(arena_.main_ + old_v));
 #else
         nvOffset size = mng_->read_ul(mem() + old_v);
 #endif
@@ -583,8 +641,9 @@ private:
     ull written_size_;
     ull created_time_;
     bool CacheSave(byte height);
+    void SeekStart(const Slice& key, nvOffset* y, byte* height);
 
-    int refs__;
+    std::atomic<int> refs__;
 
     port::RWLock lock_;
     bool immutable_;
@@ -606,6 +665,7 @@ public:
     nvOffset Seek(const Slice& key);
     bool Get(const Slice& key, std::string* value, Status* s);
     bool Get(const LookupKey& key, std::string* value, Status* s);
+    void MultiGet(KeyContext* keys, size_t n);
     void GarbageCollection();
     Iterator* NewIterator();
     Iterator* NewOfficialIterator(ull seq);
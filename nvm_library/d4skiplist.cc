@@ -4,9 +4,29 @@
 
 namespace leveldb {
 
+namespace {
+// Undo the pin a pinned Get() took.
+void ReleasePinnedValue(void* pin, void*) {
+    EpochDomain::Unpin(static_cast<int>(reinterpret_cast<intptr_t>(pin)));
+}
+
+// A table goes when its last reference does, but a reader may still hold a
+// value pinned in it: its memory waits for the readers.
+EpochDomain* RetiredTables() {
+    static EpochDomain* tables = new EpochDomain;
+    return tables;
+}
+template <typename Table>
+void DeleteTable(void* table) {
+    delete reinterpret_cast<Table*>(table);
+}
+}
+
 L4MemTableAllocator::~L4MemTableAllocator() {
     //printf("Deleting L4MemTableAllocator...\n");fflush(stdout);
-    mng_->Dispose(main_, total_size_);
+    delete retiring_;
+    if (!detached_)
+        mng_->Dispose(main_, total_size_);
     //printf("Deleting L4MemTableAllocator : Finished\n"); fflush(stdout);
 }
 L4SkipList::~L4SkipList() {
@@ -15,7 +35,8 @@ L4SkipList::~L4SkipList() {
 }
 L4Cache::~L4Cache() {
     //printf("Deleting L4Cache...\n");fflush(stdout);
-    arena_->Dispose(main_, size_);
+    if (!detached_)
+        arena_->Dispose(main_, size_);
     //printf("Deleting L4Cache : Finished\n"); fflush(stdout);
 }
 
@@ -23,16 +44,43 @@ L4Cache::~L4Cache() {
 L4SkipList::L4SkipList(NVM_Manager* mng, uint32_t size, uint32_t garbage_cache_size)
     : mng_(mng), arena_(mng, size, garbage_cache_size),
       head_(nulloffset),
-      max_height_(1)
+      max_height_(1), clean_(false)
 {
     head_ = NewNode("", "", kTypeDeletion, kMaxHeight, nullptr);
     for (byte i = 0; i < kMaxHeight; ++i)
         SetNext(head_, i, nulloffset);
     SetHead(head_);
 }
+L4SkipList::L4SkipList(NVM_Manager* mng, nvAddr main, uint32_t garbage_cache_size)  // Recovery.
+    : mng_(mng), arena_(mng, main, garbage_cache_size),
+      head_(static_cast<nvOffset>(mng->read_ull(main + L4MemTableAllocator::HeadAddress))),
+      max_height_(1),
+      clean_(mng->read_ul(main + L4MemTableAllocator::CleanShutdown) != 0)
+{
+    for (byte i = 1; i < kMaxHeight; ++i)
+        if (GetNext(head_, i) != nulloffset)
+            max_height_ = i + 1;
+    if (clean_) {
+        arena_.SetBound(static_cast<nvOffset>(mng_->read_ull(main + L4MemTableAllocator::NodeBound)),
+                        static_cast<nvOffset>(mng_->read_ull(main + L4MemTableAllocator::ValueBound)));
+    } else {
+        // Nodes grow upward from the header and values downward from the end,
+        // so the live bounds are the furthest node and the lowest live value.
+        nvOffset node_bound = L4MemTableAllocator::MemTableInfoSize;
+        nvOffset value_bound = arena_.Size();
+        for (nvOffset x = head_; x != nulloffset; x = GetNext(x, 0)) {
+            nvOffset end = GetKeyPtr(x) + GetKeySize(x);
+            if (end > node_bound) node_bound = end;
+            nvOffset v = GetValuePtr(x);
+            if (v != nulloffset && v < value_bound) value_bound = v;
+        }
+        arena_.SetBound(node_bound, value_bound);
+    }
+    mng_->write_ul_barrier(main + L4MemTableAllocator::CleanShutdown, 0);
+}
 L4SkipList::L4SkipList(const L4SkipList& t)  // Garbage Collection.
      : mng_(t.mng_), arena_(mng_, t.arena_.Size(), t.arena_.cache_.Bytes()),
-       head_(t.head_), max_height_(t.max_height_)
+       head_(t.head_), max_height_(t.max_height_), clean_(false)
  {
      byte* buf = new byte[t.arena_.Size()];
      mng_->read(buf, t.arena_.Main(), t.arena_.Size());
@@ -68,7 +116,7 @@ std::string D4MemTable::HashName(const Slice& dbname, ull seq) {
 }
 D4MemTable::D4MemTable(NVM_Manager* mng, const CachePolicy& cp, const Slice& dbname, ull seq) :
     mng_(mng), cp_(cp),
-    cache_(mng, cp_.hash_range_ + 1),
+    cache_(mng, static_cast<ul>(cp_.hash_range_ + 1), cp.hash_mirror_),
     //cache_enabled_(cp.node_cache_size_ > 32768),
     table_(mng_,
            static_cast<ul>(cp.nvskiplist_size_),
@@ -79,22 +127,51 @@ D4MemTable::D4MemTable(NVM_Manager* mng, const CachePolicy& cp, const Slice& dbn
     refs__(0), lock_(), immutable_(false) {
     mng_->bind_name(MemName(dbname_, seq_), table_.mem());
 }
+D4MemTable::D4MemTable(NVM_Manager* mng, const CachePolicy& cp, const Slice& dbname, ull seq,
+                       nvAddr location, nvAddr cache_location) :
+    mng_(mng), cp_(cp),
+    cache_(mng, cache_location, cp.hash_mirror_),
+    table_(mng_, location, static_cast<ul>(cp.garbage_cache_size_)),
+    rnd_(0xdeadbeef),
+    dbname_(dbname.ToString()), seq_(seq), pre_write_(0),
+    written_size_(0), created_time_(0),
+    refs__(0), lock_(), immutable_(false) {
+    cp_.hash_range_ = cache_.Size() - 1;
+    cp_.nvskiplist_size_ = table_.arena_.Size();
+    if (!table_.clean_)
+        RebuildHash();
+}
 
 D4MemTable::~D4MemTable() {
     //printf("Deleting D4MemTable...\n"); fflush(stdout);
     //delete cache_;
     //delete table_;
     //printf("Deleting D4MemTable : Finished\n"); fflush(stdout);
-
+    if (!table_.arena_.detached_)
+        DeleteName();
 }
 void D4MemTable::DeleteName() { mng_->delete_name(MemName(dbname_, seq_)); }
+void D4MemTable::RebuildHash() {
+    // Hash chains are linked after the node itself, so a crash may leave the
+    // newest nodes out of them.  Relink every node, in key order.
+    cache_.Clear();
+    std::vector<nvOffset> tail(cache_.Size(), nulloffset);
+    for (nvOffset x = table_.GetNext(table_.Head(), 0); x != nulloffset; x = table_.GetNext(x, 0)) {
+        nvOffset hash = Hash(table_.GetKey_(x));
+        table_.SetReserved_(x, nulloffset);
+        if (tail[hash] == nulloffset)
+            cache_.Write(hash, x);
+        else
+            table_.SetReserved_(tail[hash], x);
+        tail[hash] = x;
+    }
+}
 nvOffset D4MemTable::Seek(const Slice& key) {
     nvOffset y = table_.Head();
-    byte height = table_.max_height_-1;
-    if (table_.Seek(key, y, height, nullptr, nullptr)) {
+    nvOffset next[kMaxHeight];
+    if (table_.Seek(key, y, table_.max_height_-1, nullptr, next))
         return y;
-    }
-    return nulloffset;
+    return next[0];
 }
 bool D4MemTable::HashLocate(const Slice& key, nvOffset hash, nvOffset& node, nvOffset& next) {
     node = cache_.Read(hash);
@@ -171,26 +248,38 @@ bool D4MemTable::Get(const Slice& key, std::string* value, Status* s) {
 bool D4MemTable::Get(const LookupKey& key, std::string* value, Status* s) {
     return Get(key.user_key(), value, s);
 }
+bool D4MemTable::Get(const LookupKey& key, PinnableSlice* value, Status* s) {
+    EpochDomain::Guard guard;
+    nvOffset x = cache_.Read(Hash(key.user_key()));
+    if (x == 0) return false;
+    Slice v;
+    bool found = table_.Get_(x, key.user_key(), &v, s);
+    if (!found || v.size() == 0)
+        return found;
+    void* pin = reinterpret_cast<void*>(static_cast<intptr_t>(EpochDomain::Pin()));
+    value->PinSlice(v, &ReleasePinnedValue, pin, nullptr);
+    return true;
+}
 
 void D4MemTable::Ref() {refs__++;}
 void D4MemTable::Unref() {
-    --refs__;
-    assert(refs__ >= 0);
-    if (refs__ <= 0) {
-      delete this;
+    int refs = --refs__;
+    assert(refs >= 0);
+    if (refs <= 0) {
+      // Unbind the name now, so that a recovery does not find the table.
+      if (!table_.arena_.detached_)
+          DeleteName();
+      RetiredTables()->Retire(&DeleteTable<D4MemTable>, this);
     }
 }
 void D4MemTable::GarbageCollection() {
-    assert(false);
-    /*
-    CheckValid();
-    L4SkipList *t = new L4SkipList(*table_);
-    t->CheckValid();
-    mng_->bind_name(MemName(dbname_, seq_), t->mem());
-    L4SkipList *old = table_;
-    table_ = t;
-    delete old;
-    */
+    table_.CompactValues(nulloffset);
+}
+bool D4MemTable::GarbageCollectionStep(ull budget) {
+    return table_.CompactValues(budget < nulloffset ? static_cast<nvOffset>(budget) : nulloffset);
+}
+bool D4MemTable::GarbageCollectionBlocked() const {
+    return table_.CompactionBlocked();
 }
 
 Iterator* D4MemTable::NewIterator() { return new D4MemTableIterator(this, (1ULL<<56)-1); }
@@ -228,6 +317,17 @@ ull D4MemTable::StorageUsage() const {
 nvAddr D4MemTable::Location() const {
     return table_.mem();
 }
+bool D4MemTable::PersistentInfo(nvAddr* main, ull* main_size, nvAddr* aux, ull* aux_size) {
+    *main = table_.mem();
+    *main_size = table_.arena_.Size();
+    *aux = cache_.main_;
+    *aux_size = cache_.size_;
+    return true;
+}
+void D4MemTable::Detach() {
+    table_.arena_.Detach();
+    cache_.detached_ = true;
+}
 bool D4MemTable::HasRoomForWrite(const Slice& key, const Slice& value, bool nearly_full = false) {
     ull size = table_.StorageUsage() + key.size() + value.size() + 1024;
     return size < cp_.nvskiplist_size_ && !(nearly_full && size >= cp_.nearly_full_size_);
@@ -305,13 +405,23 @@ int D5MemTable::RandomHeight() {
     // Increase height with probability 1 in kBranching
     static const unsigned int kBranching = 4;
     int height = 1;
-    while (height < kMaxHeight && ((rnd_.Next() % kBranching) == 0)) {
+    while (height < kMaxHeight && ((NextRandom() % kBranching) == 0)) {
       height++;
     }
     //assert(height > 0);
     //assert(height <= kMaxHeight);
     return height;
 }
+uint32_t D5MemTable::NextRandom() {
+    // Several threads add to one table at once: each draws heights from its
+    // own generator, seeded apart from the others on first use.
+    static std::atomic<uint32_t> count(0);
+    static __thread uint32_t seed = 0;     // 0: not seeded yet.
+    if (seed == 0)
+        seed = 0xdeadbeef + 0x9e3779b9 * count.fetch_add(1);
+    seed = Random(seed).Next();
+    return seed;
+}
 std::string D5MemTable::MemName(const Slice& dbname, ull seq) {
     return dbname.ToString() + std::to_string(seq) + ".nvskiplist";
 }
@@ -325,52 +435,88 @@ D5MemTable::D5MemTable(NVM_Manager* mng, const CachePolicy& cp, const Slice& dbn
     table_(mng_,
            static_cast<ul>(cp.nvskiplist_size_),
            static_cast<ul>(cp.garbage_cache_size_)),
-    rnd_(0xdeadbeef),
-    dbname_(dbname.ToString()), seq_(seq), pre_write_(0),
+    dbname_(dbname.ToString()), seq_(seq), pre_write_(0), reserved_(0),
     written_size_(0), created_time_(0),
     refs__(0), lock_(), immutable_(false) {
+    table_.arena_.SetConcurrent();
     mng_->bind_name(MemName(dbname_, seq_), table_.mem());
 }
+D5MemTable::D5MemTable(NVM_Manager* mng, const CachePolicy& cp, const Slice& dbname, ull seq, nvAddr location) :
+    mng_(mng), cp_(cp),
+    table_(mng_, location, static_cast<ul>(cp.garbage_cache_size_)),
+    dbname_(dbname.ToString()), seq_(seq), pre_write_(0), reserved_(0),
+    written_size_(0), created_time_(0),
+    refs__(0), lock_(), immutable_(false) {
+    table_.arena_.SetConcurrent();
+    cp_.nvskiplist_size_ = table_.arena_.Size();
+}
 
 D5MemTable::~D5MemTable() {
     //printf("Deleting D4MemTable...\n"); fflush(stdout);
     //delete cache_;
     //delete table_;
     //printf("Deleting D4MemTable : Finished\n"); fflush(stdout);
-
+    if (!table_.arena_.detached_)
+        DeleteName();
 }
 void D5MemTable::DeleteName() { mng_->delete_name(MemName(dbname_, seq_)); }
 nvOffset D5MemTable::Seek(const Slice& key) {
     nvOffset y = table_.Head();
-    byte height = table_.max_height_-1;
-    if (table_.Seek(key, y, height, nullptr, nullptr)) {
+    nvOffset next[kMaxHeight];
+    if (table_.Seek(key, y, table_.max_height_-1, nullptr, next))
         return y;
-    }
-    return nulloffset;
+    return next[0];
 }
 void D5MemTable::Add(SequenceNumber seq, ValueType type,
                  const Slice& key,
                  const Slice& value) {
     //byte level = 0;
+    ull size = MaxSizeOf(key.size(), value.size());
     if (pre_write_ > 0)
-        pre_write_ -= MaxSizeOf(key.size(), value.size());
-    written_size_ += MaxSizeOf(key.size(), value.size());
-    nvOffset y = table_.Add(key, value, type, RandomHeight());
+        __sync_fetch_and_sub(&pre_write_, size);
+    __sync_fetch_and_add(&written_size_, size);
+    nvOffset y = table_.AddConcurrently(key, value, type, RandomHeight());
+    ReleaseRoom();
 }
 
 bool D5MemTable::Get(const LookupKey& key, std::string* value, Status* s) {
     return table_.Get(key, value, s);
 }
+bool D5MemTable::Get(const LookupKey& key, PinnableSlice* value, Status* s) {
+    EpochDomain::Guard guard;
+    Slice v;
+    bool found = table_.Get(key, &v, s);
+    if (!found || v.size() == 0)
+        return found;
+    void* pin = reinterpret_cast<void*>(static_cast<intptr_t>(EpochDomain::Pin()));
+    value->PinSlice(v, &ReleasePinnedValue, pin, nullptr);
+    return true;
+}
+
+void D5MemTable::MultiGet(KeyContext* keys, size_t n) {
+    table_.MultiGet(keys, n);
+}
 
 void D5MemTable::Ref() {refs__++;}
 void D5MemTable::Unref() {
-    --refs__;
-    assert(refs__ >= 0);
-    if (refs__ <= 0) {
-      delete this;
+    int refs = --refs__;
+    assert(refs >= 0);
+    if (refs <= 0) {
+      // Unbind the name now, so that a recovery does not find the table.
+      if (!table_.arena_.detached_)
+          DeleteName();
+      RetiredTables()->Retire(&DeleteTable<D5MemTable>, this);
     }
 }
-void D5MemTable::GarbageCollection() { assert(false); }
+void D5MemTable::GarbageCollection() {
+    table_.CompactValues(nulloffset);
+}
+bool D5MemTable::GarbageCollectionStep(ull budget) {
+    return table_.CompactValues(budget < nulloffset ? static_cast<nvOffset>(budget) : nulloffset);
+}
+bool D5MemTable::GarbageCollectionBlocked() const {
+    return table_.CompactionBlocked();
+}
 
 Iterator* D5MemTable::NewIterator() { return new D5MemTableIterator(this, (1ULL<<24)-1); }
 Iterator* D5MemTable::NewOfficialIterator(ull seq) { return new D5MemTableIterator(this, seq); }
@@ -407,9 +553,41 @@ ull D5MemTable::StorageUsage() const {
 nvAddr D5MemTable::Location() const {
     return table_.mem();
 }
+bool D5MemTable::PersistentInfo(nvAddr* main, ull* main_size, nvAddr* aux, ull* aux_size) {
+    *main = table_.mem();
+    *main_size = table_.arena_.Size();
+    *aux = nvnullptr;
+    *aux_size = 0;
+    return true;
+}
+void D5MemTable::Detach() {
+    table_.arena_.Detach();
+}
+// The room a thread took in HasRoomForWrite(), given back by its Add().
+static __thread const D5MemTable* room_table = nullptr;
+static __thread ull room_size = 0;
+
+void D5MemTable::ReleaseRoom() {
+    if (room_table != this) return;
+    reserved_.fetch_sub(room_size);
+    room_table = nullptr;
+}
 bool D5MemTable::HasRoomForWrite(const Slice& key, const Slice& value, bool nearly_full = false) {
-    ull size = table_.StorageUsage() + key.size() + value.size() + 1024;
-    return size < cp_.nvskiplist_size_ && !(nearly_full && size >= cp_.nearly_full_size_);
+    // Writers check under the shared lock: take the room with a CAS, so
+    // that they cannot all pass on the same free space.  The headroom is
+    // for the slice each stripe holds for nodes and values.
+    ReleaseRoom();
+    const ull size = MaxSizeOf(key.size(), value.size());
+    const ull headroom = 1024 + 2 * L4MemTableAllocator::kStripes * L4MemTableAllocator::kStripeSize;
+    ull reserved = reserved_.load();
+    do {
+        ull total = table_.StorageUsage() + reserved + size + headroom;
+        if (total >= cp_.nvskiplist_size_ || (nearly_full && total >= cp_.nearly_full_size_))
+            return false;
+    } while (!reserved_.compare_exchange_weak(reserved, reserved + size));
+    room_table = this;
+    room_size = size;
+    return true;
 }
 bool D5MemTable::PreWrite(const Slice& key, const Slice& value, bool nearly_full = false) {
     ull total = MaxSizeOf(key.size(), value.size());
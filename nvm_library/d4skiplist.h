@@ -4,7 +4,12 @@
 #include "db/dbformat.h"
 #include "leveldb/env.h"
 #include <string>
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <algorithm>
 #include "port/port_posix.h"
+#include "epoch.h"
 
 namespace leveldb {
 
@@ -16,46 +21,124 @@ public:
     nvOffset total_size_, rest_size_;
     nvOffset node_bound_, value_bound_;
     static const ull BlockSize = (1<<20);
-    enum {TotalSize = 0, NodeBound = 8, ValueBound = 16, HeadAddress = 24, MemTableInfoSize = 32 };
+    enum {TotalSize = 0, NodeBound = 8, ValueBound = 16, HeadAddress = 24, CleanShutdown = 32, MemTableInfoSize = 40 };
     nvOffset node_record_size_, value_record_size_;
+    bool detached_;
+
+    // With several writers (SetConcurrent()), each writer thread allocates
+    // from the slices of its stripe and takes mutex_ only to refill them.
+    enum { kStripes = 8, kStripeSize = 4096 };
+    struct Stripe {
+        std::mutex mutex_;
+        nvOffset node_, node_end_, value_, value_end_;
+        Stripe() : node_(0), node_end_(0), value_(0), value_end_(0) {}
+    };
+    bool concurrent_;
+    std::mutex mutex_;
+    Stripe stripes_[kStripes];
+    // While L4SkipList::CompactValues() runs, Reserve() drops the garbage:
+    // the compaction frees it.  Changed only with the memtable locked.
+    bool compacting_;
+    // While compacting_: live values above cursor_ are packed, and a value
+    // freed below it ends at freed_top_ at most.  The compaction may write
+    // there only once no reader can hold such a value.
+    nvOffset cursor_, freed_top_;
+    // A reader may still hold a freed value (see EpochDomain::Pin()), so
+    // Reserve() retires values in batches and Recycle() hands a batch to
+    // cache_ once no reader can.  A compaction frees all of them itself and
+    // bumps generation_, which makes the batches retired before it void.
+    enum { kRetireBatch = 32 };
+    struct RetiredValues {
+        L4MemTableAllocator* arena_;
+        ull generation_;
+        std::vector<std::pair<nvOffset, nvOffset> > values_;
+    };
+    RetiredValues* retiring_;
+    nvOffset retired_size_;
+    ull generation_;
 
     ~L4MemTableAllocator();
     L4MemTableAllocator(NVM_Manager* mng, ul size, ul buffer_size) :
         mng_(mng), cache_(buffer_size),
         main_(mng->Allocate(size)),
         total_size_(size), rest_size_(size - MemTableInfoSize),
-        node_bound_(MemTableInfoSize), value_bound_(total_size_), node_record_size_(BlockSize), value_record_size_(0)
+        node_bound_(MemTableInfoSize), value_bound_(total_size_), node_record_size_(BlockSize), value_record_size_(0),
+        detached_(false), concurrent_(false), compacting_(false), cursor_(0), freed_top_(0),
+        retiring_(nullptr), retired_size_(0), generation_(0)
     {
         mng->write_ull(main_ + NodeBound, node_record_size_);
         mng->write_ull(main_ + ValueBound, total_size_ - value_record_size_);
-        mng->write_ull(main_ + NodeBound, total_size_);
+        mng->write_ull(main_ + TotalSize, total_size_);
         mng->write_ull(main_ + HeadAddress, nvnullptr);
+        mng->write_ul(main_ + CleanShutdown, 0);
         assert(size > BlockSize);
     }
+    // Attach to an existing image; the bounds are set by the owner via SetBound().
+    L4MemTableAllocator(NVM_Manager* mng, nvAddr main, ul buffer_size) :
+        mng_(mng), cache_(buffer_size),
+        main_(main),
+        total_size_(static_cast<nvOffset>(mng->read_ull(main + TotalSize))), rest_size_(0),
+        node_bound_(MemTableInfoSize), value_bound_(total_size_), node_record_size_(BlockSize), value_record_size_(0),
+        detached_(false), concurrent_(false), compacting_(false), cursor_(0), freed_top_(0),
+        retiring_(nullptr), retired_size_(0), generation_(0)
+    {
+    }
+    void SetConcurrent() { concurrent_ = true; }
     nvOffset AllocateNode(nvOffset size) {
-        if (size > rest_size_) return nulloffset;
-        nvOffset ans = node_bound_;
-        node_bound_ += size;
-        rest_size_ -= size;
-        if (node_bound_ > node_record_size_) SetNodeRecord();
-        return ans;
+        if (concurrent_) return AllocateInStripe(size, true);
+        return AllocateNode_(size);
     }
     nvOffset AllocateValue(nvOffset size) {
+        if (concurrent_) {
+            // Only updates leave garbage; inserts skip mutex_ while there is none.
+            if (cache_.found_ > 0) {
+                std::lock_guard<std::mutex> guard(mutex_);
+                nvOffset ans = cache_.Allocate(size);
+                if (ans != nulloffset) return ans;
+            }
+            return AllocateInStripe(size, false);
+        }
         if (size > rest_size_) return nulloffset;
         nvOffset ans = cache_.Allocate(size);
         if (ans != nulloffset) return ans;
-        value_bound_ -= size;
-        rest_size_ -= size;
-        if (value_bound_ + value_record_size_ > total_size_) SetValueRecord();
-        return value_bound_;
+        return AllocateValue_(size);
     }
 
     void Reserve(nvOffset addr, nvOffset size) {
-        cache_.Reserve(addr, size);
+        RetiredValues* full = nullptr;
+        {
+            std::unique_lock<std::mutex> guard(mutex_, std::defer_lock);
+            if (concurrent_) guard.lock();
+            if (compacting_) {
+                if (addr < cursor_ && addr + size > freed_top_)
+                    freed_top_ = addr + size;
+                return;
+            }
+            if (retiring_ == nullptr) {
+                retiring_ = new RetiredValues;
+                retiring_->arena_ = this;
+                retiring_->generation_ = generation_;
+            }
+            retiring_->values_.push_back(std::make_pair(addr, size));
+            retired_size_ += size;
+            if (retiring_->values_.size() >= kRetireBatch)
+                std::swap(full, retiring_);
+        }
+        // Outside mutex_: Retire() may run Recycle() right away.
+        if (full != nullptr)
+            epoch_.Retire(&Recycle, full);
+    }
+
+    // size bytes that no one will use again, e.g. a node that lost a race
+    // and was never linked.
+    void Lose(nvOffset size) {
+        std::unique_lock<std::mutex> guard(mutex_, std::defer_lock);
+        if (concurrent_) guard.lock();
+        cache_.lost_ += size;
     }
 
     nvOffset Garbage() const {
-        return cache_.lost_ + cache_.found_;
+        return cache_.lost_ + cache_.found_ + retired_size_;
     }
 
     nvAddr Main() const { return main_; }
@@ -81,6 +164,103 @@ public:
         cache_.Clear();
     }
 
+    // Values are packed toward the top of the value region while a
+    // compaction runs; then [value_bound_, value_bound) is free again.
+    void BeginCompaction() {
+        compacting_ = true;
+        cursor_ = freed_top_ = total_size_;     // Readers may hold any garbage.
+        cache_.Clear();
+        DropValueSlices();
+        std::unique_lock<std::mutex> guard(mutex_, std::defer_lock);
+        if (concurrent_) guard.lock();
+        generation_++;
+        delete retiring_;
+        retiring_ = nullptr;
+        retired_size_ = 0;
+    }
+    // The rest of each stripe's value slice becomes garbage.
+    void DropValueSlices() {
+        for (int i = 0; i < kStripes; ++i)
+            stripes_[i].value_ = stripes_[i].value_end_ = 0;
+    }
+    void EndCompaction(nvOffset value_bound) {
+        assert(value_bound >= value_bound_);
+        rest_size_ += value_bound - value_bound_;
+        value_bound_ = value_bound;
+        SetValueRecord();
+        compacting_ = false;
+    }
+
+    // Keep the image on destruction and record its exact bounds, so that a
+    // reopen does not have to scan the nodes to find them.
+    void Detach() {
+        mng_->write_ull(main_ + NodeBound, node_bound_);
+        mng_->write_ull(main_ + ValueBound, value_bound_);
+        mng_->write_ul_barrier(main_ + CleanShutdown, 1);
+        detached_ = true;
+    }
+
+private:
+    static void Recycle(void* arg) {
+        RetiredValues* r = reinterpret_cast<RetiredValues*>(arg);
+        L4MemTableAllocator* a = r->arena_;
+        std::unique_lock<std::mutex> guard(a->mutex_, std::defer_lock);
+        if (a->concurrent_) guard.lock();
+        if (r->generation_ == a->generation_) {
+            for (size_t i = 0; i < r->values_.size(); ++i) {
+                a->cache_.Reserve(r->values_[i].first, r->values_[i].second);
+                a->retired_size_ -= r->values_[i].second;
+            }
+        }
+        delete r;
+    }
+    nvOffset AllocateNode_(nvOffset size) {
+        if (size > rest_size_) return nulloffset;
+        nvOffset ans = node_bound_;
+        node_bound_ += size;
+        rest_size_ -= size;
+        if (node_bound_ > node_record_size_) SetNodeRecord();
+        return ans;
+    }
+    nvOffset AllocateValue_(nvOffset size) {
+        if (size > rest_size_) return nulloffset;
+        value_bound_ -= size;
+        rest_size_ -= size;
+        if (value_bound_ + value_record_size_ > total_size_) SetValueRecord();
+        return value_bound_;
+    }
+    static ul StripeOf() {
+        static std::atomic<ul> count(0);
+        static __thread ul stripe = 0;     // 0: not assigned yet.
+        if (stripe == 0)
+            stripe = count.fetch_add(1) % kStripes + 1;
+        return stripe - 1;
+    }
+    nvOffset AllocateInStripe(nvOffset size, bool node) {
+        Stripe& s = stripes_[StripeOf()];
+        std::lock_guard<std::mutex> guard(s.mutex_);
+        nvOffset& cur = node ? s.node_ : s.value_;
+        nvOffset& end = node ? s.node_end_ : s.value_end_;
+        if (end - cur < size) {
+            // The rest of the old slice is dropped.
+            nvOffset slice = size > kStripeSize ? size : static_cast<nvOffset>(kStripeSize);
+            nvOffset x;
+            {
+                std::lock_guard<std::mutex> g(mutex_);
+                if (slice > rest_size_) slice = size;
+                x = node ? AllocateNode_(slice) : AllocateValue_(slice);
+            }
+            if (x == nulloffset) return nulloffset;
+            cur = x;
+            end = x + slice;
+        }
+        nvOffset ans = cur;
+        cur += size;
+        return ans;
+    }
+    // Last, so that its pending Recycle() calls run before the rest goes.
+    EpochDomain epoch_;
+public:
     L4MemTableAllocator(const L4MemTableAllocator&) = delete;
     void operator=(const L4MemTableAllocator&) = delete;
 };
@@ -90,8 +270,37 @@ public:
         L4MemTableAllocator arena_;
         nvOffset head_;
         byte max_height_;
+        bool clean_;        // Reopened after Detach(), no scan was needed.
+        // State of CompactValues() between its calls.
+        struct Compaction {
+            bool running_;
+            // The first pass moves the values there were when the
+            // compaction began, those above bottom_; it scans the nodes for
+            // them, scan_ is the next one.
+            nvOffset bottom_;
+            bool scanning_;
+            nvOffset scan_;
+            // (value, node) of the values of this pass, a max-heap.
+            std::vector<std::pair<nvOffset, nvOffset> > values_;
+            // (value, node) of the values written since this pass began,
+            // which the next pass moves.  Under arena_.mutex_ for several
+            // writers.
+            std::vector<std::pair<nvOffset, nvOffset> > written_;
+            // Until Passed(fence_), readers may hold values freed below
+            // fenced_top_.
+            bool fenced_;
+            uint64_t fence_;
+            nvOffset fenced_top_;
+            Compaction() : running_(false), bottom_(0), scanning_(false), scan_(0),
+                           fenced_(false), fence_(0), fenced_top_(0) {}
+        } compaction_;
         enum { HeightKeySize = 0, ReservedOffset = 4, ValueOffset = 8, NextOffset = 12 };
         enum { kMaxHeight = 12 };
+        // MultiGet() runs up to kBatchSeek searches at once in a table of
+        // at least kBatchSeekBytes; a smaller one stays in the cache, where
+        // taking turns costs more than the misses it hides.
+        enum { kBatchSeek = 16 };
+        static const nvOffset kBatchSeekBytes = 32 << 20;
         enum { VersionNumber = 0, NextValueOffset = 8, ValueSize = 12, ValueDataOffset = 16 };
         //L2SkipList* msl_;
         nvAddr mem() const { return arena_.Main(); }
@@ -133,10 +342,11 @@ public:
         }
         Slice GetValue(nvOffset x) const {
            //assert(x != nulloffset);
-           nvOffset valueptr = GetValuePtr(x);
+           return ValueAt(GetValuePtr(x));
+        }
+        Slice ValueAt(nvOffset valueptr) const {
            if (valueptr == nulloffset)
                return Slice();
-           nvOffset valuesize = ValueGetSize(valueptr);
            return  mng_->GetSlice(mem() + valueptr + 4, ValueGetSize(valueptr));
         }
         bool GetValue(nvOffset x, std::string* value) {
@@ -186,6 +396,7 @@ public:
     public:
        ~L4SkipList();
        L4SkipList(NVM_Manager* mng, uint32_t size, uint32_t garbage_cache_size);
+       L4SkipList(NVM_Manager* mng, nvAddr main, uint32_t garbage_cache_size);
        L4SkipList(const L4SkipList& t);
 
        void SetHead(nvOffset head) {
@@ -194,19 +405,29 @@ public:
        }
      // An iterator is either positioned at a key/value pair, or
      // not valid.  This method returns true iff the iterator is valid.
-        bool Seek(const Slice& target, nvOffset &x_, byte level, nvOffset *prev = nullptr, nvOffset *pnext = nullptr) {
+        // pnext_key, if given, gets the keys of pnext.
+        bool Seek(const Slice& target, nvOffset &x_, byte level, nvOffset *prev = nullptr, nvOffset *pnext = nullptr,
+                  Slice *pnext_key = nullptr) {
             //byte level = max_height_ - 1;
             static nvOffset __thread next = nulloffset;
             int cmp;
+            Slice key;
 
             while (true) {
                 next = GetNext(x_, level);
-                cmp = next == nulloffset ? -1 : target.compare(GetKey(next));
+                if (next == nulloffset) {
+                    cmp = -1;
+                    key.clear();
+                } else {
+                    key = GetKey(next);
+                    cmp = target.compare(key);
+                }
                 if (cmp > 0)
                     x_ = next;      // Right.
                 else {
                     if (prev) prev[level] = x_;
                     if (pnext) pnext[level] = next;
+                    if (pnext_key) pnext_key[level] = key;
                     if (level == 0) {
                         if (cmp == 0) {
                             x_ = next;
@@ -255,6 +476,9 @@ public:
                 }
 
             nvOffset x = NewNode(key, value, type, height, next);
+            // One fence per insert: the node must be durable before it is
+            // linked, the links themselves are ordered by the next fence.
+            mng_->Fence();
             if (height > max_height_) {
                 for (byte i = max_height_; i < height; ++i)
                     SetNext(head_, i, x);
@@ -262,20 +486,77 @@ public:
             }
             for (byte i = 0; i < height; ++i)
                 SetNext(prev[i], i, x);
+            Written(x, GetValuePtr(x));
             return x;
         }
         void Update(nvOffset x, const Slice& value, ValueType type) {
             nvOffset old_v = GetValuePtr(x);
             nvOffset new_v = type == kTypeDeletion ? nulloffset : NewValue(value);
+            mng_->Fence();
             SetValuePtr(x, new_v);
+            Written(x, new_v);
             if (old_v == nulloffset) return;
     #ifdef NO_READ_DELAY
-            nvOffset size = *reinterpret_cast<nvOffset*>(arena_.main_ + old_v);
+            nvOffset size = *reinterpret_cast<nvOffset*>(mng_->main_block_->Decode(arena_.main_ + old_v));
     #else
             nvOffset size = mng_->read_ul(mem() + old_v);
     #endif
             arena_.Reserve(old_v, size + 4);
         }
+        // Move prev right until next is the first node at level whose key
+        // is not less than key.
+        void FindSplice(const Slice& key, byte level, nvOffset& prev, nvOffset& next) {
+            while (true) {
+                next = GetNext(prev, level);
+                if (next == nulloffset || key.compare(GetKey(next)) <= 0)
+                    return;
+                prev = next;
+            }
+        }
+        void SwapValue(nvOffset x, nvOffset new_v) {
+            nvOffset old_v = mng_->exchange_ul(mem() + x + ValueOffset, new_v);
+            Written(x, new_v);
+            if (old_v != nulloffset)
+                arena_.Reserve(old_v, ValueGetSize(old_v) + 4);
+        }
+        // Add() for several writers at once.  A node is published level by
+        // level with a CAS on its predecessor; a writer that loses a race
+        // searches again from the predecessor it had on that level only.
+        nvOffset AddConcurrently(const Slice& key, const Slice& value, ValueType type, byte height) {
+            nvOffset x = head_;
+            nvOffset prev[kMaxHeight], next[kMaxHeight];
+            byte top = max_height_;
+            if (Seek(key, x, top - 1, prev, next)) {
+                nvOffset v = type == kTypeDeletion ? nulloffset : NewValue(value);
+                mng_->Fence();
+                SwapValue(x, v);
+                return nulloffset;
+            }
+            for (byte i = top; i < height; ++i) {
+                prev[i] = head_;
+                FindSplice(key, i, prev[i], next[i]);
+            }
+            x = NewNode(key, value, type, height, next);
+            mng_->Fence();
+            for (byte i = 0; i < height; ++i) {
+                while (!mng_->cas_ul(mem() + prev[i] + NextOffset + i * 4, next[i], x)) {
+                    FindSplice(key, i, prev[i], next[i]);
+                    if (i == 0 && next[0] != nulloffset && key.compare(GetKey(next[0])) == 0) {
+                        // Another writer inserted the same key first: x is
+                        // never linked, hand its value to that node.
+                        SwapValue(next[0], GetValuePtr(x));
+                        arena_.Lose(NextOffset + sizeof (nvOffset) * height + key.size());
+                        return nulloffset;
+                    }
+                    SetNext(x, i, next[i]);
+                }
+            }
+            byte h = max_height_;
+            while (height > h && !__sync_bool_compare_and_swap(&max_height_, h, height))
+                h = max_height_;
+            Written(x, GetValuePtr(x));
+            return x;
+        }
         nvOffset GetReserved_(nvOffset x) const {
             return mng_->read_ul(mem() + x + ReservedOffset);
         }
@@ -293,37 +574,309 @@ public:
             Update(x, value, type);
             return nulloffset;
         }
+        // A running compaction has to move the value v of x too.  Writers
+        // hold the memtable lock shared at least, so running_ stays put.
+        void Written(nvOffset x, nvOffset v) {
+            if (!compaction_.running_ || v == nulloffset)
+                return;
+            std::unique_lock<std::mutex> guard(arena_.mutex_, std::defer_lock);
+            if (arena_.concurrent_) guard.lock();
+            compaction_.written_.push_back(std::make_pair(v, x));
+        }
+        // Visiting a node in the scan of the first pass costs about as much
+        // as moving this many bytes.
+        enum { kScanCost = 16 };
+        // Go on with the scan until *cost reaches budget; true once it is
+        // over.
+        bool ScanCompactionPass(nvOffset* cost, nvOffset budget) {
+            Compaction& c = compaction_;
+            for (; c.scan_ != nulloffset; c.scan_ = GetNext(c.scan_, 0)) {
+                if (*cost >= budget)
+                    return false;
+                *cost += kScanCost;
+                nvOffset v = GetValuePtr(c.scan_);
+                if (v != nulloffset && v >= c.bottom_) {
+                    c.values_.push_back(std::make_pair(v, c.scan_));
+                    std::push_heap(c.values_.begin(), c.values_.end());
+                }
+            }
+            c.scanning_ = false;
+            return true;
+        }
+        // Whether the compaction may write from lo up to the cursor, where
+        // it may have freed values itself.  If a reader may still hold one
+        // of them, a grace period starts and the caller comes back later.
+        bool Writable(nvOffset lo) {
+            Compaction& c = compaction_;
+            if (c.fenced_ && EpochDomain::Passed(c.fence_))
+                c.fenced_ = false;
+            if (c.fenced_ && lo < c.fenced_top_)
+                return false;
+            if (lo >= arena_.freed_top_)
+                return true;
+            // A newer fence covers the older one too.
+            c.fenced_top_ = c.fenced_ ? std::max(c.fenced_top_, arena_.freed_top_) : arena_.freed_top_;
+            c.fence_ = EpochDomain::Fence();
+            c.fenced_ = true;
+            arena_.freed_top_ = 0;
+            if (!EpochDomain::Passed(c.fence_))
+                return false;
+            c.fenced_ = false;
+            return true;
+        }
+        // Move live values to the top of the value region, highest first,
+        // and free the space below them once none is left.  Each call moves
+        // at most budget bytes, a node scanned counting kScanCost; Add() may
+        // run between calls but not during one.  A value is written to its new place before its node points
+        // there, so a crash loses no value.  Space that held a value is
+        // written again only once no reader can hold the value.  Returns
+        // true when done, or when such a reader stops it; the next call goes
+        // on from there.
+        bool CompactValues(nvOffset budget) {
+            Compaction& c = compaction_;
+            if (!c.running_) {
+                // New values come from below bottom_ from now on.
+                arena_.BeginCompaction();
+                c.running_ = true;
+                c.bottom_ = arena_.value_bound_;
+                c.scanning_ = true;
+                c.scan_ = GetNext(head_, 0);
+                c.values_.clear();
+                c.written_.clear();
+                c.fenced_ = false;
+            }
+            std::string buf;
+            nvOffset moved = 0;     // Scans count too.
+            while (true) {
+                if (c.scanning_) {
+                    if (!ScanCompactionPass(&moved, budget))
+                        return false;
+                    continue;
+                }
+                if (c.values_.empty()) {
+                    if (c.written_.empty())
+                        break;
+                    // The values of a pass are above those written after
+                    // it began, once the slices they came from are dropped.
+                    arena_.DropValueSlices();
+                    c.values_.swap(c.written_);
+                    std::make_heap(c.values_.begin(), c.values_.end());
+                    continue;
+                }
+                if (moved >= budget)
+                    return false;
+                nvOffset v = c.values_.front().first;
+                nvOffset x = c.values_.front().second;
+                if (GetValuePtr(x) != v) {
+                    PopCompactionValue();
+                    continue;       // Overwritten, v is garbage now.
+                }
+                nvOffset size = ValueGetSize(v) + 4;
+                if (arena_.cursor_ - v < 2 * size) {
+                    // The new place would overlap the old one: leave the
+                    // value there, the gap above it stays lost.
+                    arena_.cursor_ = v;
+                    PopCompactionValue();
+                    continue;
+                }
+                if (!Writable(arena_.cursor_ - size))
+                    return true;
+                PopCompactionValue();
+                buf.resize(size);
+                mng_->read(reinterpret_cast<byte*>(&buf[0]), mem() + v, size);
+                mng_->write(mem() + arena_.cursor_ - size, reinterpret_cast<const byte*>(buf.data()), size);
+                mng_->Fence();
+                arena_.cursor_ -= size;
+                SetValuePtr(x, arena_.cursor_);
+                arena_.Reserve(v, size);
+                moved += size;
+            }
+            if (!Writable(arena_.value_bound_))
+                return true;
+            arena_.EndCompaction(arena_.cursor_);
+            c.running_ = false;
+            std::vector<std::pair<nvOffset, nvOffset> >().swap(c.values_);
+            std::vector<std::pair<nvOffset, nvOffset> >().swap(c.written_);
+            return true;
+        }
+        void PopCompactionValue() {
+            std::vector<std::pair<nvOffset, nvOffset> >& values = compaction_.values_;
+            std::pop_heap(values.begin(), values.end());
+            values.pop_back();
+        }
+        // A compaction waits for readers that may hold values it freed.
+        bool CompactionBlocked() const {
+            const Compaction& c = compaction_;
+            return c.running_ && c.fenced_ && !EpochDomain::Passed(c.fence_);
+        }
         bool Get(const LookupKey& lkey, std::string* value, Status* s) {
+            Slice v;
+            if (!Get(lkey, &v, s))
+                return false;
+            if (v.size() > 0)
+                value->assign(v.data(), v.size());
+            return true;
+        }
+        // *value refers to the value in NVM; it stays there while the
+        // caller is inside an EpochDomain::Guard or holds a pin.
+        bool Get(const LookupKey& lkey, Slice* value, Status* s) {
             Slice key = lkey.user_key();
             nvOffset x_ = head_;
             if (Seek(key, x_, max_height_-1, nullptr, nullptr)) {
-                Slice v = GetValue(x_);
-                if (v.size() > 0) {
-                    value->assign(v.data(), v.size());
-                    return true;
-                } else {
+                *value = GetValue(x_);
+                if (value->size() == 0)
                     *s = Status::NotFound(Slice());
-                    return true;
-                }
+                return true;
             }
             return false;
         }
+        // Seek() for keys[0,n-1], sorted, at once; x[i] is set to the node
+        // of keys[i] or nulloffset.  The keys are dealt out to at most
+        // kBatchSeek strands of neighbouring keys.  The strands take one
+        // step each in turn and prefetch the node they read next, so that
+        // their cache misses overlap instead of adding up.  Within a strand
+        // the searches go on from each other as in MultiGet().
+        void BatchSeek(const Slice* keys, size_t n, nvOffset* x) {
+            struct Strand {
+                size_t i, end;      // Searching keys[i], up to keys[end].
+                byte level;
+                nvOffset x, next;
+                nvOffset prev[kMaxHeight], succ[kMaxHeight];
+                Slice succ_key[kMaxHeight];
+            };
+            Strand strands[kBatchSeek];
+            const size_t m = std::min<size_t>(n, kBatchSeek);
+            const byte top = max_height_;
+            for (size_t s = 0; s < m; ++s) {
+                Strand& t = strands[s];
+                t.i = n * s / m;
+                t.end = n * (s + 1) / m;
+                t.level = top - 1;
+                t.x = head_;
+                t.next = GetNext(t.x, t.level);
+                PrefetchNode(t.next);
+            }
+            size_t active = m;
+            while (active > 0) {
+                for (size_t s = 0; s < m; ++s) {
+                    Strand& t = strands[s];
+                    if (t.i == t.end)
+                        continue;
+                    Slice key;
+                    int cmp = -1;
+                    if (t.next != nulloffset) {
+                        key = GetKey(t.next);
+                        cmp = keys[t.i].compare(key);
+                    }
+                    if (cmp > 0) {
+                        t.x = t.next;       // Right.
+                    } else {
+                        t.prev[t.level] = t.x;
+                        t.succ[t.level] = t.next;
+                        t.succ_key[t.level] = key;
+                        if (t.level > 0) {
+                            t.level--;      // Down.
+                        } else {
+                            x[t.i] = cmp == 0 ? t.next : nulloffset;
+                            if (++t.i == t.end) {
+                                --active;
+                                continue;
+                            }
+                            byte level = 0;
+                            while (level < top - 1 && t.succ[level] != nulloffset &&
+                                   keys[t.i].compare(t.succ_key[level]) > 0)
+                                ++level;
+                            t.level = level;
+                            t.x = t.prev[level];
+                        }
+                    }
+                    t.next = GetNext(t.x, t.level);
+                    PrefetchNode(t.next);
+                }
+            }
+        }
+        // The header, links and a short key of x.
+        void PrefetchNode(nvOffset x) {
+            if (x != nulloffset)
+                mng_->Prefetch(mem() + x, NextOffset + 4 * 2 + 16);
+        }
+        void BatchGet(KeyContext* keys, size_t n) {
+            std::vector<Slice> key(n);
+            std::vector<nvOffset> x(n);
+            for (size_t i = 0; i < n; ++i)
+                key[i] = keys[i].key->user_key();
+            BatchSeek(&key[0], n, &x[0]);
+            // Load the values together as well.
+            for (size_t i = 0; i < n; ++i) {
+                nvOffset v = x[i] == nulloffset ? nulloffset : GetValuePtr(x[i]);
+                if (v != nulloffset)
+                    mng_->Prefetch(mem() + v, 64);
+            }
+            for (size_t i = 0; i < n; ++i) {
+                KeyContext& c = keys[i];
+                c.found = x[i] != nulloffset;
+                if (!c.found)
+                    continue;
+                Slice v = GetValue(x[i]);
+                if (v.size() > 0)
+                    c.value->assign(v.data(), v.size());
+                else
+                    *c.s = Status::NotFound(Slice());
+            }
+        }
+        // Get() for keys sorted by user key.  A search starts on the lowest
+        // level where the key is not past the previous search's successor,
+        // from that search's predecessor, instead of from the head.  The
+        // successors' keys were read by the previous searches already.
+        // Large tables go through BatchGet().
+        void MultiGet(KeyContext* keys, size_t n) {
+            if (n > 1 && arena_.StorageUsage() >= kBatchSeekBytes) {
+                BatchGet(keys, n);
+                return;
+            }
+            nvOffset prev[kMaxHeight], next[kMaxHeight];
+            Slice next_key[kMaxHeight];
+            byte top = max_height_;
+            for (size_t i = 0; i < n; ++i) {
+                Slice key = keys[i].key->user_key();
+                byte level = top - 1;
+                nvOffset x = head_;
+                if (i > 0) {
+                    level = 0;
+                    while (level < top - 1 && next[level] != nulloffset &&
+                           key.compare(next_key[level]) > 0)
+                        ++level;
+                    x = prev[level];
+                }
+                keys[i].found = Seek(key, x, level, prev, next, next_key);
+                if (!keys[i].found)
+                    continue;
+                Slice v = GetValue(x);
+                if (v.size() > 0)
+                    keys[i].value->assign(v.data(), v.size());
+                else
+                    *keys[i].s = Status::NotFound(Slice());
+            }
+        }
         bool Get_(nvOffset x, const Slice& key, std::string *value, Status *s) {
+            Slice v;
+            if (!Get_(x, key, &v, s))
+                return false;
+            if (v.size() > 0)
+                value->assign(v.data(), v.size());
+            return true;
+        }
+        bool Get_(nvOffset x, const Slice& key, Slice* value, Status *s) {
             //if (x == nulloffset) return false;
             int cmp;
             while ((cmp = GetKey(x).compare(key)) != 0) {
                 x = GetReserved_(x);
                 if (x == nulloffset || cmp > 0) return false;
             }
-            Slice v = GetValue(x);
-            if (v.size() > 0) {
-                value->assign(v.data(), v.size());
-                return true;
-            } else {
+            *value = GetValue(x);
+            if (value->size() == 0)
                 *s = Status::NotFound(Slice());
-                return true;
-            }
-            return false;
+            return true;
         }
         ull StorageUsage() const {
             return arena_.StorageUsage();
@@ -380,6 +933,9 @@ public:
         const ul array_size_;
         const ul size_;
         const nvAddr main_;
+        bool detached_;
+        // A DRAM copy of the buckets, written through; empty if disabled.
+        std::vector<ElementType> mirror_;
 
         nvOffset LocalAddress(ul x) { return Reserved + x * ElementSize; }
         void MetaWrite4(nvOffset x, ul y) { arena_->write_ul(main_ + x, y); }
@@ -391,16 +947,37 @@ public:
         }
     public:
         ~L4Cache();
-        L4Cache(NVM_Manager* arena, ul size) :
+        L4Cache(NVM_Manager* arena, ul size, bool mirror) :
             arena_(arena),
             array_size_(size), size_(size * 4 + Reserved),
-            main_(arena_->Allocate(size_)) {
+            main_(arena_->Allocate(size_)), detached_(false),
+            mirror_(mirror ? size : 0, 0) {
             Init();
         }
-        nvOffset Read(ul x) { return arena_->read_ul(main_ + LocalAddress(x)); }
-        void Write(ul x, ul y) { arena_->write_ul(main_ + LocalAddress(x), y); }
+        L4Cache(NVM_Manager* arena, nvAddr main, bool mirror) :   // Recovery.
+            arena_(arena),
+            array_size_(arena->read_ul(main + LengthOffset)), size_(array_size_ * 4 + Reserved),
+            main_(main), detached_(false) {
+            if (mirror) {
+                mirror_.resize(array_size_);
+                arena_->read(reinterpret_cast<byte*>(&mirror_[0]), main_ + Reserved, size_ - Reserved);
+            }
+        }
+        nvOffset Read(ul x) {
+            if (!mirror_.empty())
+                return mirror_[x];
+            return arena_->read_ul(main_ + LocalAddress(x));
+        }
+        void Write(ul x, ul y) {
+            arena_->write_ul(main_ + LocalAddress(x), y);
+            if (!mirror_.empty())
+                mirror_[x] = y;
+        }
         nvOffset Size() const { return array_size_; }
-        void Clear() { arena_->write_zero(main_ + Reserved, size_ - Reserved); }
+        void Clear() {
+            arena_->write_zero(main_ + Reserved, size_ - Reserved);
+            std::fill(mirror_.begin(), mirror_.end(), 0);
+        }
     };
     struct D4MemTable : nvMemTable {
     private:
@@ -424,7 +1001,7 @@ public:
         ull written_size_;
         ull created_time_;
 
-        int refs__;
+        std::atomic<int> refs__;
 
         port::RWLock lock_;
         bool immutable_;
@@ -439,6 +1016,8 @@ public:
             return keysize + valuesize + (1 + 4 + 4 + 4 * kMaxHeight + 4);
         }
         void DeleteName();
+        void RebuildHash();
+        // The first node whose key is not less than key.
         nvOffset Seek(const Slice& key);
         bool Get(const Slice& key, std::string* value, Status* s);
         void GetMid(std::string* key);
@@ -448,14 +1027,20 @@ public:
         enum { kMaxHeight = 12 };
         virtual ~D4MemTable();
         D4MemTable(NVM_Manager* mng, const CachePolicy& cp, const Slice& dbname, ull seq);
+        // Recovery: rebuild from the images at location and cache_location.
+        D4MemTable(NVM_Manager* mng, const CachePolicy& cp, const Slice& dbname, ull seq,
+                   nvAddr location, nvAddr cache_location);
         bool HashLocate(const Slice& key, nvOffset hash, nvOffset& node, nvOffset& next);
         void Insert(SequenceNumber seq, ValueType type, const Slice& key, const Slice& value,
                                 nvOffset hash, nvOffset prev, nvOffset next);
         void Add(SequenceNumber seq, ValueType type, const Slice& key, const Slice& value);
         bool Get(const LookupKey& key, std::string* value, Status* s);
+        bool Get(const LookupKey& key, PinnableSlice* value, Status* s);
         nvOffset FindNode(const Slice& key);
         void Update(nvOffset node, SequenceNumber seq, ValueType type, const Slice& value);
         void GarbageCollection();
+        virtual bool GarbageCollectionStep(ull budget);
+        virtual bool GarbageCollectionBlocked() const;
         Iterator* NewIterator();
         Iterator* NewOfficialIterator(ull seq);
 
@@ -468,6 +1053,8 @@ public:
         ull LowerStorage() const { return table_.arena_.Size(); }
 
         nvAddr Location() const;
+        virtual bool PersistentInfo(nvAddr* main, ull* main_size, nvAddr* aux, ull* aux_size);
+        virtual void Detach();
 
         bool HasRoomForWrite(const Slice& key, const Slice& value, bool nearly_full);
         virtual bool PreWrite(const Slice& key, const Slice& value, bool nearly_full);
@@ -541,25 +1128,36 @@ public:
         void operator=(const D4MemTable&) = delete;
     };
 
+    // Writers may replace the value of the current node: the iterator
+    // reads the value pointer once it is positioned, so that key() and
+    // value() agree.  The value stays where it is while the caller holds a
+    // pin (see EpochDomain::Pin()) or the table takes no writes.
     struct D4MemTableIterator : public Iterator {
      public:
         D4MemTableIterator(D4MemTable* mem, ull seq = 0) :
-            mem_(mem), buffer_(new DRAM_Buffer(8192)), seq_(seq), x_(nulloffset) {}
+            mem_(mem), buffer_(new DRAM_Buffer(8192)), seq_(seq), x_(nulloffset), v_(nulloffset) {}
         virtual ~D4MemTableIterator() { delete buffer_; }
 
       virtual bool Valid() const { return x_ != nulloffset; }
-      virtual void SeekToFirst() { x_ = mem_->table_.GetNext(mem_->table_.head_, 0); }
-      virtual void SeekToLast() { x_ = mem_->table_.Tail(); }
-      virtual void Seek(const Slice& target) { x_ = mem_->Seek(target); }
-      virtual void Next() { x_ = mem_->table_.GetNext(x_, 0); }
-      virtual void Prev() { x_ = mem_->table_.GetPrev(x_); }
-      virtual Slice value() const { return mem_->table_.GetValue(x_); }
+      virtual void SeekToFirst() { Move(mem_->table_.GetNext(mem_->table_.head_, 0)); }
+      virtual void SeekToLast() { Move(mem_->table_.Tail()); }
+      virtual void Seek(const Slice& target) {
+          Slice key = ExtractUserKey(target);
+          Move(mem_->Seek(key));
+          // Our entry of the same user key is newer than the target, so before it.
+          if (x_ != nulloffset && user_key() == key &&
+              (DecodeFixed64(target.data() + key.size()) >> 8) < seq_)
+              Next();
+      }
+      virtual void Next() { Move(mem_->table_.GetNext(x_, 0)); }
+      virtual void Prev() { Move(mem_->table_.GetPrev(x_)); }
+      virtual Slice value() const { return mem_->table_.ValueAt(v_); }
       virtual Status status() const { return Status(); }
       Slice user_key() const { return mem_->table_.GetKey_(x_); }
       virtual Slice key() const {
           assert(x_ != nulloffset);
           Slice key = user_key();
-          nvOffset v = mem_->table_.GetValuePtr(x_);
+          nvOffset v = v_;
 
           char* lkey_data = reinterpret_cast<char*>(buffer_->Allocate(key.size() + 8));
           memcpy(lkey_data, key.data(), key.size());
@@ -578,10 +1176,16 @@ public:
       // will be invoked when this iterator is destroyed.
 
      private:
+      void Move(nvOffset x) {
+          x_ = x;
+          v_ = x_ == nulloffset ? nulloffset : mem_->table_.GetValuePtr(x_);
+      }
+
       D4MemTable* mem_;
       DRAM_Buffer* buffer_;
       SequenceNumber seq_;
       nvOffset x_;
+      nvOffset v_;      // The value of x_ when the iterator got there.
 
       D4MemTableIterator(const D4MemTableIterator&) = delete;
       void operator=(const D4MemTableIterator&) = delete;
@@ -595,16 +1199,19 @@ public:
         //L4Cache cache_;
         L4SkipList table_;
 
-        Random rnd_;
+        static uint32_t NextRandom();
         int RandomHeight();
 
         std::string dbname_;
         ull seq_;
         ull pre_write_;
+        // Room taken by HasRoomForWrite() for the adds under way.
+        std::atomic<ull> reserved_;
+        void ReleaseRoom();
         ull written_size_;
         ull created_time_;
 
-        int refs__;
+        std::atomic<int> refs__;
 
         port::RWLock lock_;
         bool immutable_;
@@ -615,8 +1222,10 @@ public:
         std::string MemName(const Slice& dbname, ull seq);
         std::string HashName(const Slice& dbname, ull seq);
         //nvOffset Hash(const Slice& key) { return leveldb::Hash(key.data(), key.size(), 0xdeadbeef) % cp_.hash_range_ + 1; }
-        ull MaxSizeOf(size_t keysize, size_t valuesize) { return keysize + valuesize + (1 + 4 + 4 + 4 * kMaxHeight + 4); }
+        // Node header and links, and the length of the value.
+        ull MaxSizeOf(size_t keysize, size_t valuesize) { return keysize + valuesize + (4 + 4 + 4 + 4 * kMaxHeight + 4); }
         void DeleteName();
+        // The first node whose key is not less than key.
         nvOffset Seek(const Slice& key);
         bool Get(const Slice& key, std::string* value, Status* s);
         void GetMid(std::string* key);
@@ -626,9 +1235,15 @@ public:
         enum { kMaxHeight = 12 };
         virtual ~D5MemTable();
         D5MemTable(NVM_Manager* mng, const CachePolicy& cp, const Slice& dbname, ull seq);
+        // Recovery: rebuild from the image at location.
+        D5MemTable(NVM_Manager* mng, const CachePolicy& cp, const Slice& dbname, ull seq, nvAddr location);
         void Add(SequenceNumber seq, ValueType type, const Slice& key, const Slice& value);
         bool Get(const LookupKey& key, std::string* value, Status* s);
+        bool Get(const LookupKey& key, PinnableSlice* value, Status* s);
+        void MultiGet(KeyContext* keys, size_t n);
         void GarbageCollection();
+        virtual bool GarbageCollectionStep(ull budget);
+        virtual bool GarbageCollectionBlocked() const;
         Iterator* NewIterator();
         Iterator* NewOfficialIterator(ull seq);
 
@@ -641,10 +1256,13 @@ public:
         ull LowerStorage() const { return table_.arena_.Size(); }
 
         nvAddr Location() const;
+        virtual bool PersistentInfo(nvAddr* main, ull* main_size, nvAddr* aux, ull* aux_size);
+        virtual void Detach();
 
         bool HasRoomForWrite(const Slice& key, const Slice& value, bool nearly_full);
         virtual bool PreWrite(const Slice& key, const Slice& value, bool nearly_full);
         virtual bool HasRoomFor(ull size) const { return table_.HasRoomFor(size); }
+        virtual bool ConcurrentAdd() const { return true; }
         void Ref();
         void Unref();
         virtual bool Immutable() const { return immutable_; }
@@ -714,25 +1332,36 @@ public:
         void operator=(const D5MemTable&) = delete;
     };
 
+    // Writers may replace the value of the current node: the iterator
+    // reads the value pointer once it is positioned, so that key() and
+    // value() agree.  The value stays where it is while the caller holds a
+    // pin (see EpochDomain::Pin()) or the table takes no writes.
     struct D5MemTableIterator : public Iterator {
      public:
         D5MemTableIterator(D5MemTable* mem, ull seq = 0) :
-            mem_(mem), buffer_(new DRAM_Buffer(8192)), seq_(seq), x_(nulloffset) {}
+            mem_(mem), buffer_(new DRAM_Buffer(8192)), seq_(seq), x_(nulloffset), v_(nulloffset) {}
         virtual ~D5MemTableIterator() { delete buffer_; }
 
       virtual bool Valid() const { return x_ != nulloffset; }
-      virtual void SeekToFirst() { x_ = mem_->table_.GetNext(mem_->table_.head_, 0); }
-      virtual void SeekToLast() { x_ = mem_->table_.Tail(); }
-      virtual void Seek(const Slice& target) { x_ = mem_->Seek(target); }
-      virtual void Next() { x_ = mem_->table_.GetNext(x_, 0); }
-      virtual void Prev() { x_ = mem_->table_.GetPrev(x_); }
-      virtual Slice value() const { return mem_->table_.GetValue(x_); }
+      virtual void SeekToFirst() { Move(mem_->table_.GetNext(mem_->table_.head_, 0)); }
+      virtual void SeekToLast() { Move(mem_->table_.Tail()); }
+      virtual void Seek(const Slice& target) {
+          Slice key = ExtractUserKey(target);
+          Move(mem_->Seek(key));
+          // Our entry of the same user key is newer than the target, so before it.
+          if (x_ != nulloffset && user_key() == key &&
+              (DecodeFixed64(target.data() + key.size()) >> 8) < seq_)
+              Next();
+      }
+      virtual void Next() { Move(mem_->table_.GetNext(x_, 0)); }
+      virtual void Prev() { Move(mem_->table_.GetPrev(x_)); }
+      virtual Slice value() const { return mem_->table_.ValueAt(v_); }
       virtual Status status() const { return Status(); }
       Slice user_key() const { return mem_->table_.GetKey_(x_); }
       virtual Slice key() const {
           assert(x_ != nulloffset);
           Slice key = user_key();
-          nvOffset v = mem_->table_.GetValuePtr(x_);
+          nvOffset v = v_;
 
           char* lkey_data = reinterpret_cast<char*>(buffer_->Allocate(key.size() + 8));
           memcpy(lkey_data, key.data(), key.size());
@@ -751,10 +1380,16 @@ public:
       // will be invoked when this iterator is destroyed.
 
      private:
+      void Move(nvOffset x) {
+          x_ = x;
+          v_ = x_ == nulloffset ? nulloffset : mem_->table_.GetValuePtr(x_);
+      }
+
       D5MemTable* mem_;
       DRAM_Buffer* buffer_;
       SequenceNumber seq_;
       nvOffset x_;
+      nvOffset v_;      // The value of x_ when the iterator got there.
 
       D5MemTableIterator(const D5MemTableIterator&) = delete;
       void operator=(const D5MemTableIterator&) = delete;
@@ -0,0 +1,196 @@
+#include "epoch.h"
+#include <assert.h>
+#include <atomic>
+#include <thread>
+#include "util/mutexlock.h"
+
+namespace leveldb {
+
+namespace {
+
+static const int kSlots = 256;
+static const int kPinsPerSlot = 8;
+
+// The epoch its owner entered at, 0 while the owner is outside a Guard.
+struct Slot {
+    std::atomic<uint64_t> epoch_;
+    std::atomic<bool> owned_;
+    char pad_[64 - sizeof(std::atomic<uint64_t>) - sizeof(std::atomic<bool>)];
+};
+
+// The epochs of the pins taken by the owner of the slot, 0 for a free one.
+// Only the owner takes a pin, any thread may release it.
+struct Pins {
+    std::atomic<uint64_t> epoch_[kPinsPerSlot];
+};
+
+Slot slots[kSlots];
+Pins pins[kSlots];
+std::atomic<uint64_t> global_epoch(1);
+// Readers inside a Guard that found no free slot, and pins that found no
+// free entry; they hold back every retired object.
+std::atomic<int> unslotted(0);
+std::atomic<int> unslotted_pins(0);
+
+struct LocalReader {
+    int slot_;
+    int depth_;
+    bool unslotted_;
+    LocalReader() : slot_(-1), depth_(0), unslotted_(false) {}
+    ~LocalReader() {
+        if (slot_ >= 0)
+            slots[slot_].owned_.store(false, std::memory_order_release);
+    }
+};
+
+thread_local LocalReader local_reader;
+
+int AcquireSlot() {
+    for (int i = 0; i < kSlots; ++i) {
+        bool owned = false;
+        if (!slots[i].owned_.load(std::memory_order_relaxed) &&
+            slots[i].owned_.compare_exchange_strong(owned, true))
+            return i;
+    }
+    return -1;
+}
+
+// The oldest epoch a reader is inside of, or holds a pin of if with_pins,
+// or UINT64_MAX.
+uint64_t MinActiveEpoch(bool with_pins) {
+    if (unslotted.load() > 0 || (with_pins && unslotted_pins.load() > 0))
+        return 0;
+    uint64_t min = UINT64_MAX;
+    for (int i = 0; i < kSlots; ++i) {
+        uint64_t e = slots[i].epoch_.load();
+        if (e != 0 && e < min)
+            min = e;
+        if (!with_pins)
+            continue;
+        // After the slot: a reader that left its Guard before the load
+        // above took its pins before leaving.
+        for (int j = 0; j < kPinsPerSlot; ++j) {
+            e = pins[i].epoch_[j].load();
+            if (e != 0 && e < min)
+                min = e;
+        }
+    }
+    return min;
+}
+
+}  // namespace
+
+void EpochDomain::Enter() {
+    LocalReader& r = local_reader;
+    if (r.depth_++ > 0)
+        return;
+    if (r.slot_ < 0)
+        r.slot_ = AcquireSlot();
+    if (r.slot_ < 0) {
+        r.unslotted_ = true;
+        unslotted.fetch_add(1);
+        return;
+    }
+    // Sequentially consistent, so that a writer that does not see this
+    // store retired its object before our loads of the published pointers.
+    slots[r.slot_].epoch_.store(global_epoch.load());
+}
+
+void EpochDomain::Exit() {
+    LocalReader& r = local_reader;
+    assert(r.depth_ > 0);
+    if (--r.depth_ > 0)
+        return;
+    if (r.unslotted_) {
+        r.unslotted_ = false;
+        unslotted.fetch_sub(1);
+        return;
+    }
+    slots[r.slot_].epoch_.store(0, std::memory_order_release);
+}
+
+int EpochDomain::Pin() {
+    LocalReader& r = local_reader;
+    assert(r.depth_ > 0);
+    if (!r.unslotted_) {
+        std::atomic<uint64_t>* entries = pins[r.slot_].epoch_;
+        for (int j = 0; j < kPinsPerSlot; ++j) {
+            if (entries[j].load(std::memory_order_relaxed) == 0) {
+                entries[j].store(slots[r.slot_].epoch_.load(std::memory_order_relaxed));
+                return r.slot_ * kPinsPerSlot + j;
+            }
+        }
+    }
+    unslotted_pins.fetch_add(1);
+    return -1;
+}
+
+void EpochDomain::Unpin(int pin) {
+    if (pin < 0)
+        unslotted_pins.fetch_sub(1);
+    else
+        pins[pin / kPinsPerSlot].epoch_[pin % kPinsPerSlot].store(0, std::memory_order_release);
+}
+
+uint64_t EpochDomain::Fence() {
+    return global_epoch.fetch_add(1);
+}
+
+bool EpochDomain::Passed(uint64_t fence) {
+    return MinActiveEpoch(true) > fence;
+}
+
+void EpochDomain::Retire(Deleter deleter, void* arg) {
+    Retired r;
+    r.epoch_ = global_epoch.fetch_add(1);
+    r.deleter_ = deleter;
+    r.arg_ = arg;
+    {
+        MutexLock l(&mu_);
+        retired_.push_back(r);
+    }
+    Reclaim();
+}
+
+void EpochDomain::Synchronize() {
+    uint64_t epoch = global_epoch.fetch_add(1);
+    while (MinActiveEpoch(false) <= epoch)
+        std::this_thread::yield();
+    Reclaim();
+}
+
+void EpochDomain::Reclaim() {
+    std::vector<Retired> candidates;
+    {
+        MutexLock l(&mu_);
+        if (retired_.empty())
+            return;
+        candidates.swap(retired_);
+    }
+    // Scan the slots only after taking the candidates: a reader missed by
+    // the scan entered after they were retired.
+    uint64_t min = MinActiveEpoch(true);
+    std::vector<Retired> pending;
+    for (size_t i = 0; i < candidates.size(); ++i) {
+        if (candidates[i].epoch_ < min)
+            (*candidates[i].deleter_)(candidates[i].arg_);
+        else
+            pending.push_back(candidates[i]);
+    }
+    if (!pending.empty()) {
+        MutexLock l(&mu_);
+        retired_.insert(retired_.end(), pending.begin(), pending.end());
+    }
+}
+
+void EpochDomain::Drain() {
+    std::vector<Retired> all;
+    {
+        MutexLock l(&mu_);
+        all.swap(retired_);
+    }
+    for (size_t i = 0; i < all.size(); ++i)
+        (*all[i].deleter_)(all[i].arg_);
+}
+
+}
@@ -0,0 +1,76 @@
+#ifndef EPOCH_H
+#define EPOCH_H
+#include <stdint.h>
+#include <vector>
+#include "port/port_posix.h"
+
+namespace leveldb {
+
+// Epoch based reclamation for structures that readers walk without a lock.
+// A reader stays inside a Guard while it uses a published object; entering
+// only writes a slot owned by the reader's thread, so readers share no cache
+// line that is written.  A writer that unpublishes an object Retire()s it
+// instead of deleting it, and the deleter runs once every reader that could
+// have seen the object has left its Guard.  The slots and the epoch counter
+// are process wide, a domain only holds the objects retired to it.
+class EpochDomain {
+public:
+    typedef void (*Deleter)(void* arg);
+
+    EpochDomain() {}
+    // REQUIRES: no reader can still see an object retired to this domain.
+    ~EpochDomain() { Drain(); }
+
+    static void Enter();
+    static void Exit();
+
+    class Guard {
+    public:
+        Guard() { EpochDomain::Enter(); }
+        ~Guard() { EpochDomain::Exit(); }
+    private:
+        Guard(const Guard&);
+        void operator=(const Guard&);
+    };
+
+    // Keep what the caller's Guard protects past the Guard, e.g. a value
+    // handed out to the user.  Called inside a Guard; returns the pin for
+    // Unpin(), which any thread may call.  A pin holds back the objects
+    // retired to every domain, so it should not be held for long.
+    // Synchronize() does not wait for pins.
+    static int Pin();
+    static void Unpin(int pin);
+
+    // For writers that reuse memory in place instead of retiring it: once
+    // Passed(Fence()), no reader holds what was unreachable before Fence().
+    static uint64_t Fence();
+    static bool Passed(uint64_t fence);
+
+    // Run deleter(arg) once no reader can hold arg.  arg must already be
+    // unreachable for a reader that enters from now on.
+    void Retire(Deleter deleter, void* arg);
+    // Wait until the readers that are inside a Guard now have left, then
+    // run what became free.  Must not be called inside a Guard.
+    void Synchronize();
+    // Run the deleters of objects no reader can hold any more.
+    void Reclaim();
+    // Run every pending deleter.  REQUIRES: no reader of this domain.
+    void Drain();
+
+private:
+    struct Retired {
+        uint64_t epoch_;
+        Deleter deleter_;
+        void* arg_;
+    };
+    port::Mutex mu_;
+    std::vector<Retired> retired_;
+
+    // No copying allowed
+    EpochDomain(const EpochDomain&);
+    void operator=(const EpochDomain&);
+};
+
+}
+
+#endif // EPOCH_H
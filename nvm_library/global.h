@@ -52,6 +52,39 @@ ll nanodelay_until(ll until_nano);
 ({                      \
     __asm__ __volatile__ ("mfence":::"memory");    \
 })
+
+// How stores are written back to NVM, see sys_nvm_flush_type().
+enum NVM_FlushType { kFlushNone = 0, kFlushClflush = 1, kFlushClflushopt = 2, kFlushClwb = 3 };
+
+// Write back the cache line holding p.  Only clflush is ordered with later
+// stores; the others need nvm_fence().
+inline void nvm_flush_line(NVM_FlushType type, const void* p) {
+#if defined(__x86_64__) || defined(__i386__)
+    volatile char* line = static_cast<volatile char*>(const_cast<void*>(p));
+    switch (type) {
+    case kFlushClwb:
+        __asm__ __volatile__ (".byte 0x66; xsaveopt %0" : "+m"(*line));
+        break;
+    case kFlushClflushopt:
+        __asm__ __volatile__ (".byte 0x66; clflush %0" : "+m"(*line));
+        break;
+    case kFlushClflush:
+        __asm__ __volatile__ ("clflush %0" : "+m"(*line));
+        break;
+    default:
+        break;
+    }
+#endif
+}
+inline void nvm_fence(NVM_FlushType type) {
+#if defined(__x86_64__) || defined(__i386__)
+    if (type >= kFlushClflushopt) {
+        __asm__ __volatile__ ("sfence" : : : "memory");
+        return;
+    }
+#endif
+    __asm__ __volatile__ ("" : : : "memory");
+}
 void pflush(uint64_t *addr);
 void init_pflush(int cpu_speed_mhz, int write_latency_ns);
 
@@ -6,11 +6,8 @@ namespace leveldb {
 
 bool BackgroundHelper::PushWorkToQueue(nvFixedHashTable* table, WorkType::Type type) {
     assert(bgthread_created_ == true);
-    bool wakeup = queue_.Empty();
     WorkType work(table, type);
     AddWork(&work);
-    if (wakeup)
-        WakeUp();
     return true;
 }
 
@@ -60,8 +57,7 @@ void BackgroundHelper::BackgroundWork() {     // Background work, can not be cal
     //size_t last_work = 0;
     WorkType work(nullptr, WorkType::Clean);
     while (true) {
-        while (queue_.Empty() && !shutdown_) {
-            cv_.Wait();
+        while (!queue_.WaitForData(1000) && !shutdown_) {
         }
         if (shutdown_)
             break;
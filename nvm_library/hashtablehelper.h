@@ -59,19 +59,19 @@ public:
     void StartWorkerThread();
     void ShutdownWorkerThread() {
         shutdown_ = true;
-        cv_.Signal();
+        queue_.WakeUp();
         //cv_.Wait();
     }
     void Lock() { mu_.Lock(); }
     void UnLock() { mu_.Unlock(); }
-    void WakeUp() { cv_.Signal(); }
+    void WakeUp() { queue_.WakeUp(); }
     void Wait() { cv_.Wait(); }
 
     //bool GetClearMark() const { return clear_mark_; }
     //void SetClearMark(bool mark) { clear_mark_ = mark; }
     bool CheckClear() const {
-        while (!queue_.Empty())
-            usleep(1);
+        queue_.WaitUntilEmpty();
+        return true;
     }
 
     //void SetClearForce();
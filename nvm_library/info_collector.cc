@@ -5,6 +5,7 @@ namespace leveldb {
         std::string* info_ = new std::string();
         this->kvinfo_.Save(info_);
         this->garbage_collection_info_.Save(info_);
+        this->level0_filter_info_.Save(info_);
         //kvinfo_.Save(info_);
 
         //fprintf(file, "%s\n", info_->c_str());
@@ -9,6 +9,7 @@
 #include "global.h"
 #include "db/dbformat.h"
 #include <unordered_map>
+#include <atomic>
 #include <thread>
 #include <unistd.h>
 
@@ -219,7 +220,44 @@ struct InfoCollector {
             garbage_collection_info_.sinior_compaction_ ++;
     }
     //-----------------------------------------------------------------------------------
+    // Level 0 bloom filters, counted by concurrent readers.  A thread
+    // counts one lookup in kSampleRate, by kSampleRate, so the counters
+    // are estimates that do not take a shared write on every Get().
+    struct FilterInfo {
+        enum { kSampleRate = 16 };
+        std::atomic<ull> skip_;     // The filter ruled the key out.
+        std::atomic<ull> probe_;    // The filter let the memtable be probed.
+        std::atomic<ull> hit_;      // ... and the key was there.
+        void Clear() {
+            skip_.store(0);
+            probe_.store(0);
+            hit_.store(0);
+        }
+        void Save(std::string *s) {
+            *s += "Level0 Filter Skip  : " + std::to_string(skip_.load()) + "\n";
+            *s += "Level0 Filter Probe : " + std::to_string(probe_.load()) + "\n";
+            *s += "Level0 Filter Hit   : " + std::to_string(hit_.load()) + "\n";
+        }
+        FilterInfo() : skip_(0), probe_(0), hit_(0) {}
+    } level0_filter_info_;
+    static bool Level0FilterSampled() {
+        static __thread ull ticks = 0;
+        return ++ticks % FilterInfo::kSampleRate == 0;
+    }
+    void Level0FilterSkip() {
+        if (Level0FilterSampled())
+            level0_filter_info_.skip_.fetch_add(FilterInfo::kSampleRate, std::memory_order_relaxed);
+    }
+    void Level0FilterProbe(bool hit) {
+        if (!Level0FilterSampled())
+            return;
+        level0_filter_info_.probe_.fetch_add(FilterInfo::kSampleRate, std::memory_order_relaxed);
+        if (hit)
+            level0_filter_info_.hit_.fetch_add(FilterInfo::kSampleRate, std::memory_order_relaxed);
+    }
+    //-----------------------------------------------------------------------------------
     void Clear() {
+        this->level0_filter_info_.Clear();
         this->bound_info_.Clear();
         this->kvinfo_.Clear();
         this->garbage_collection_info_.Clear();
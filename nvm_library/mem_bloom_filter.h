@@ -1,10 +1,10 @@
 #ifndef MEM_BLOOM_FILTER_H
 #define MEM_BLOOM_FILTER_H
 
+#include <atomic>
 #include <string>
 #include "leveldb/slice.h"
 #include "util/hash.h"
-#include "util/random.h"
 
 namespace leveldb {
 
@@ -17,43 +17,53 @@ class MemBloomFilter {
   size_t filter_size_;
   size_t filter_bits_;
 
+  // Readers probe a filter concurrently and the heuristic only needs rough
+  // numbers: an awake filter records one lookup of a thread in SampleRate,
+  // so the shared counters are not written on every probe.
   struct Sleepy {
-      enum {WorkBase = 7, SleepingRate = 100, CountLimit = 1000};
-      Random rnd_;
-      size_t usage_;
-      size_t reject_;
+      enum {WorkBase = 7, SleepingRate = 100, CountLimit = 1000, SampleRate = 16};
+      std::atomic<size_t> usage_;
+      std::atomic<size_t> reject_;
       // if reject_ * WorkBase >= usage_, it's helpful.
-      bool sleepy_;
-      Sleepy() : rnd_(0xdeadbeef), usage_(100), reject_(100), sleepy_(false) {}
+      std::atomic<bool> sleepy_;
+      Sleepy() : usage_(100), reject_(100), sleepy_(false) {}
+      // Lookups of the calling thread, in any filter.
+      static size_t Tick() {
+          static __thread size_t ticks = 0;
+          return ++ticks;
+      }
       inline void Record(bool accepted) {
+          size_t reject = reject_.load(std::memory_order_relaxed);
           if (!accepted)
-              reject_++;
-          ++usage_;
-          bool awake = reject_ * WorkBase >= usage_;
-          if (sleepy_) {
-              if (awake)
-                  sleepy_ = false;
-          } else {
-              if (!awake)
-                  sleepy_ = true;
-          }
-          if (usage_ >= CountLimit) {
-              usage_ >>= 1;
-              reject_ >>= 1;
+              reject = reject_.fetch_add(1, std::memory_order_relaxed) + 1;
+          size_t usage = usage_.fetch_add(1, std::memory_order_relaxed) + 1;
+          bool awake = reject * WorkBase >= usage;
+          if (sleepy_.load(std::memory_order_relaxed) != !awake)
+              sleepy_.store(!awake, std::memory_order_relaxed);
+          if (usage >= CountLimit) {
+              usage_.store(usage >> 1, std::memory_order_relaxed);
+              reject_.store(reject >> 1, std::memory_order_relaxed);
           }
       }
-      bool isSleeping() {
-          if (sleepy_) {
-              return rnd_.Next() % SleepingRate > 0;
+      // Whether the filter answers this lookup, and *record whether it
+      // Record()s the answer.  A sleeping filter still answers about one
+      // lookup in SleepingRate, and records all of them, so that it
+      // notices when it becomes useful again.
+      bool isSleeping(bool* record) {
+          if (sleepy_.load(std::memory_order_relaxed)) {
+              *record = true;
+              return Tick() % SleepingRate > 0;
           }
+          *record = Tick() % SampleRate == 0;
           return false;
       }
   } sheep_;
 
+ public:
   inline static uint32_t BloomHash(const Slice& key) {
     return Hash(key.data(), key.size(), 0xbc9f1d34);
   }
- public:
+
   explicit MemBloomFilter(int64_t memory, int key_estimated)
       : bits_per_key_(memory / key_estimated), key_estimated_(key_estimated) {
     // We intentionally round down to reduce probing cost a little bit
@@ -79,10 +89,14 @@ class MemBloomFilter {
   }
 
   void InsertKey(const Slice& key){
+    InsertHash(BloomHash(key));
+  }
+
+  // InsertKey() of a key whose BloomHash() is h.
+  void InsertHash(uint32_t h) {
     char* array = &filter_[0];
     // Use double-hashing to generate a sequence of hash values.
     // See analysis in [Kirsch,Mitzenmacher 2006].
-    uint32_t h = BloomHash(key);
     const uint32_t delta = (h >> 17) | (h << 15);  // Rotate right 17 bits
     for (size_t j = 0; j < k_; j++) {
       const uint32_t bitpos = h % filter_bits_;
@@ -93,7 +107,8 @@ class MemBloomFilter {
 
   bool KeyMayMatch(const Slice& key) {
     assert(filter_size_ > 0);
-    if (sheep_.isSleeping()) return true;
+    bool record;
+    if (sheep_.isSleeping(&record)) return true;
 
     const char* array = filter_.c_str();
 
@@ -103,7 +118,7 @@ class MemBloomFilter {
     if (k > 30) {
       // Reserved for potentially new encodings for short bloom filters.
       // Consider it a match.
-      sheep_.Record(true);
+      if (record) sheep_.Record(true);
       return true;
     }
 
@@ -112,12 +127,12 @@ class MemBloomFilter {
     for (size_t j = 0; j < k; j++) {
       const uint32_t bitpos = h % filter_bits_;
       if ((array[bitpos/8] & (1 << (bitpos % 8))) == 0) {
-          sheep_.Record(false);
+          if (record) sheep_.Record(false);
           return false;
       }
       h += delta;
     }
-    sheep_.Record(false);
+    if (record) sheep_.Record(true);
     return true;
   }
 
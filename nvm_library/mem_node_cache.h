@@ -31,6 +31,7 @@ struct CachePolicy {
     int height_;
     int p_;
     bool cache_disable_;
+    bool hash_mirror_;
     CachePolicy(ull nvmem, ull nvmem_nearly_full, ull dram_buffer, ull nvm_buffer, ull cover_range, ul hash_div):
         dram_size_(dram_buffer), nvm_size_(nvm_buffer),
         nearly_full_rate_(1. * nvmem_nearly_full / nvmem),
@@ -49,7 +50,8 @@ struct CachePolicy {
         hash_full_limit_(0.8),
         node_cache_size_((dram_size_ - garbage_cache_size_) / standard_nvmemtable_size_),
         cover_range_(cover_range * (nvskiplist_size_ / (2 * MB))),
-        cache_disable_(dram_size_ / nvskiplist_size_ > 16 * KB ? false : true) {
+        cache_disable_(dram_size_ / nvskiplist_size_ > 16 * KB ? false : true),
+        hash_mirror_(false) {
 
         if (dram_size_ >= nvm_size_) { height_ = 0; p_ = 1; return; }
         if (cache_disable_) { height_ = 12; p_ = 1; return; }
@@ -110,6 +112,7 @@ struct PuzzleCache {
         void Clear() {
             for (nvOffset i = 0; i < size_; ++i)
                 a_[i].clear();
+            count_ = 0;
         }
 
         void Eat(Cache* b) {
@@ -1,4 +1,6 @@
 #include "multitable.h"
+#include <algorithm>
+#include "table/merger.h"
 #include "nvskiplist.h"
 #include "mixedskiplist_connector.h"
 #include "d2skiplist.h"
@@ -23,6 +25,8 @@ nvMultiTable::nvMultiTable(DBImpl* db, const Options& options, const string &dbn
         options_.TEST_cover_range,               // Overlap range
         options_.TEST_hash_div),
     dbname_(dbname), index_(nullptr),
+    published_index_(nullptr), published_level0_(new Level0Version()),
+    level0_filtering_(nullptr), root_(nullptr),
     writer_num_( options.TEST_write_thread ),
     writers_(nullptr),
     leveli_(256, sizeof(nvHashTable*)), helper_(nullptr),
@@ -33,6 +37,7 @@ nvMultiTable::nvMultiTable(DBImpl* db, const Options& options, const string &dbn
     //pool_(new BackgroundWorkers(db)),
     file_in_use_(),
     prev_poped_(""), node_total_(0), seq_(0), log_number_(0), bytes_(0), oprs_(0), clear_mark_(false) {
+        cache_policy_.hash_mirror_ = options.TEST_dram_hash_mirror;
         BuildWriters(mng_, options, dbname);
         if (options_.TEST_nvskiplist_type == kTypeLinearHash)
             FillLevelI();
@@ -54,7 +59,8 @@ void nvMultiTable::BuildWriters(NVM_Manager* mng, const Options& options, const
         //log->setName(log_name);
         //mng->bind_name(log_name, log->location());
         //if (options.TEST_background_lock_free) {
-        writers_[i] = new BackgroundWriter_LockFree(mng_, i);
+        writers_[i] = new BackgroundWriter_LockFree(mng_, i,
+                options.TEST_numa_home_ranges ? static_cast<int>(i % mng_->Nodes()) : -1);
         //} else {
         //    result[i] = new BackgroundWriter_Mutex(log, i);
         //}
@@ -69,6 +75,151 @@ nvMemTable* nvMultiTable::WhereIs(const Slice& key) {
     //}
     return mem;
 }
+
+bool nvMultiTable::Get(const LookupKey& lkey, std::string* value, Status* s) {
+    EpochDomain::Guard guard;
+    // Acquire keeps the level 0 load after the index load; see PublishIndex().
+    IndexTree* index = published_index_.load(std::memory_order_acquire);
+    if (index->FuzzyFind(lkey.user_key())->Get(lkey, value, s))
+        return true;
+    return published_level0_.load(std::memory_order_acquire)->Get(lkey, value, s, &global_ic_);
+}
+
+// Each memtable is found once in the index and gets all of its keys in one
+// call; the index iterator lands on the range of a key.
+bool nvMultiTable::MultiGet(KeyContext* keys, size_t n) {
+    EpochDomain::Guard guard;
+    IndexTree* index = published_index_.load(std::memory_order_acquire);
+    IndexIterator* iter = index->NewIterator();
+    size_t i = 0;
+    while (i < n) {
+        iter->Seek(keys[i].key->user_key());
+        nvMemTable* mem = iter->Data();
+        iter->Next();
+        size_t j = i + 1;
+        if (!iter->Valid()) {
+            j = n;
+        } else {
+            Slice bound = iter->key();
+            while (j < n && keys[j].key->user_key().compare(bound) < 0)
+                ++j;
+        }
+        mem->MultiGet(keys + i, j - i);
+        i = j;
+    }
+    delete iter;
+
+    Level0Version* v = published_level0_.load(std::memory_order_acquire);
+    bool all = true;
+    for (i = 0; i < n; ++i) {
+        if (!keys[i].found)
+            keys[i].found = v->Get(*keys[i].key, keys[i].value, keys[i].s, &global_ic_);
+        all = all && keys[i].found;
+    }
+    return all;
+}
+
+// The guard keeps the tables alive until a pinned one takes its reference.
+bool nvMultiTable::Get(const LookupKey& lkey, PinnableSlice* value, Status* s) {
+    EpochDomain::Guard guard;
+    IndexTree* index = published_index_.load(std::memory_order_acquire);
+    if (index->FuzzyFind(lkey.user_key())->Get(lkey, value, s))
+        return true;
+    return published_level0_.load(std::memory_order_acquire)->Get(lkey, value, s, &global_ic_);
+}
+
+namespace {
+template <typename T>
+void DeleteObject(void* arg) { delete reinterpret_cast<T*>(arg); }
+void UnrefMemTable(void* arg) { reinterpret_cast<nvMemTable*>(arg)->Unref(); }
+}
+
+// Callers hold rwlock_ for writing, so index_ does not change under us.
+// The view shares the nodes of index_; it frees the ones that the changes
+// since the last view replaced once the readers of older views are gone.
+void nvMultiTable::PublishIndex() {
+    IndexTree* index = index_.Snapshot();
+    IndexTree* old = published_index_.exchange(index);
+    if (old != nullptr)
+        epoch_.Retire(&DeleteObject<IndexTree>, old);
+}
+
+void nvMultiTable::PublishLevel0() {
+    // Pushes and pops come from different threads; whoever publishes last
+    // copies the queue after both changes.
+    MutexLock l(&publish_level0_mutex_);
+    Level0Version* v = new Level0Version();
+    level0_.lock_.ReadLock();
+    ull tail = level0_.Tail();
+    // A push still copying in publishes again when it is done.
+    for (ull i = level0_.Head(); i != tail && level0_.Ready(i); i = (i + 1) % level0_.size_) {
+        nvMemTable* mem = *reinterpret_cast<nvMemTable**>(level0_[i]);
+        auto f = level0_filters_.find(mem);
+        v->Add(mem, f == level0_filters_.end() ? nullptr : f->second);
+    }
+    level0_.lock_.Unlock();
+    Level0Version* old = published_level0_.exchange(v);
+    epoch_.Retire(&DeleteObject<Level0Version>, old);
+}
+
+MemBloomFilter* nvMultiTable::BuildLevel0Filter(nvMemTable* mem) {
+    // The hashes of the keys tell how large the filter has to be, so a
+    // single pass over the table will do.  The official iterator also
+    // waits for the image of a hash table.
+    std::vector<uint32_t> hashes;
+    Iterator* iter = mem->NewOfficialIterator(mem->Seq());
+    for (iter->SeekToFirst(); iter->Valid(); iter->Next()) {
+        Slice lkey = iter->key();
+        hashes.push_back(MemBloomFilter::BloomHash(Slice(lkey.data(), lkey.size() - 8)));
+    }
+    delete iter;
+    if (hashes.empty())
+        return nullptr;
+    const int keys = static_cast<int>(hashes.size());
+    MemBloomFilter* filter = new MemBloomFilter(
+                static_cast<int64_t>(options_.TEST_level0_filter_bits_per_key) * keys, keys);
+    for (size_t i = 0; i < hashes.size(); ++i)
+        filter->InsertHash(hashes[i]);
+    return filter;
+}
+
+void nvMultiTable::BuildLevel0Filters() {
+    while (true) {
+        nvMemTable* mem;
+        {
+            MutexLock l(&publish_level0_mutex_);
+            if (level0_unfiltered_.empty())
+                return;
+            mem = level0_unfiltered_.front();
+            level0_unfiltered_.erase(level0_unfiltered_.begin());
+            level0_filtering_ = mem;
+        }
+        MemBloomFilter* filter = BuildLevel0Filter(mem);
+        bool built = false;
+        {
+            // ReleaseLevel0() clears level0_filtering_ if mem left level 0
+            // meanwhile.
+            MutexLock l(&publish_level0_mutex_);
+            if (level0_filtering_ == mem && filter != nullptr) {
+                level0_filters_[mem] = filter;
+                built = true;
+            }
+            level0_filtering_ = nullptr;
+        }
+        if (built)
+            PublishLevel0();
+        else
+            delete filter;
+        mem->Unref();
+    }
+}
+
+void nvMultiTable::RetireMemTable(nvMemTable* mem) {
+    // Memtables hold NVM that the next one may need, so wait for the
+    // readers instead of leaving mem to a later Reclaim().
+    epoch_.Retire(&UnrefMemTable, mem);
+    epoch_.Synchronize();
+}
 /*
 void nvMultiTable::Add(SequenceNumber seq, ValueType type,
          const Slice& key,
@@ -80,10 +231,16 @@ bool nvMultiTable::Get(const LookupKey& key, std::string* value, Status* s) {
 }
 */
 bool nvMultiTable::HasRoomForNewMem() {
-    return node_total_ + level0_.Size() + leveli_.Size() + 2 <= cache_policy_.standard_nvmemtable_size_;
+    return RoomForNewMems() >= 0;
+}
+
+ll nvMultiTable::RoomForNewMems() {
+    return static_cast<ll>(cache_policy_.standard_nvmemtable_size_) -
+           static_cast<ll>(node_total_ + level0_.Size() + leveli_.Size() + 2);
 }
 
 bool nvMultiTable::ReleaseAll() {
+    epoch_.Drain();
     if (options_.TEST_nvskiplist_type == kTypeLinearHash && helper_) {
         helper_->ShutdownWorkerThread();
         while (helper_->bgthread_created_);
@@ -103,9 +260,12 @@ bool nvMultiTable::ReleaseAll() {
         }
         delete[] writers_;
     }
+    // Memtables recorded in the root keep their NVM images, so that the
+    // next Recover() finds them again.
     auto iter = index_.NewIterator();
     for (iter->SeekToFirst(); iter->Valid(); iter->Next()) {
         nvMemTable * mem = (iter->Data());
+        if (mem && root_ && root_->Contains(mem)) mem->Detach();
         if (mem) mem->Unref();
     }
     delete iter;
@@ -117,12 +277,140 @@ bool nvMultiTable::ReleaseAll() {
         nvMemTable* mem = nullptr;
         level0_.PopFront(&mem);
         assert(mem);
+        if (root_ && root_->Contains(mem)) mem->Detach();
         mem->Unref();
     }
+    for (size_t i = 0; i < level0_unfiltered_.size(); ++i)
+        level0_unfiltered_[i]->Unref();
+    level0_unfiltered_.clear();
+    delete published_index_.exchange(nullptr);
+    delete published_level0_.exchange(nullptr);
+    for (auto f = level0_filters_.begin(); f != level0_filters_.end(); ++f)
+        delete f->second;
+    level0_filters_.clear();
+    delete root_;
+    root_ = nullptr;
     delete cache_;
     delete imm_cache_;
 }
 
+nvMemTable* nvMultiTable::RecoverMemTable(const nvMultiTableRoot::Record& record) {
+    switch (record.type_) {
+    case kTypeLinearHash:
+        return new nvFixedHashTable(mng_, cache_policy_, dbname_, record.seq_, record.main_);
+    case kTypeHashedSkipList:
+        return new D4MemTable(mng_, cache_policy_, dbname_, record.seq_, record.main_, record.aux_);
+    case kTypePureSkiplist:
+        return new D5MemTable(mng_, cache_policy_, dbname_, record.seq_, record.main_);
+    default:
+        return nullptr;
+    }
+}
+
+Status nvMultiTable::Recover(bool create) {
+    assert(root_ == nullptr && node_total_ == 0);
+    if (create)
+        nvMultiTableRoot::Destroy(mng_, dbname_);
+    root_ = new nvMultiTableRoot(mng_, dbname_, options_.TEST_nvskiplist_type,
+                                 cache_policy_.standard_nvmemtable_size_ + level0_.size_ + PrepareListSize + 1);
+    if (!root_->Recovered())
+        return Status::OK();
+    if (root_->Type() != options_.TEST_nvskiplist_type)
+        return Status::InvalidArgument(dbname_, "nvm memtables were built with another TEST_nvskiplist_type");
+
+    std::vector<nvMultiTableRoot::Record> records;
+    root_->GetRecords(&records);
+    std::vector<std::pair<nvMultiTableRoot::Record, nvMemTable*> > active, level0;
+    for (size_t i = 0; i < records.size(); ++i) {
+        const nvMultiTableRoot::Record& r = records[i];
+        nvMemTable* mem = RecoverMemTable(r);
+        if (mem == nullptr) {
+            root_->Release(r.slot_);
+            continue;
+        }
+        mem->Ref();
+        mem->LeftBound() = r.lft_bound_;
+        mem->RightBound() = r.rgt_bound_;
+        root_->Attach(mem, r.slot_);
+        if (log_number_ <= r.seq_)
+            log_number_ = r.seq_ + 1;
+        if (r.state_ == nvMultiTableRoot::kActive)
+            active.push_back(std::make_pair(r, mem));
+        else
+            level0.push_back(std::make_pair(r, mem));
+    }
+
+    // A crash in the middle of a Pop() leaves the old memtable active next to
+    // the first of its replacements, which share its left bound.  The newer
+    // one wins; the older one is queued as the youngest level 0 memtable.
+    std::sort(active.begin(), active.end(),
+              [](const std::pair<nvMultiTableRoot::Record, nvMemTable*>& a,
+                 const std::pair<nvMultiTableRoot::Record, nvMemTable*>& b) {
+        int cmp = Slice(a.first.lft_bound_).compare(b.first.lft_bound_);
+        return cmp < 0 || (cmp == 0 && a.first.seq_ > b.first.seq_);
+    });
+    std::sort(level0.begin(), level0.end(),
+              [](const std::pair<nvMultiTableRoot::Record, nvMemTable*>& a,
+                 const std::pair<nvMultiTableRoot::Record, nvMemTable*>& b) {
+        return a.first.order_ < b.first.order_;
+    });
+    for (size_t i = 0; i < active.size(); ++i) {
+        nvMemTable* mem = active[i].second;
+        if (i > 0 && active[i].first.lft_bound_ == active[i - 1].first.lft_bound_) {
+            mem->RightBound() = "";
+            root_->MoveToLevel0(mem);
+            level0.push_back(active[i]);
+            continue;
+        }
+        if (node_total_ == 0 && mem->LeftBound() != "") {
+            // The memtable that covered "" was popped without its successor
+            // taking the bound over.
+            mem->LeftBound() = "";
+            root_->SetBound(mem);
+        }
+        mem->Paramenter(nvMemTable::ParameterType::CreatedTime) = bytes_;
+        index_.Add(mem->LeftBound(), mem);
+        node_total_++;
+    }
+    for (size_t i = 0; i < level0.size(); ++i) {
+        nvMemTable* mem = level0[i].second;
+        PushLevel0(mem);
+        if (options_.TEST_nvskiplist_type == kTypeLinearHash)
+            helper_->PushWorkToQueue(reinterpret_cast<nvFixedHashTable*>(mem), BackgroundHelper::WorkType::CreateImmutableMemTable);
+    }
+    PublishIndex();
+    return Status::OK();
+}
+
+void nvMultiTable::ReleaseLevel0(nvMemTable* mem) {
+    // Off the map first: once mem is freed, a new memtable may be queued at
+    // the same address.
+    MemBloomFilter* filter = nullptr;
+    bool unfiltered = false;
+    {
+        MutexLock l(&publish_level0_mutex_);
+        auto f = level0_filters_.find(mem);
+        if (f != level0_filters_.end()) {
+            filter = f->second;
+            level0_filters_.erase(f);
+        }
+        // Nor is a filter of mem still to come wanted.
+        auto u = std::find(level0_unfiltered_.begin(), level0_unfiltered_.end(), mem);
+        if (u != level0_unfiltered_.end()) {
+            level0_unfiltered_.erase(u);
+            unfiltered = true;
+        }
+        if (level0_filtering_ == mem)
+            level0_filtering_ = nullptr;
+    }
+    if (unfiltered)
+        mem->Unref();
+    root_->Remove(mem);
+    RetireMemTable(mem);
+    // RetireMemTable() waited for the readers, the filter is unused now.
+    delete filter;
+}
+
 ll nvMultiTable::StorageUsage() const {
     return cache_policy_.nvskiplist_size_ * (node_total_ + level0_.Size());
 }
@@ -144,6 +432,7 @@ void nvMultiTable::Print() {
 
 void nvMultiTable::Init(MemTable* mem) {
     if (node_total_ > 0) return;
+    NVM_Manager::NodeScope scope(HomeNode(""));
     switch (options_.TEST_nvskiplist_type) {
     case kTypeD2SkipList: {
         //L2SkipList * list = new L2SkipList(mng_, cache_policy_);
@@ -152,6 +441,7 @@ void nvMultiTable::Init(MemTable* mem) {
         blank = new D2MemTable(mng_, cache_policy_, dbname_, log_number_++);
         blank->Ref();
         index_.Add("", blank);
+        root_->Add(blank);
         if (mem != nullptr) {
             DramKV_Skiplist * kvmem = DramKV_Skiplist::BuildFromMemtable(mem);
             auto iter = kvmem->NewIterator();
@@ -170,6 +460,7 @@ void nvMultiTable::Init(MemTable* mem) {
         blank = new nvFixedHashTable(mng_, cache_policy_, dbname_, log_number_++);
         blank->Ref();
         index_.Add("", blank);
+        root_->Add(blank);
         if (mem != nullptr) {
             DramKV_Skiplist * kvmem = DramKV_Skiplist::BuildFromMemtable(mem);
             auto iter = kvmem->NewIterator();
@@ -190,6 +481,7 @@ void nvMultiTable::Init(MemTable* mem) {
         blank = static_cast<nvMemTable*>(new D4MemTable(mng_, cache_policy_, dbname_, log_number_++));
         blank->Ref();
         index_.Add("", blank);
+        root_->Add(blank);
         if (mem != nullptr) {
             DramKV_Skiplist * kvmem = DramKV_Skiplist::BuildFromMemtable(mem);
             auto iter = kvmem->NewIterator();
@@ -210,6 +502,7 @@ void nvMultiTable::Init(MemTable* mem) {
         blank = new D5MemTable(mng_, cache_policy_, dbname_, log_number_++);
         blank->Ref();
         index_.Add("", blank);
+        root_->Add(blank);
         if (mem != nullptr) {
             DramKV_Skiplist * kvmem = DramKV_Skiplist::BuildFromMemtable(mem);
             auto iter = kvmem->NewIterator();
@@ -228,10 +521,39 @@ void nvMultiTable::Init(MemTable* mem) {
     }
 
     node_total_ ++;
+    PublishIndex();
 }
 
-Iterator* nvMultiTable::NewIterator() {
-  return new nvMultiTableIterator(this);
+SequenceNumber nvMultiTable::AddIterators(SequenceNumber seq, std::vector<Iterator*>* list) {
+    std::vector<std::string> bounds;
+    std::vector<nvMemTable*> index;
+    std::vector<Level0Version::Entry> level0;
+    int pin;
+    {
+        EpochDomain::Guard guard;
+        // Writers free the values the iterator may still show.  Level 0
+        // takes no writes.
+        pin = EpochDomain::Pin();
+        // The index first, as in Get(): a memtable that moves to level 0
+        // meanwhile is seen in one of them at least.
+        IndexIterator* iter = published_index_.load(std::memory_order_acquire)->NewIterator();
+        for (iter->SeekToFirst(); iter->Valid(); iter->Next()) {
+            bounds.push_back(iter->key().ToString());
+            index.push_back(iter->Data());
+            iter->Data()->Ref();
+        }
+        delete iter;
+        const Level0Version* v = published_level0_.load(std::memory_order_acquire);
+        level0 = v->list_;
+        for (size_t i = 0; i < level0.size(); ++i)
+            level0[i].mem_->Ref();
+    }
+    if (!level0.empty()) {
+        list->push_back(new nvLevel0Iterator(&comparator_, level0, seq + 1));
+        seq += level0.size();
+    }
+    list->push_back(new nvMultiTableIterator(bounds, index, ++seq, pin));
+    return seq;
 }
 
 void nvMultiTable::ForcePop(Version* current, const Slice* except) {
@@ -244,18 +566,16 @@ void nvMultiTable::ForcePop(Version* current, const Slice* except) {
         iter->Next(); if (!iter->Valid()) iter->SeekToFirst();
         mem = iter->Data();
     }
-    ull lifetime = bytes_ - mem->Paramenter(nvMemTable::ParameterType::CreatedTime);
-    double lowest_write_speed = 1. * mem->Paramenter(nvMemTable::ParameterType::WrittenSize) / lifetime;
+    double lowest_temperature = Temperature(mem);
     for (ul i = 1; i < try_sample; ++i) {
         iter->Next(); if (!iter->Valid()) iter->SeekToFirst();
-        if (except->compare(mem->LeftBound()) == 0) {
+        if (except->compare(iter->Data()->LeftBound()) == 0) {
             iter->Next(); if (!iter->Valid()) iter->SeekToFirst();
         }
         nvMemTable* cur = iter->Data();
-        lifetime = bytes_ - cur->Paramenter(nvMemTable::ParameterType::CreatedTime);
-        double write_speed = 1. * cur->Paramenter(nvMemTable::ParameterType::WrittenSize) / lifetime;
-        if (write_speed < lowest_write_speed) {
-            lowest_write_speed = write_speed;
+        double temperature = Temperature(cur);
+        if (temperature < lowest_temperature) {
+            lowest_temperature = temperature;
             mem = cur;
         }
     }
@@ -274,14 +594,24 @@ void nvMultiTable::ForcePop(Version* current, const Slice* except) {
 
     delete iter;
 
+    // A writer that routed here before we took rwlock_ may still be adding
+    // under the memtable's own lock; let it finish and turn later ones away,
+    // so that the checks and the level 0 filter below see every key.
+    mem->Lock();
+    mem->SetImmutable(true);
+    mem->Unlock();
+
     if (mem->StorageUsage() == mem->BlankStorageUsage()) {
         DeleteKey(mem->LeftBound());
-        mem->Unref();
+        PublishIndex();
+        root_->Remove(mem);
+        RetireMemTable(mem);
     } else {
         //mem->CheckValid();
         //level0_.push_back(mem);
         //mem->SetImmutable(true);
-        level0_.PushBack(&mem);
+        root_->MoveToLevel0(mem);
+        PushLevel0(mem);
         if (options_.TEST_nvskiplist_type == kTypeLinearHash)
             helper_->PushWorkToQueue(reinterpret_cast<nvFixedHashTable*>(mem), BackgroundHelper::WorkType::CreateImmutableMemTable);
         global_ic_.AddCompaction(-1);
@@ -302,15 +632,21 @@ void nvMultiTable::InitPop(nvMemTable* mem) {
     assert(divider[0] == mem->LeftBound());
     for (size_t i = 0; i < divider.size(); ++i) {
         nvMemTable* m = nullptr;
-        m = mem->Rebuild(divider[i], log_number_++);
+        {
+            NVM_Manager::NodeScope scope(HomeNode(divider[i]));
+            m = mem->Rebuild(divider[i], log_number_++);
+        }
         m->Ref();
         m->Paramenter(nvMemTable::ParameterType::CreatedTime) = this->bytes_;
         index_.Add(m->LeftBound(), m);
+        root_->Add(m);
     }
     node_total_ += divider.size();
     node_total_ --;
     Inserts(mem);
-    mem->Unref();
+    PublishIndex();
+    root_->Remove(mem);
+    RetireMemTable(mem);
 }
 void nvMultiTable::Inserts(nvMemTable* oldmem) {
     Iterator* iter = oldmem->NewIterator();
@@ -322,7 +658,7 @@ void nvMultiTable::Inserts(nvMemTable* oldmem) {
         mem->Add(0, value.size() == 0 ? kTypeDeletion : kTypeValue, key, value);
     }
 }
-void nvMultiTable::Pop(Version* current, const Slice& key) {
+bool nvMultiTable::Pop(Version* current, const Slice& key) {
     //assert(HasRoomForNewMem());
     //while (!HasRoomForNewMem()) {
     //    Slice except = key;
@@ -342,19 +678,30 @@ void nvMultiTable::Pop(Version* current, const Slice& key) {
     assert(mem != nullptr);
     iter->Next();
     mem->RightBound() = (iter->Valid() ? iter->Data()->LeftBound() : "");
+    // DeleteKey() hands the range to the left neighbour, or to the right one
+    // for the first range.
+    nvMemTable* heir = iter->Valid() ? iter->Data() : nullptr;
+    if (mem->LeftBound() != "") {
+        iter->Seek(mem->LeftBound());
+        iter->Prev();
+        heir = iter->Valid() ? iter->Data() : nullptr;
+    }
     delete iter;
 
-    if (mem->Garbage() >= options_.TEST_min_nvm_memtable_garbage_rate) {
+    // While a collection of mem waits for readers, it would free nothing
+    // and the writer would come back here: split instead.
+    if (mem->Garbage() >= options_.TEST_min_nvm_memtable_garbage_rate &&
+        !mem->GarbageCollectionBlocked()) {
         //ic_.Pop(mem->StorageUsage(), mem->Garbage(), this->seq_ - mem->Seq());                                      // Info Collection !!!
-        mem->GarbageCollection();
-        return;
+        mem->SetImmutable(false);
+        return false;
     }
-    if (node_total_ == 1) { InitPop(mem); return; }
+    if (node_total_ == 1) { InitPop(mem); return true; }
     vector<std::string> divider;
     vector<nvMemTable*> pack;
     assert(log_number_ > mem->Seq());
     ull lifetime = log_number_ - mem->Seq();
-    size_t try_divid = 2;
+    size_t try_divid = SplitFanOut(mem, heir);
 
     mem->FillKey(divider, try_divid);
 
@@ -364,15 +711,20 @@ void nvMultiTable::Pop(Version* current, const Slice& key) {
         assert(divider[0] == mem->LeftBound());
         for (size_t i = 0; i < divider.size(); ++i) {
             nvMemTable* m = nullptr;
-            m = mem->Rebuild(divider[i], log_number_++);
+            {
+                NVM_Manager::NodeScope scope(HomeNode(divider[i]));
+                m = mem->Rebuild(divider[i], log_number_++);
+            }
             m->Ref();
             m->Paramenter(nvMemTable::ParameterType::CreatedTime) = this->bytes_;
             index_.Add(m->LeftBound(), m);
+            root_->Add(m);
         }
     }
     //mem->CheckValid();
     //mem->SetImmutable(true);                                                   // Info Collection !!!
-    level0_.PushBack(&mem);
+    root_->MoveToLevel0(mem);
+    PushLevel0(mem);
     if (options_.TEST_nvskiplist_type == kTypeLinearHash)
         helper_->PushWorkToQueue(reinterpret_cast<nvFixedHashTable*>(mem), BackgroundHelper::WorkType::CreateImmutableMemTable);
     global_ic_.AddCompaction(-1);
@@ -383,6 +735,8 @@ void nvMultiTable::Pop(Version* current, const Slice& key) {
     while (node_total_ >= cache_policy_.standard_multimemtable_size_) {
         ForcePop(current, &key);
     }
+    PublishIndex();
+    return true;
 /*
     ic_.Pop(mem->StorageUsage(), mem->Garbage(), lifetime);                                         // Info Collection !!!
 
@@ -398,6 +752,53 @@ void nvMultiTable::Pop(Version* current, const Slice& key) {
 */
 }
 
+// Ranges this much hotter, or colder, than the average one.
+static const double kHotTemperature = 2;
+static const double kColdTemperature = 0.5;
+
+double nvMultiTable::Temperature(nvMemTable* mem) {
+    // bytes_ counts the bytes written to all ranges.
+    const ull lifetime = bytes_ - mem->Paramenter(nvMemTable::ParameterType::CreatedTime);
+    if (lifetime == 0)
+        return 1;
+    return 1. * mem->Paramenter(nvMemTable::ParameterType::WrittenSize) * node_total_ / lifetime;
+}
+
+size_t nvMultiTable::SplitFanOut(nvMemTable* mem, nvMemTable* heir) {
+    const double t = Temperature(mem);
+    if (t <= kColdTemperature)
+        return heir != nullptr && Temperature(heir) <= kColdTemperature ? 0 : 1;
+    // mem stays in NVM until its flush: the new memtables come on top of
+    // it, and RoomForNewMems() keeps 2 of them in reserve. More than fit
+    // would only push other ranges out of NVM.
+    const ll room = RoomForNewMems() + 2;
+    size_t n = (t >= kHotTemperature ? std::min<size_t>(MaxSplitFanOut, static_cast<size_t>(t)) : 2);
+    if (room < static_cast<ll>(n))
+        n = static_cast<size_t>(std::max<ll>(room, 1));
+    const ull most = cache_policy_.standard_multimemtable_size_;
+    if (node_total_ + n > most)
+        n = (node_total_ + 1 < most ? most - node_total_ : 1);
+    return n;
+}
+
+void nvMultiTable::CollectGarbage(nvMemTable* mem) {
+    bool done = false;
+    while (!done) {
+        // Some writers add holding rwlock_ alone, the others lock mem.
+        rwlock_.ReadLock();
+        if (WhereIs(mem->LeftBound()) != mem) {
+            // Popped meanwhile: level 0 memtables take no writes, whatever
+            // the collection has not freed yet stays garbage.
+            rwlock_.Unlock();
+            return;
+        }
+        mem->Lock();
+        done = mem->Immutable() || mem->GarbageCollectionStep(GarbageCollectionStepSize);
+        mem->Unlock();
+        rwlock_.Unlock();
+    }
+}
+
 bool nvMultiTable::DeleteKey(const string& key) {
     if (key != "") {
         return index_.Delete(key);
@@ -414,6 +815,7 @@ bool nvMultiTable::DeleteKey(const string& key) {
 
     n->LeftBound() = "";
     index_.Add("", n);
+    root_->SetBound(n);
     return index_.Delete(s);
 
 }
@@ -470,64 +872,69 @@ IndexIterator* nvMultiTable::NewIndexIterator() {
 }
 //-------------------------------------------------
 
+namespace {
+bool KeyBeforeBound(const Slice& key, const std::string& bound) { return key.compare(bound) < 0; }
+}
+
 nvMultiTableIterator::~nvMultiTableIterator() {
-    delete index_iter_;
     delete iter_;
+    for (size_t i = 0; i < mems_.size(); ++i)
+        mems_[i]->Unref();
+    EpochDomain::Unpin(pin_);
 }
-  nvMultiTableIterator::nvMultiTableIterator(nvMultiTable* mt) :
-        mt_(mt),
-        index_iter_(mt_->NewIndexIterator()),
-        iter_(nullptr) {
+  nvMultiTableIterator::nvMultiTableIterator(const std::vector<std::string>& bounds,
+                                             const std::vector<nvMemTable*>& mems, SequenceNumber seq,
+                                             int pin) :
+        bounds_(bounds), mems_(mems), seq_(seq), pin_(pin),
+        pos_(0), iter_(nullptr) {
   }
 
   bool nvMultiTableIterator::Valid() const {
       return iter_ && iter_->Valid();
   }
+  void nvMultiTableIterator::SetTable(size_t pos) {
+      delete iter_;
+      pos_ = pos;
+      iter_ = pos < mems_.size() ? mems_[pos]->NewOfficialIterator(seq_) : nullptr;
+  }
   void nvMultiTableIterator::Seek(const Slice& k) {
-      index_iter_->Seek(k);
-      if (iter_) delete iter_;
-      iter_ = (index_iter_->Data())->NewIterator();
-      iter_->Seek(k);
+      // The last memtable whose left bound is not greater than the key.
+      Slice key = ExtractUserKey(k);
+      size_t pos = std::upper_bound(bounds_.begin(), bounds_.end(), key, KeyBeforeBound) - bounds_.begin();
+      SetTable(pos == 0 ? 0 : pos - 1);
+      if (iter_) iter_->Seek(k);
+      SkipEmptyTablesForward();
   }
   void nvMultiTableIterator::SeekToFirst() {
-      index_iter_->SeekToFirst();
-      if (iter_) delete iter_;
-      iter_ = (index_iter_->Data())->NewIterator();
-      iter_->SeekToFirst();
+      SetTable(0);
+      if (iter_) iter_->SeekToFirst();
+      SkipEmptyTablesForward();
   }
   void nvMultiTableIterator::SeekToLast() {
-        index_iter_->SeekToLast();
-        if (iter_) delete iter_;
-        iter_ = (index_iter_->Data())->NewIterator();
-        iter_->SeekToLast();
+        SetTable(mems_.size() - 1);
+        if (iter_) iter_->SeekToLast();
+        SkipEmptyTablesBackward();
   }
   void nvMultiTableIterator::Next() {
       assert(Valid());
       iter_->Next();
-      while (iter_ && !iter_->Valid()) {
-        index_iter_->Next();
-        delete iter_;
-        if (index_iter_->Valid()) {
-            iter_ = (index_iter_->Data())->NewIterator();
-            iter_->SeekToFirst();
-        } else {
-            iter_ = nullptr;
-        }
-      }
-      //if (!iter_->Valid())
+      SkipEmptyTablesForward();
   }
   void nvMultiTableIterator::Prev() {
         assert(Valid());
         iter_->Prev();
+        SkipEmptyTablesBackward();
+  }
+  void nvMultiTableIterator::SkipEmptyTablesForward() {
+      while (iter_ && !iter_->Valid()) {
+        SetTable(pos_ + 1);
+        if (iter_) iter_->SeekToFirst();
+      }
+  }
+  void nvMultiTableIterator::SkipEmptyTablesBackward() {
         while (iter_ && !iter_->Valid()) {
-          index_iter_->Prev();
-          delete iter_;
-          if (index_iter_->Valid()) {
-              iter_ = (index_iter_->Data())->NewIterator();
-              iter_->SeekToLast();
-          } else {
-              iter_ = nullptr;
-          }
+          SetTable(pos_ == 0 ? mems_.size() : pos_ - 1);
+          if (iter_) iter_->SeekToLast();
         }
   }
   Slice nvMultiTableIterator::key() const {
@@ -543,5 +950,77 @@ nvMultiTableIterator::~nvMultiTableIterator() {
       return Status::OK();
   }
 
+nvLevel0Iterator::~nvLevel0Iterator() {
+    delete iter_;
+    for (size_t i = 0; i < entries_.size(); ++i)
+        entries_[i].mem_->Unref();
+}
+  nvLevel0Iterator::nvLevel0Iterator(const InternalKeyComparator* comparator,
+                                     const std::vector<Level0Version::Entry>& entries, SequenceNumber seq) :
+        comparator_(comparator), entries_(entries), seq_(seq),
+        opened_(entries.size(), false), opened_count_(0), iter_(nullptr) {
+  }
+
+  bool nvLevel0Iterator::Valid() const {
+      return iter_ && iter_->Valid();
+  }
+  void nvLevel0Iterator::Open(const Slice* key) {
+      std::vector<bool> opened(entries_.size());
+      size_t count = 0;
+      for (size_t i = 0; i < entries_.size(); ++i) {
+          opened[i] = key == nullptr || entries_[i].rgt_bound_ == "" || key->compare(entries_[i].rgt_bound_) < 0;
+          if (opened[i]) ++count;
+      }
+      if (iter_ != nullptr && opened == opened_)
+          return;
+      delete iter_;
+      std::vector<Iterator*> list;
+      for (size_t i = 0; i < entries_.size(); ++i)
+          if (opened[i])
+              list.push_back(entries_[i].mem_->NewOfficialIterator(seq_ + i));
+      iter_ = NewMergingIterator(comparator_, list.data(), list.size());
+      opened_.swap(opened);
+      opened_count_ = count;
+  }
+  void nvLevel0Iterator::Seek(const Slice& k) {
+      Slice key = ExtractUserKey(k);
+      Open(&key);
+      iter_->Seek(k);
+  }
+  void nvLevel0Iterator::SeekToFirst() {
+      Open(nullptr);
+      iter_->SeekToFirst();
+  }
+  void nvLevel0Iterator::SeekToLast() {
+      Open(nullptr);
+      iter_->SeekToLast();
+  }
+  void nvLevel0Iterator::Next() {
+      assert(Valid());
+      iter_->Next();
+  }
+  void nvLevel0Iterator::Prev() {
+      assert(Valid());
+      if (opened_count_ < entries_.size()) {
+          // The memtables left out by Seek() hold only smaller keys.
+          std::string k = iter_->key().ToString();
+          Open(nullptr);
+          iter_->Seek(k);
+      }
+      iter_->Prev();
+  }
+  Slice nvLevel0Iterator::key() const {
+      assert(Valid());
+      return iter_->key();
+  }
+  Slice nvLevel0Iterator::value() const {
+      assert(Valid());
+      return iter_->value();
+  }
+
+  Status nvLevel0Iterator::status() const {
+      return iter_ ? iter_->status() : Status::OK();
+  }
+
 //static InfoCollector __thread ic_;
 };
@@ -1,6 +1,7 @@
 #ifndef MULTITABLE_H
 #define MULTITABLE_H
 #include "trie_compressed.h"
+#include "art_index.h"
 //#include "skiplist_nonvolatile.h"
 //#include "nvskiplist.h"
 #include "l2skiplist.h"
@@ -13,6 +14,7 @@
 //using std::shared_mutex;
 #include "nvmemtable.h"
 #include <unordered_set>
+#include <unordered_map>
 #include <leveldb/env.h>
 #include "backgroundwriter.h"
 #include "backgroundwriter_lockfree.h"
@@ -24,6 +26,11 @@
 #include "nvhash.h"
 #include "nvhashtable.h"
 #include "hashtablehelper.h"
+#include "multitable_root.h"
+#include "epoch.h"
+#include "mem_bloom_filter.h"
+#include "util/mutexlock.h"
+#include <atomic>
 
 namespace leveldb {
 
@@ -31,27 +38,49 @@ class DBImpl;
 using std::unordered_set;
 class nvMultiTableIterator;
 
+// Level 0 as Get() sees it: a copy of the queue, oldest first, with the
+// bounds and the bloom filter each memtable had when it was queued.  It never changes once
+// published; nvMultiTable publishes a new one whenever the queue changes and
+// frees the old one through its EpochDomain.
 struct Level0Version {
-    std::vector<nvMemTable*> list_;
-    int refs_;
-    Level0Version() : list_(), refs_(0) {}
-    void Ref(){ refs_ ++; }
-    void Unref() { refs_ --; assert(refs_ >= 0); if (refs_ == 0) delete this; }
-    bool Get(const LookupKey& lkey, std::string* value, Status* s) {
+    struct Entry {
+        nvMemTable* mem_;
+        std::string lft_bound_;
+        std::string rgt_bound_;
+        MemBloomFilter* filter_;    // Owned by nvMultiTable, may be null.
+    };
+    std::vector<Entry> list_;
+
+    void Add(nvMemTable* mem, MemBloomFilter* filter) {
+        Entry e;
+        e.mem_ = mem;
+        e.filter_ = filter;
+        e.lft_bound_ = mem->LeftBound();
+        e.rgt_bound_ = mem->RightBound();
+        list_.push_back(e);
+    }
+    // V is std::string or PinnableSlice.
+    template <typename V>
+    bool Get(const LookupKey& lkey, V* value, Status* s, InfoCollector* ic) const {
       Slice key = lkey.user_key();
-      for (std::vector<nvMemTable*>::iterator p = list_.begin(); p != list_.end(); ++p) {
-          nvMemTable* imm = *p;
-          if ( key.compare(imm->LeftBound()) >= 0 && key.compare(imm->RightBound()) < 0 && imm->Get(lkey, value, s))
+      // Newest first: a key popped twice is in both tables.
+      for (std::vector<Entry>::const_reverse_iterator p = list_.rbegin(); p != list_.rend(); ++p) {
+          if (key.compare(p->lft_bound_) < 0)
+              continue;
+          if (p->rgt_bound_ != "" && key.compare(p->rgt_bound_) >= 0)
+              continue;
+          if (p->filter_ != nullptr && !p->filter_->KeyMayMatch(key)) {
+              ic->Level0FilterSkip();
+              continue;
+          }
+          bool found = p->mem_->Get(lkey, value, s);
+          if (p->filter_ != nullptr)
+              ic->Level0FilterProbe(found);
+          if (found)
               return true;
       }
       return false;
     }
-private:
-    ~Level0Version() {
-        for (std::vector<nvMemTable*>::iterator p = list_.begin(); p != list_.end(); ++p) {
-            (*p)->Unref();
-        }
-    }
 };
 
 struct nvMultiTable {
@@ -70,8 +99,26 @@ public:
 private:
     const std::string dbname_;
 
-    typedef CTrie IndexTree;
+    //typedef CTrie IndexTree;
+    typedef ARTIndex IndexTree;
     IndexTree index_;
+    // What Get() reads without rwlock_: copies of index_ and level0_ that
+    // are replaced as a whole.  Readers stay in an EpochDomain::Guard while
+    // they use them, and a memtable that leaves both is released through
+    // epoch_, so it outlives the readers that found it.
+    EpochDomain epoch_;
+    std::atomic<IndexTree*> published_index_;
+    std::atomic<Level0Version*> published_level0_;
+    port::Mutex publish_level0_mutex_;
+    // Bloom filters of the memtables in level0_, guarded by
+    // publish_level0_mutex_.
+    std::unordered_map<nvMemTable*, MemBloomFilter*> level0_filters_;
+    // Memtables of level0_ whose filters BuildLevel0Filters() has yet to
+    // build, each holding a reference, and the one it builds now.  Also
+    // guarded by publish_level0_mutex_.
+    std::vector<nvMemTable*> level0_unfiltered_;
+    nvMemTable* level0_filtering_;
+    nvMultiTableRoot* root_;
 
     const size_t writer_num_;
     BackgroundWriter_LockFree **writers_;
@@ -80,6 +127,9 @@ public:
     MyQueue leveli_;
     BackgroundHelper* helper_;
     static const ul PrepareListSize = 4;
+    static const ul MaxSplitFanOut = 4;
+    // Bytes of values CollectGarbage() moves per step.
+    static const ul GarbageCollectionStepSize = 256 * KB;
 
     MyQueue level0_;
     int64_t bytes_;
@@ -103,6 +153,18 @@ private:
 
     static std::string commonPrefix(const std::string& s1, const std::string& s2);
     void BuildWriters(NVM_Manager* mng, const Options& options, const string &dbname);
+    nvMemTable* RecoverMemTable(const nvMultiTableRoot::Record& record);
+    // Make the current index_ (level0_) what Get() sees.  The index goes
+    // second when both change, so that a reader that finds the new index
+    // also finds the memtable that moved to level 0.
+    void PublishIndex();
+    void PublishLevel0();
+    // Drop our reference to mem once no reader of the published index or
+    // level 0 can use it.  REQUIRES: mem is in neither.
+    void RetireMemTable(nvMemTable* mem);
+    // A filter of the user keys in mem, or null if it is empty.  Reads mem
+    // once, so call it without the locks of this table.
+    MemBloomFilter* BuildLevel0Filter(nvMemTable* mem);
     //void Separate(nvMemTable* N1, std::string T1_bound, std::string T3_bound);
 
 public:
@@ -130,6 +192,13 @@ public:
             return writers_[0];
         return writers_[Hash(lft_bound)];
     }
+    // The NUMA node of the range starting at lft_bound, that of its writer
+    // WhoIs(); -1 without TEST_numa_home_ranges.
+    int HomeNode(const Slice& lft_bound) {
+        if (!options_.TEST_numa_home_ranges)
+            return -1;
+        return (lft_bound.size() == 0 ? 0 : Hash(lft_bound)) % mng_->Nodes();
+    }
     void ClearWriteBuffer();
     void FillLevelI() {
         size_t size = leveli_.Size();
@@ -146,7 +215,11 @@ public:
       level0_.lock_.ReadLock();
       Slice key = lkey.user_key();
       ull head = level0_.Head(), tail = level0_.Tail();
-      for (ull i = head; i != tail; i = (i + 1) % level0_.size_) {
+      // Newest first: a key popped twice is in both tables.
+      for (ull i = tail; i != head; ) {
+          i = (i + level0_.size_ - 1) % level0_.size_;
+          if (!level0_.Ready(i))
+              continue;
           nvMemTable* imm = *reinterpret_cast<nvMemTable**>(level0_[i]);
           if (key.compare(imm->LeftBound()) < 0)
               continue;
@@ -173,6 +246,8 @@ public:
     }
     bool DeleteKey(const string& key);
     bool HasRoomForNewMem();
+    // Memtables that may still be created, negative when there are too many.
+    ll RoomForNewMems();
     //void SetFull(nvMemTable* mem, FullType type);
     nvMemTable* GetMaxMemTable() {
         IndexIterator* iter = NewIndexIterator();
@@ -188,20 +263,72 @@ public:
         delete iter;
         return maxMem;
     }
+    // Move the coldest of some memtables other than the one at key to
+    // level 0; its neighbour takes over its range.
     void ForcePop(Version *current, const Slice* key);
     void Delete(const Slice& key);
-    void Pop(Version* current, const Slice& key);
+    // Move the memtable at key to level 0 and replace it by SplitFanOut()
+    // new ones.  Returns false if it was only made writable again, to be
+    // compacted by CollectGarbage() instead, which pinned values prevent.
+    bool Pop(Version* current, const Slice& key);
+    // How much faster than an average range mem's range has been written
+    // since mem was created.
+    double Temperature(nvMemTable* mem);
+    // Memtables that replace a full mem: up to MaxSplitFanOut for a hot
+    // range, so that its writes stay in NVM longer, 2 for the others, but
+    // no more than NVM has room for; 1 for a cold one and none if heir,
+    // which takes over a range that is not renewed, is cold as well.
+    size_t SplitFanOut(nvMemTable* mem, nvMemTable* heir);
+    // Compact mem in place a step at a time, letting writers in between.
+    // REQUIRES: the caller holds a reference to mem and no locks.
+    void CollectGarbage(nvMemTable* mem);
     void InitPop(nvMemTable* mem);
     void Inserts(nvMemTable* mem);
+    // The count oldest memtables of level 0, oldest first.
+    void Level0Front(size_t count, std::vector<nvMemTable*>* mems) {
+        mems->clear();
+        level0_.lock_.ReadLock();
+        ull tail = level0_.Tail();
+        for (ull i = level0_.Head(); i != tail && mems->size() < count && level0_.Ready(i);
+             i = (i + 1) % level0_.size_)
+            mems->push_back(*reinterpret_cast<nvMemTable**>(level0_[i]));
+        level0_.lock_.Unlock();
+    }
+    // The filter of mem comes later, from BuildLevel0Filters(): we hold
+    // rwlock_ here.
+    void PushLevel0(nvMemTable* mem) {
+        if (options_.TEST_level0_filter_bits_per_key > 0) {
+            mem->Ref();
+            MutexLock l(&publish_level0_mutex_);
+            level0_unfiltered_.push_back(mem);
+        }
+        level0_.PushBack(&mem);
+        PublishLevel0();
+    }
+    // Build and publish the filters of the memtables pushed to level 0
+    // since the last call.  Until then Get() reads those memtables.
+    // REQUIRES: no lock of this table held, one caller at a time.
+    void BuildLevel0Filters();
     nvMemTable* PopFromLevel0() {
         nvMemTable* mem = nullptr;
+        level0_.lock_.WriteLock();
         level0_.PopFront(&mem);
-        //nvMemTable* mem = level0_.front();
-        //level0_.pop_front();
+        level0_.lock_.Unlock();
+        PublishLevel0();
         return mem;
     }
+    // Look key up in the memtables without taking rwlock_.
+    bool Get(const LookupKey& lkey, std::string* value, Status* s);
+    bool Get(const LookupKey& lkey, PinnableSlice* value, Status* s);
+    // Get() for keys[0,n-1], sorted by user key; true if all were found.
+    bool MultiGet(KeyContext* keys, size_t n);
 
     bool ReleaseAll();
+    // Rebuild the index and level 0 from the persistent root of dbname.
+    // If create is true the DB is new and any stale root is discarded.
+    Status Recover(bool create);
+    // Drop a level 0 memtable whose contents have been compacted.
+    void ReleaseLevel0(nvMemTable* mem);
 
     ll StorageUsage() const;
     void SetFileInUse(ull file_number, bool in_use);
@@ -213,16 +340,28 @@ public:
     }
     void CheckIndexValid();
 
-    friend class nvMultiTableIterator;
-    Iterator* NewIterator();
+    // Add to list an iterator over each memtable Get() would read now, and
+    // hold a reference to them instead of rwlock_.  Level 0 comes first,
+    // oldest first, then the index; the entries of each get the next
+    // sequence after seq, so that the newest copy of a key wins.  Returns
+    // the last sequence given.
+    SequenceNumber AddIterators(SequenceNumber seq, std::vector<Iterator*>* list);
     IndexIterator* NewIndexIterator();
 
 };
 
+// Concatenation of the memtables of the index as it was published at one
+// moment.  It holds a reference to each of them, and their entries carry
+// the sequence it was given.
 class nvMultiTableIterator: public Iterator {
  public:
   virtual ~nvMultiTableIterator();
-  explicit nvMultiTableIterator(nvMultiTable* mt);
+  // Takes over the references to mems and the EpochDomain pin that keeps
+  // their values in place; bounds[i] is the left bound of mems[i], in
+  // increasing order.
+  nvMultiTableIterator(const std::vector<std::string>& bounds,
+                       const std::vector<nvMemTable*>& mems, SequenceNumber seq,
+                       int pin);
 
   virtual bool Valid() const;
   virtual void Seek(const Slice& k);
@@ -235,13 +374,18 @@ class nvMultiTableIterator: public Iterator {
   virtual Status status() const;
 
  private:
+  // Open an iterator over mems_[pos], or none if pos is out of range.
+  void SetTable(size_t pos);
+  // Move over memtables that have no entry (left) from the current one.
+  void SkipEmptyTablesForward();
+  void SkipEmptyTablesBackward();
 
-  nvMultiTable* mt_;
-  IndexIterator *index_iter_;
-  //nvSkiplist::Iterator* iter_;
+  const std::vector<std::string> bounds_;
+  const std::vector<nvMemTable*> mems_;
+  const SequenceNumber seq_;
+  const int pin_;
+  size_t pos_;
   Iterator* iter_;
-  int pos_;
-  std::string tmp_;       // For passing to EncodeKey
 
   // No copying allowed
   nvMultiTableIterator(const nvMultiTableIterator&) = delete;
@@ -249,6 +393,45 @@ class nvMultiTableIterator: public Iterator {
 
 };
 
+// Merge of the level 0 memtables, oldest first.  A memtable is only opened
+// once the iterator can reach its range: Seek() leaves out those whose right
+// bound is not greater than the target, and they are added back if Prev()
+// needs them.
+class nvLevel0Iterator: public Iterator {
+ public:
+  virtual ~nvLevel0Iterator();
+  // Takes over the references to the memtables of entries; the i-th one is
+  // read with sequence seq + i.
+  nvLevel0Iterator(const InternalKeyComparator* comparator,
+                   const std::vector<Level0Version::Entry>& entries, SequenceNumber seq);
+
+  virtual bool Valid() const;
+  virtual void Seek(const Slice& k);
+  virtual void SeekToFirst();
+  virtual void SeekToLast();
+  virtual void Next();
+  virtual void Prev();
+  virtual Slice key() const;
+  virtual Slice value() const;
+  virtual Status status() const;
+
+ private:
+  // Merge the memtables whose right bound is greater than key, all of them
+  // if key is null.  Keeps the current merge if it covers the same ones.
+  void Open(const Slice* key);
+
+  const InternalKeyComparator* comparator_;
+  const std::vector<Level0Version::Entry> entries_;
+  const SequenceNumber seq_;
+  std::vector<bool> opened_;
+  size_t opened_count_;
+  Iterator* iter_;
+
+  // No copying allowed
+  nvLevel0Iterator(const nvLevel0Iterator&) = delete;
+  void operator=(const nvLevel0Iterator&) = delete;
+};
+
 }
 
 #endif
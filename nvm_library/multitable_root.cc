@@ -0,0 +1,208 @@
+#include "multitable_root.h"
+#include "util/coding.h"
+
+namespace leveldb {
+
+nvMultiTableRoot::nvMultiTableRoot(NVM_Manager* mng, const std::string& dbname, ListType type, ul capacity) :
+    mng_(mng), mutex_(), name_(RootName(dbname)), main_(mng->find_name(name_)),
+    capacity_(capacity), type_(type), order_(0), recovered_(false), free_(), slot_()
+{
+    if (main_ != nvnullptr && mng_->read_ull(main_ + MagicOffset) == kMagic) {
+        recovered_ = true;
+        type_ = static_cast<ListType>(mng_->read_ul(main_ + TypeOffset));
+        capacity_ = mng_->read_ul(main_ + CapacityOffset);
+        order_ = mng_->read_ull(main_ + OrderOffset);
+        for (ul i = capacity_; i > 0; --i)
+            if (mng_->read_ul(Slot(i - 1) + StateOffset) == kFree)
+                free_.push_back(i - 1);
+        return;
+    }
+    main_ = mng_->Allocate(Size());
+    mng_->write_zero(main_, Size());
+    mng_->write_ul(main_ + TypeOffset, type_);
+    mng_->write_ul(main_ + CapacityOffset, capacity_);
+    mng_->write_ull(main_ + OrderOffset, order_);
+    mng_->write_ull_barrier(main_ + MagicOffset, kMagic);
+    mng_->bind_name(name_, main_);
+    for (ul i = capacity_; i > 0; --i)
+        free_.push_back(i - 1);
+}
+
+nvAddr nvMultiTableRoot::NewBound(const std::string& lft, const std::string& rgt) {
+    ul size = 8 + lft.size() + rgt.size();
+    nvAddr bound = mng_->Allocate(size);
+    byte* buf = new byte[size];
+    EncodeFixed32(reinterpret_cast<char*>(buf), lft.size());
+    EncodeFixed32(reinterpret_cast<char*>(buf) + 4, rgt.size());
+    memcpy(buf + 8, lft.data(), lft.size());
+    memcpy(buf + 8 + lft.size(), rgt.data(), rgt.size());
+    mng_->write(bound, buf, size);
+    delete[] buf;
+    return bound;
+}
+
+void nvMultiTableRoot::DisposeBound(nvAddr bound) {
+    if (bound == nvnullptr) return;
+    mng_->Dispose(bound, 8 + mng_->read_ul(bound) + mng_->read_ul(bound + 4));
+}
+
+void nvMultiTableRoot::ReadBound(nvAddr bound, std::string* lft, std::string* rgt) {
+    lft->clear();
+    rgt->clear();
+    if (bound == nvnullptr) return;
+    ul lsize = mng_->read_ul(bound), rsize = mng_->read_ul(bound + 4);
+    Slice l = mng_->GetSlice(bound + 8, lsize);
+    Slice r = mng_->GetSlice(bound + 8 + lsize, rsize);
+    lft->assign(l.data(), l.size());
+    rgt->assign(r.data(), r.size());
+}
+
+void nvMultiTableRoot::ReplaceBound(ul slot, nvMemTable* mem) {
+    nvAddr x = Slot(slot);
+    nvAddr old = mng_->read_addr(x + BoundOffset);
+    mng_->write_addr(x + BoundOffset, NewBound(mem->LeftBound(), mem->RightBound()));
+    DisposeBound(old);
+}
+
+void nvMultiTableRoot::Free(ul slot) {
+    nvAddr x = Slot(slot);
+    mng_->write_ul_barrier(x + StateOffset, kFree);
+    DisposeBound(mng_->read_addr(x + BoundOffset));
+    mng_->write_addr(x + BoundOffset, nvnullptr);
+    free_.push_back(slot);
+}
+
+void nvMultiTableRoot::Grow() {
+    const ull old_size = Size();
+    const nvAddr old_main = main_;
+    const ul capacity = capacity_ * 2;
+    const ull size = HeaderSize + 1ULL * capacity * SlotSize;
+    nvAddr main = mng_->Allocate(size);
+    assert(main != nvnullptr);
+    // The new root is complete before the name is bound to it: a crash
+    // leaves either the old one or the new one.
+    byte* buf = new byte[old_size];
+    mng_->read(buf, old_main, old_size);
+    mng_->write(main, buf, old_size);
+    delete[] buf;
+    mng_->write_zero(main + old_size, size - old_size);
+    mng_->write_ul(main + CapacityOffset, capacity);
+    mng_->write_ull_barrier(main + MagicOffset, kMagic);
+    mng_->bind_name(name_, main);
+    mng_->Dispose(old_main, old_size);
+    main_ = main;
+    for (ul i = capacity; i > capacity_; --i)
+        free_.push_back(i - 1);
+    capacity_ = capacity;
+}
+
+void nvMultiTableRoot::GetRecords(std::vector<Record>* records) {
+    std::lock_guard<std::mutex> guard(mutex_);
+    records->clear();
+    for (ul i = 0; i < capacity_; ++i) {
+        nvAddr x = Slot(i);
+        ul state = mng_->read_ul(x + StateOffset);
+        if (state == kFree) continue;
+        Record r;
+        r.slot_ = i;
+        r.state_ = static_cast<State>(state);
+        r.type_ = static_cast<ListType>(mng_->read_ul(x + ListTypeOffset));
+        r.seq_ = mng_->read_ull(x + SeqOffset);
+        r.order_ = mng_->read_ull(x + Level0OrderOffset);
+        r.main_ = mng_->read_addr(x + MainOffset);
+        r.main_size_ = mng_->read_ul(x + MainSizeOffset);
+        r.aux_ = mng_->read_addr(x + AuxOffset);
+        r.aux_size_ = mng_->read_ul(x + AuxSizeOffset);
+        ReadBound(mng_->read_addr(x + BoundOffset), &r.lft_bound_, &r.rgt_bound_);
+        records->push_back(r);
+    }
+}
+
+void nvMultiTableRoot::Attach(nvMemTable* mem, ul slot) {
+    std::lock_guard<std::mutex> guard(mutex_);
+    slot_[mem] = slot;
+}
+
+void nvMultiTableRoot::Release(ul slot) {
+    std::lock_guard<std::mutex> guard(mutex_);
+    Free(slot);
+}
+
+void nvMultiTableRoot::Add(nvMemTable* mem) {
+    nvAddr main, aux;
+    ull main_size, aux_size;
+    if (!mem->PersistentInfo(&main, &main_size, &aux, &aux_size))
+        return;
+    std::lock_guard<std::mutex> guard(mutex_);
+    if (free_.empty())
+        Grow();
+    ul slot = free_.back();
+    free_.pop_back();
+    nvAddr x = Slot(slot);
+    mng_->write_ul(x + ListTypeOffset, type_);
+    mng_->write_ull(x + SeqOffset, mem->Seq());
+    mng_->write_ull(x + Level0OrderOffset, 0);
+    mng_->write_addr(x + MainOffset, main);
+    mng_->write_ul(x + MainSizeOffset, main_size);
+    mng_->write_addr(x + AuxOffset, aux);
+    mng_->write_ul(x + AuxSizeOffset, aux_size);
+    mng_->write_addr(x + BoundOffset, NewBound(mem->LeftBound(), mem->RightBound()));
+    mng_->write_ul_barrier(x + StateOffset, kActive);
+    slot_[mem] = slot;
+}
+
+void nvMultiTableRoot::SetBound(nvMemTable* mem) {
+    std::lock_guard<std::mutex> guard(mutex_);
+    auto i = slot_.find(mem);
+    if (i == slot_.end()) return;
+    ReplaceBound(i->second, mem);
+}
+
+void nvMultiTableRoot::MoveToLevel0(nvMemTable* mem) {
+    std::lock_guard<std::mutex> guard(mutex_);
+    auto i = slot_.find(mem);
+    if (i == slot_.end()) return;
+    nvAddr x = Slot(i->second);
+    ReplaceBound(i->second, mem);
+    mng_->write_ull(main_ + OrderOffset, ++order_);
+    mng_->write_ull(x + Level0OrderOffset, order_);
+    mng_->write_ul_barrier(x + StateOffset, kLevel0);
+}
+
+void nvMultiTableRoot::Remove(nvMemTable* mem) {
+    std::lock_guard<std::mutex> guard(mutex_);
+    auto i = slot_.find(mem);
+    if (i == slot_.end()) return;
+    Free(i->second);
+    slot_.erase(i);
+}
+
+bool nvMultiTableRoot::Contains(nvMemTable* mem) {
+    std::lock_guard<std::mutex> guard(mutex_);
+    return slot_.find(mem) != slot_.end();
+}
+
+void nvMultiTableRoot::Destroy(NVM_Manager* mng, const std::string& dbname) {
+    const std::string name = RootName(dbname);
+    nvAddr main = mng->find_name(name);
+    if (main == nvnullptr) return;
+    if (mng->read_ull(main + MagicOffset) == kMagic) {
+        ul capacity = mng->read_ul(main + CapacityOffset);
+        for (ul i = 0; i < capacity; ++i) {
+            nvAddr x = main + HeaderSize + 1ULL * i * SlotSize;
+            if (mng->read_ul(x + StateOffset) == kFree) continue;
+            mng->write_ul_barrier(x + StateOffset, kFree);
+            nvAddr bound = mng->read_addr(x + BoundOffset);
+            if (bound != nvnullptr)
+                mng->Dispose(bound, 8 + mng->read_ul(bound) + mng->read_ul(bound + 4));
+            mng->Dispose(mng->read_addr(x + MainOffset), mng->read_ul(x + MainSizeOffset));
+            if (mng->read_addr(x + AuxOffset) != nvnullptr)
+                mng->Dispose(mng->read_addr(x + AuxOffset), mng->read_ul(x + AuxSizeOffset));
+        }
+        mng->write_ull_barrier(main + MagicOffset, 0);
+        mng->Dispose(main, HeaderSize + 1ULL * capacity * SlotSize);
+    }
+    mng->delete_name(name);
+}
+
+}
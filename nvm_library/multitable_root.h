@@ -0,0 +1,98 @@
+#ifndef MULTITABLE_ROOT_H
+#define MULTITABLE_ROOT_H
+#include "global.h"
+#include "nvm_manager.h"
+#include "nvmemtable.h"
+#include "leveldb/options.h"
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace leveldb {
+
+// nvMultiTableRoot is the persistent directory of a nvMultiTable.  It is
+// bound to "<dbname>/multitable.root" in the name book of NVM_Manager and
+// records, for every memtable that is either in the index or queued in
+// level 0, where its NVM image is and which key range it covers.  DBImpl
+// rebuilds the index and level 0 from it instead of starting empty.
+//
+// Root   : [Magic 8][Type 4][Capacity 4][Order 8][Reserved 40] + Capacity * Slot
+// Slot   : [State 4][Type 4][Seq 8][Order 8][Main 8][MainSize 4][AuxSize 4]
+//          [Aux 8][Bound 8][Reserved 8]
+// Bound  : [LeftSize 4][RightSize 4][Left][Right]
+//
+// A slot is published by writing its State last, and is retired by
+// clearing its State first, so a crash never exposes a half-written slot.
+struct nvMultiTableRoot {
+    enum State { kFree = 0, kActive = 1, kLevel0 = 2 };
+    struct Record {
+        ul slot_;
+        State state_;
+        ListType type_;
+        ull seq_, order_;
+        nvAddr main_, aux_;
+        ul main_size_, aux_size_;
+        std::string lft_bound_, rgt_bound_;
+    };
+
+    nvMultiTableRoot(NVM_Manager* mng, const std::string& dbname, ListType type, ul capacity);
+    ~nvMultiTableRoot() {}
+
+    // True if an existing root was found in NVM.
+    bool Recovered() const { return recovered_; }
+    ListType Type() const { return type_; }
+    void GetRecords(std::vector<Record>* records);
+
+    // Bind a memtable rebuilt from slot.
+    void Attach(nvMemTable* mem, ul slot);
+    // Drop a slot whose memtable could not be rebuilt.
+    void Release(ul slot);
+
+    void Add(nvMemTable* mem);
+    void SetBound(nvMemTable* mem);
+    void MoveToLevel0(nvMemTable* mem);
+    void Remove(nvMemTable* mem);
+    bool Contains(nvMemTable* mem);
+
+    // Dispose the root of dbname and every memtable it records.
+    static void Destroy(NVM_Manager* mng, const std::string& dbname);
+
+private:
+    static const ull kMagic = 0x746f6f72544d766eULL;    // "nvMTroot"
+    enum RootOffset { MagicOffset = 0, TypeOffset = 8, CapacityOffset = 12, OrderOffset = 16, HeaderSize = 64 };
+    enum SlotOffset {
+        StateOffset = 0, ListTypeOffset = 4, SeqOffset = 8, Level0OrderOffset = 16,
+        MainOffset = 24, MainSizeOffset = 32, AuxSizeOffset = 36, AuxOffset = 40,
+        BoundOffset = 48, SlotSize = 64
+    };
+
+    NVM_Manager* mng_;
+    std::mutex mutex_;
+    const std::string name_;
+    nvAddr main_;
+    ul capacity_;
+    ListType type_;
+    ull order_;
+    bool recovered_;
+    std::vector<ul> free_;
+    std::unordered_map<nvMemTable*, ul> slot_;
+
+    static std::string RootName(const std::string& dbname) { return dbname + "/multitable.root"; }
+    ull Size() const { return HeaderSize + 1ULL * capacity_ * SlotSize; }
+    nvAddr Slot(ul slot) const { return main_ + HeaderSize + 1ULL * slot * SlotSize; }
+    nvAddr NewBound(const std::string& lft, const std::string& rgt);
+    void DisposeBound(nvAddr bound);
+    void ReadBound(nvAddr bound, std::string* lft, std::string* rgt);
+    void ReplaceBound(ul slot, nvMemTable* mem);
+    void Free(ul slot);
+    // Move the root to one with twice as many slots.
+    void Grow();
+
+    nvMultiTableRoot(const nvMultiTableRoot&) = delete;
+    void operator=(const nvMultiTableRoot&) = delete;
+};
+
+}
+
+#endif // MULTITABLE_ROOT_H
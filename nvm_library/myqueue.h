@@ -1,71 +1,180 @@
 #ifndef MYQUEUE_H
 #define MYQUEUE_H
 #include "global.h"
-#include "port/atomic_pointer.h"
 #include "port/port_posix.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <cstring>
+#include <mutex>
+#include <thread>
 //#include <stdlib.h>
 
+// A bounded ring of fixed-size elements for several producers and several
+// consumers.  Every slot carries a turn: a push of position p may fill slot
+// p % size_ once its turn is p, and a pop of p may empty it once its turn is
+// p + 1, so pushers and poppers only race on the CAS of tail_ or head_.
+// PushBack() waits while the queue is full and PopFront() while it is empty;
+// a thread that holds a lock the other side needs must keep room itself.
 struct MyQueue {
     const uint32_t size_;
     const uint32_t element_size_;
     byte* a;
-    ull head_;
-    leveldb::port::AtomicPointer tail_;
+    std::atomic<ull>* turn_;
     leveldb::port::RWLock lock_;
 
-    ull Next(ull x) { return (x + 1 < size_ ? x + 1 : 0);}
     void* operator[] (ull x) { return a + x * element_size_; }
-    ull Head() const { return head_; }
-    ull Tail() const { return reinterpret_cast<ull>(tail_.NoBarrier_Load()); }
+    // Slots of the first element and of the one after the last.  tail_
+    // moves before the element is copied in: a reader walking [Head(),
+    // Tail()) takes slot i only if Ready(i).
+    ull Head() const { return head_.load(std::memory_order_acquire) % size_; }
+    ull Tail() const { return tail_.load(std::memory_order_acquire) % size_; }
+    // The push to slot i is complete and it is not popped yet.  Its turn
+    // is then its position + 1; an empty slot has its position.
+    bool Ready(ull i) const {
+        return turn_[i].load(std::memory_order_acquire) % size_ == (i + 1) % size_;
+    }
     ull Size() const {
-        ull tail = Tail(), head = Head();
-        return (tail < head ? tail + size_ - head : tail - head);
-    }
-#define MyQueue_Next(x) (x + 1 < size_ ? x + 1 : 0)
-#define MyQueue_Tail (reinterpret_cast<ull>(tail_.NoBarrier_Load()))
-#define MyQueue_Head (head_)
-#define MyQueue_SetTail(x) (tail_.NoBarrier_Store(reinterpret_cast<void*>(x)))
-#define MyQueue_SetHead(x) (head_ = x)
-    // a[head_] : First element in queue;
-    // a[tail_] : Next element of the Last element in queue.
-    // if tail_ == head_, it means queue is empty.
-    // We don't allow queue.size() == size_, that's why size_ = size+1 during initialization.
+        ull head = head_.load(std::memory_order_acquire);
+        ull tail = tail_.load(std::memory_order_acquire);
+        return (tail > head ? tail - head : 0);
+    }
+    // We don't allow queue.size() == size_, that's why size_ = size+1 during
+    // initialization: Head() == Tail() still means an empty queue.
     MyQueue(uint32_t size, uint32_t element_size) :
-        size_(size+1), element_size_(element_size), a(nullptr),
-        head_(0), tail_()
+        size_(size+1), element_size_(element_size),
+        a(new byte[size_ * element_size]), turn_(new std::atomic<ull>[size_]),
+        head_(0), tail_(0), waiters_(0)
     {
-        a = new byte[size_ * element_size];
-        MyQueue_SetHead(0);
-        MyQueue_SetTail(0);
+        for (ull i = 0; i < size_; ++i)
+            turn_[i].store(i, std::memory_order_relaxed);
         assert(Empty());
     }
-    void PushBack(const void* src) {    // For Producer: head_ should be a signal mark, to check if queue is full. but...
-        ull locate = MyQueue_Tail;
-        //assert(Empty() || Next(Tail()) != Head());
-        memcpy(a + locate * element_size_,
-               src,
-               element_size_);
-        MyQueue_SetTail(MyQueue_Next(locate));
+    ~MyQueue() {
+        delete[] turn_;
+        delete[] a;
+    }
+
+    bool TryPushBack(const void* src) {
+        ull pos = tail_.load(std::memory_order_relaxed);
+        while (true) {
+            if (pos - head_.load(std::memory_order_acquire) >= size_ - 1) {
+                ull now = tail_.load(std::memory_order_relaxed);
+                if (now == pos) return false;   // Full.
+                pos = now;
+                continue;
+            }
+            std::atomic<ull>& turn = turn_[pos % size_];
+            if (turn.load(std::memory_order_acquire) == pos) {
+                if (tail_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    memcpy(a + (pos % size_) * element_size_, src, element_size_);
+                    turn.store(pos + 1, std::memory_order_release);
+                    Notify();
+                    return true;
+                }
+            } else {
+                // Taken by another pusher, or still being read by a popper.
+                pos = tail_.load(std::memory_order_relaxed);
+            }
+        }
+    }
+    bool TryPopFront(void* dst) {
+        ull pos = head_.load(std::memory_order_relaxed);
+        while (true) {
+            std::atomic<ull>& turn = turn_[pos % size_];
+            ull t = turn.load(std::memory_order_acquire);
+            if (t == pos + 1) {
+                if (head_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    memcpy(dst, a + (pos % size_) * element_size_, element_size_);
+                    turn.store(pos + size_, std::memory_order_release);
+                    Notify();
+                    return true;
+                }
+            } else if (t < pos + 1) {
+                ull now = head_.load(std::memory_order_relaxed);
+                if (now == pos) return false;   // Empty, or the push is not done.
+                pos = now;
+            } else {
+                pos = head_.load(std::memory_order_relaxed);
+            }
+        }
+    }
+    void PushBack(const void* src) {
+        while (!TryPushBack(src))
+            Wait(kRoom, kWaitMicros);
+    }
+    void PopFront(void* dst) {
+        while (!TryPopFront(dst))
+            Wait(kData, kWaitMicros);
     }
-    void PopFront(void *src) {
-        //assert(!Empty());
-        ull locate = MyQueue_Head;
-        memcpy(src, a + locate * element_size_, element_size_);
-        MyQueue_SetHead(MyQueue_Next(locate));
+    // Only for a single consumer, which pops what it saw afterwards.
+    // REQUIRES: !Empty().  Waits for a push still copying in.
+    void Front(void* dst) {
+        ull locate = Head();
+        while (!Ready(locate))
+            std::this_thread::yield();
+        memcpy(dst, a + locate * element_size_, element_size_);
     }
-    void Front(void* src) {
-        ull locate = MyQueue_Head;
-        memcpy(src, a + locate * element_size_, element_size_);
+    void Back(void* dst) {
+        ull locate = (Tail() + size_ - 1) % size_;
+        while (!Ready(locate))
+            std::this_thread::yield();
+        memcpy(dst, a + locate * element_size_, element_size_);
     }
+    bool Empty() const {
+        return head_.load(std::memory_order_acquire) == tail_.load(std::memory_order_acquire);
+    }
+    bool Full() const { return Size() >= size_ - 1; }
 
-    void Back(void* src) {
-        ull locate = MyQueue_Tail;
-        memcpy(src, a + locate * element_size_, element_size_);
+    // Block until the queue has an element, WakeUp() is called or micros
+    // pass.  Returns !Empty().
+    bool WaitForData(ull micros) {
+        if (Empty()) Wait(kData, micros);
+        return !Empty();
+    }
+    void WaitUntilEmpty() const {
+        while (!Empty())
+            Wait(kDrained, kWaitMicros);
     }
-    bool Empty() const {                  // For Consumer: tail_ should be a signal mark, to check if queue is empty.
-        return MyQueue_Tail == MyQueue_Head;
+    void WakeUp() const {
+        std::lock_guard<std::mutex> guard(mutex_);
+        cv_.notify_all();
     }
+
+private:
+    enum { kWaitMicros = 1000 };
+    enum WaitFor { kData, kRoom, kDrained };
+    // Keep the two hot counters and the waiting state in cache lines of
+    // their own.
+    char pad0_[64];
+    std::atomic<ull> head_;     // Position of the next pop.
+    char pad1_[64];
+    std::atomic<ull> tail_;     // Position of the next push.
+    char pad2_[64];
+    mutable std::mutex mutex_;
+    mutable std::condition_variable cv_;
+    mutable std::atomic<int> waiters_;
+
+    void Notify() const {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (waiters_.load(std::memory_order_relaxed) > 0)
+            WakeUp();
+    }
+    // The timeout covers a wakeup racing with the check, so one round may
+    // return without any change.
+    void Wait(WaitFor what, ull micros) const {
+        waiters_.fetch_add(1);
+        {
+            std::unique_lock<std::mutex> l(mutex_);
+            bool ready = (what == kData ? !Empty() : what == kRoom ? !Full() : Empty());
+            if (!ready)
+                cv_.wait_for(l, std::chrono::microseconds(micros));
+        }
+        waiters_.fetch_sub(1);
+    }
+
+    MyQueue(const MyQueue&) = delete;
+    void operator=(const MyQueue&) = delete;
 };
 
 #endif // MYQUEUE_H
@@ -7,10 +7,13 @@ void nvLinearHash::Add_(const leveldb::Slice& key, const leveldb::Slice& value,
     Block block;
     nvOffset ptr, ptr_location;
     if (!Seek(key, block, ptr, ptr_location)) {
-        SetBlock(ptr_location, NewBlock(key, value, ptr));
+        nvOffset b = NewBlock(key, value, ptr);
+        mng_->Fence();
+        SetBlock(ptr_location, b);
         return;
     }
     nvOffset v = NewValue(value);
+    mng_->Fence();
     if (block.value_ptr_ != blankblock) {
         ul oldvsize = GetValueSize(block.value_ptr_) + ValueDataOffset;
         UpdateBlock(ptr, v);
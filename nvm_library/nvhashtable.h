@@ -11,6 +11,7 @@
 #include "d1skiplist.h"
 #include "mem_node_cache.h"
 #include "util/random.h"
+#include <atomic>
 
 namespace leveldb {
 /*
@@ -82,18 +83,26 @@ struct nvLinearHash : AbstractMemTable {
         nvOffset full_size_;
         nvOffset alloc_ptr_;
         nvOffset alloc_remaining_;
+        bool detached_;
         //nvOffset garbage_size_;
 
         Narena(NVM_Manager* mng, ul size) :
             mng_(mng), cache_(256), main_(), full_size_(size),
-            alloc_ptr_(blankblock), alloc_remaining_(0)
+            alloc_ptr_(blankblock), alloc_remaining_(0), detached_(false)
         {
             main_ = mng_->Allocate(size);
             alloc_ptr_ = 0;
             alloc_remaining_ = size - 0;
         }
+        // Attach to an existing image; the owner sets alloc_ptr_ after scanning it.
+        Narena(NVM_Manager* mng, nvAddr main, ul size) :
+            mng_(mng), cache_(256), main_(main), full_size_(size),
+            alloc_ptr_(size), alloc_remaining_(0), detached_(false)
+        {
+        }
         ~Narena() {
-            DisposeAll();
+            if (!detached_)
+                DisposeAll();
         }
         nvOffset AllocateBlock(nvOffset size) {
             if (size > alloc_remaining_)
@@ -212,11 +221,47 @@ public:
         main_block_offset_(blankblock) {
         main_block_offset_ = arena_.AllocateBlock(MainBlockSize);
         hash_block_offset_ = arena_.AllocateBlock(hash_range_ * sizeof(nvOffset));
+        mng_->write_ul(arena_.main_ + TableSize, table_size);
+        mng_->write_ul(arena_.main_ + HashHeadOffset, hash_block_offset_);
+        mng_->write_ul(arena_.main_ + HashSize, hash_range_);
+        mng_->write_ul(arena_.main_ + TableUsed, 0);
         if (clean) {
             CleanHashBlock();
         }
         cleaned_ = false;
     }
+    // Recovery: reopen the table at main.  TableUsed is only set by a clean
+    // Detach(); after a crash the end of the used space is found by a scan.
+    nvLinearHash(NVM_Manager* mng, nvAddr main, double full_limit) :
+        arena_(mng, main, mng->read_ul(main + TableSize)),
+        mng_(mng),
+        hash_range_(mng->read_ul(main + HashSize)),
+        full_range_(static_cast<ul>(hash_range_ * full_limit)),
+        total_used_(0), total_key_(0),
+        hash_block_offset_(mng->read_ul(main + HashHeadOffset)),
+        main_block_offset_(blankblock), cleaned_(true) {
+        nvOffset bound = mng_->read_ul(arena_.main_ + TableUsed);
+        if (bound == 0) {
+            bound = hash_block_offset_ + hash_range_ * sizeof(nvOffset);
+            Block block;
+            for (ul i = 0; i < hash_range_; ++i) {
+                nvOffset x = mng_->read_ul(arena_.main_ + hash_block_offset_ + i * sizeof(nvOffset));
+                for (; x != blankblock; x = block.next_) {
+                    LoadBlock(x, &block);
+                    bound = std::max<nvOffset>(bound, x + KeyDataOffset + block.key_size_);
+                    if (block.value_ptr_ != blankblock)
+                        bound = std::max<nvOffset>(bound, block.value_ptr_ + ValueDataOffset + GetValueSize(block.value_ptr_));
+                }
+            }
+        }
+        mng_->write_ul_barrier(arena_.main_ + TableUsed, 0);
+        arena_.alloc_ptr_ = bound;
+        arena_.alloc_remaining_ = arena_.full_size_ - bound;
+    }
+    void Detach() {
+        mng_->write_ul_barrier(arena_.main_ + TableUsed, arena_.alloc_ptr_);
+        arena_.detached_ = true;
+    }
     ~nvLinearHash() {
         //arena_.DisposeAll();
         //    arena_.DisposeAll();
@@ -391,7 +436,7 @@ struct nvFixedHashTable : nvMemTable {
 
     port::RWLock lock_;
     bool is_immutable_;
-    int refs__;
+    std::atomic<int> refs__;
     std::string MemName(const Slice& dbname, ull seq) {
         return dbname.ToString() + std::to_string(seq) + ".nvskiplist";
     }
@@ -403,9 +448,29 @@ public:
         lft_bound_(), rgt_bound_(), lock_(), is_immutable_(false), refs__(0) {
         mng_->bind_name(MemName(dbname_, seq_), table_.Location());
     }
+    // Recovery: rebuild from the image at location.
+    nvFixedHashTable(NVM_Manager* mng, const CachePolicy& cp, const Slice& dbname, ull seq, nvAddr location) :
+        mng_(mng), cp_(cp), full_size_(cp.nvskiplist_size_), nearly_full_size_(cp.nearly_full_size_), written_size_(0),
+        table_(mng, location, cp.hash_full_limit_),
+        imm_(nullptr), dbname_(dbname.ToString()), seq_(seq), created_time_(0), pre_write_(0),
+        lft_bound_(), rgt_bound_(), lock_(), is_immutable_(false), refs__(0) {
+        full_size_ = table_.arena_.full_size_;
+    }
     virtual ~nvFixedHashTable() {
         if (imm_ != nullptr)
             delete imm_;
+        if (!table_.arena_.detached_)
+            mng_->delete_name(MemName(dbname_, seq_));
+    }
+    virtual bool PersistentInfo(nvAddr* main, ull* main_size, nvAddr* aux, ull* aux_size) {
+        *main = table_.Location();
+        *main_size = table_.arena_.full_size_;
+        *aux = nvnullptr;
+        *aux_size = 0;
+        return true;
+    }
+    virtual void Detach() {
+        table_.Detach();
     }
 
     virtual void Add(SequenceNumber seq, ValueType type, const Slice& key, const Slice& value) {
@@ -460,8 +525,9 @@ public:
 
     virtual void Ref() { refs__++; }
     virtual void Unref() {
-        assert(refs__ > 0);
-        if (--refs__ == 0) {
+        int refs = --refs__;
+        assert(refs >= 0);
+        if (refs == 0) {
             delete this;
         }
     }
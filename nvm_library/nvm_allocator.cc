@@ -1,4 +1,240 @@
 #include "nvm_allocator.h"
+#include <vector>
+#include <atomic>
+
+  void NVM_BuddyAllocator::Free(nvAddr begin, nvAddr end) {
+      while (begin < end) {
+          byte level = log2_downfit(end - begin);
+          if (level >= MaxLevel) level = MaxLevel - 1;
+          while ((begin - Begin) & ((1ULL << level) - 1))
+              --level;
+          Push(level, begin);
+          begin += 1ULL << level;
+      }
+  }
+
+  void NVM_BuddyAllocator::SetMap(nvAddr addr, int level) {
+      if (Map == nvnullptr || io_ == nullptr) return;
+      byte value = static_cast<byte>(level + 1);
+      io_->write(Map + (addr - Begin) / Page, &value, 1);
+  }
+
+  // Checkpoint : [Count 8] + Count * [Level 8][Addr 8]
+  void NVM_BuddyAllocator::Checkpoint() {
+      std::lock_guard<std::mutex> guard(mutex_);
+      if (io_ == nullptr || Map != nvnullptr || checkpoint_ != nvnullptr) return;
+      ull count = slot_.size();
+      // Taking the block may split up to MaxLevel free blocks.
+      ull size = 8 + (count + MaxLevel) * 16;
+      if (size < Page) size = Page;
+      byte level = log2_upfit(size);
+      nvAddr block = Allocate_(level);
+      if (block == nvnullptr) return;
+      std::vector<byte> buf(8);
+      for (byte l = 0; l < MaxLevel; ++l) {
+          for (size_t i = 0; i < free_[l].size(); ++i) {
+              ull entry[2] = { l, free_[l][i] };
+              buf.insert(buf.end(), reinterpret_cast<byte*>(entry), reinterpret_cast<byte*>(entry + 2));
+          }
+      }
+      count = (buf.size() - 8) / 16;
+      memcpy(buf.data(), &count, 8);
+      io_->write(block, buf.data(), buf.size());
+      io_->write_ull(Record + 8, level);
+      io_->write_ull_barrier(Record, block);
+      checkpoint_ = block;
+      checkpoint_level_ = level;
+  }
+
+  bool NVM_BuddyAllocator::Restore() {
+      std::lock_guard<std::mutex> guard(mutex_);
+      if (Map != nvnullptr) {
+          // Every block not recorded as allocated is free.
+          const ull pages = MapBytes(Begin, End, Page);
+          std::vector<byte> map(pages);
+          io_->read(map.data(), Map, pages);
+          nvAddr free_begin = Begin;
+          for (ull i = 0; i < pages; ) {
+              if (map[i] == 0) {
+                  ++i;
+                  continue;
+              }
+              nvAddr block = Begin + i * Page;
+              Free(free_begin, block);
+              free_begin = block + (1ULL << (map[i] - 1));
+              i = (free_begin - Begin) / Page;
+          }
+          Free(free_begin, End);
+          return true;
+      }
+      nvAddr block = io_->read_addr(Record);
+      if (block == nvnullptr) return false;
+      ull count = io_->read_ull(block);
+      for (ull i = 0; i < count; ++i) {
+          nvAddr entry = block + 8 + i * 16;
+          Push(static_cast<byte>(io_->read_ull(entry)), io_->read_addr(entry + 8));
+      }
+      // The record still describes the free list, so keep it until the
+      // first change.
+      checkpoint_ = block;
+      checkpoint_level_ = static_cast<byte>(io_->read_ull(Record + 8));
+      return true;
+  }
+
+  void NVM_BuddyAllocator::DropCheckpoint_() {
+      nvAddr block = checkpoint_;
+      checkpoint_ = nvnullptr;
+      if (io_ == nullptr) return;
+      io_->write_ull_barrier(Record, nvnullptr);
+      Dispose_(block, checkpoint_level_);
+  }
+
+  static std::atomic<ull> node_allocator_ids(0);
+
+  NVM_NodeAllocator::NVM_NodeAllocator(const NVM_Options& options, NVM_Manager* io, bool format) :
+      Allocator(), io_(io), Page(options.page_size), pools_(),
+      page_maps_(true), magazines_mutex_(), magazines_(),
+      id_(++node_allocator_ids) {
+      ull count = 1;
+      if (format) {
+          if (options.numa_nodes > 1) count = options.numa_nodes;
+          io_->write_ull(NVM_Manager::PoolsOffset, count);
+          io_->write_ull(NVM_Manager::PageMapsOffset, 1);
+      } else {
+          if (io_->read_ull(NVM_Manager::PoolsOffset) > 0)
+              count = io_->read_ull(NVM_Manager::PoolsOffset);
+          page_maps_ = io_->read_ull(NVM_Manager::PageMapsOffset) != 0;
+      }
+      const nvAddr begin = options.basic_offset, end = options.block->Size();
+      const ull span = ((end - begin) / count) & ~(Page - 1);
+      for (ull p = 0; p < count; ++p) {
+          nvAddr lo = begin + p * span;
+          nvAddr hi = (p + 1 == count ? end : lo + span);
+          nvAddr record = NVM_Manager::CheckpointOffset, map = nvnullptr;
+          if (page_maps_) {
+              // [PageMap][Blocks], the map rounded up to whole pages.
+              ull map_bytes = (NVM_BuddyAllocator::MapBytes(lo, hi, Page) + Page - 1) & ~(Page - 1);
+              map = lo;
+              lo += map_bytes;
+              if (format) io_->write_zero(map, map_bytes);
+          } else if (p > 0) {
+              record = lo;
+              lo += Page;
+          }
+          sys_nvm_bind(options.block->Decode(lo), hi - lo, static_cast<int>(p));
+          pools_.push_back(new NVM_BuddyAllocator(options, io, lo, hi, record, map, format));
+      }
+  }
+  NVM_NodeAllocator::~NVM_NodeAllocator() {
+      // What the magazines hold is free in the page maps already.
+      for (auto i = magazines_.begin(); i != magazines_.end(); ++i)
+          delete i->second;
+      for (size_t p = 0; p < pools_.size(); ++p)
+          delete pools_[p];
+  }
+  size_t NVM_NodeAllocator::Home() const {
+      if (pools_.size() == 1) return 0;
+      int node = NVM_Manager::HomeNode();
+      if (node < 0) node = sys_nvm_current_node();
+      return static_cast<size_t>(node) % pools_.size();
+  }
+  NVM_BuddyAllocator* NVM_NodeAllocator::PoolOf(nvAddr addr) const {
+      for (size_t p = 1; p < pools_.size(); ++p)
+          if (pools_[p]->Contains(addr))
+              return pools_[p];
+      return pools_[0];
+  }
+  NVM_NodeAllocator::Magazine* NVM_NodeAllocator::ThreadMagazine() {
+      static __thread ull owner = 0;
+      static __thread Magazine* magazine = nullptr;
+      if (owner != id_) {
+          std::lock_guard<std::mutex> guard(magazines_mutex_);
+          Magazine*& m = magazines_[pthread_self()];
+          if (m == nullptr) m = new Magazine;
+          magazine = m;
+          owner = id_;
+      }
+      return magazine;
+  }
+  nvAddr NVM_NodeAllocator::AllocateFromPools(size_t size, size_t home) {
+      for (size_t i = 0; i < pools_.size(); ++i) {
+          nvAddr result = pools_[(home + i) % pools_.size()]->Allocate(size);
+          if (result != nvnullptr)
+              return result;
+      }
+      return nvnullptr;
+  }
+  void NVM_NodeAllocator::Drain() {
+      std::lock_guard<std::mutex> guard(magazines_mutex_);
+      for (auto i = magazines_.begin(); i != magazines_.end(); ++i) {
+          Magazine* m = i->second;
+          std::lock_guard<std::mutex> l(m->mutex_);
+          for (byte level = 0; level <= kMagazineMaxLevel; ++level) {
+              for (size_t j = 0; j < m->rounds_[level].size(); ++j)
+                  PoolOf(m->rounds_[level][j])->Dispose(m->rounds_[level][j], 1ULL << level);
+              m->rounds_[level].clear();
+          }
+      }
+  }
+  nvAddr NVM_NodeAllocator::Allocate(size_t size) {
+      const size_t home = Home();
+      const byte level = log2_upfit(size);
+      if (page_maps_ && level <= kMagazineMaxLevel) {
+          Magazine* m = ThreadMagazine();
+          std::lock_guard<std::mutex> guard(m->mutex_);
+          std::vector<nvAddr>& rounds = m->rounds_[level];
+          if (!rounds.empty() && PoolOf(rounds.back()) == pools_[home]) {
+              nvAddr result = rounds.back();
+              rounds.pop_back();
+              pools_[home]->SetMap(result, level);
+              return result;
+          }
+      }
+      nvAddr result = AllocateFromPools(size, home);
+      if (result == nvnullptr && page_maps_) {
+          // The magazines may hold the buddies of what is free.
+          Drain();
+          result = AllocateFromPools(size, home);
+      }
+      if (result == nvnullptr) {
+          printf("Error : Space not enough in NVM-Buddy-Allocator.\n");
+          assert(false);
+      }
+      return result;
+  }
+  void NVM_NodeAllocator::Dispose(nvAddr ptr, size_t size) {
+      NVM_BuddyAllocator* pool = PoolOf(ptr);
+      const byte level = log2_upfit(size);
+      if (page_maps_ && level <= kMagazineMaxLevel && pool == pools_[Home()]) {
+          Magazine* m = ThreadMagazine();
+          std::lock_guard<std::mutex> guard(m->mutex_);
+          std::vector<nvAddr>& rounds = m->rounds_[level];
+          if (rounds.size() < Rounds(level)) {
+              pool->SetMap(ptr, -1);
+              rounds.push_back(ptr);
+              return;
+          }
+      }
+      pool->Dispose(ptr, size);
+  }
+  void NVM_NodeAllocator::Checkpoint() {
+      for (size_t p = 0; p < pools_.size(); ++p)
+          pools_[p]->Checkpoint();
+  }
+  bool NVM_NodeAllocator::Restore() {
+      for (size_t p = 0; p < pools_.size(); ++p)
+          if (!pools_[p]->Restore())
+              return false;
+      return true;
+  }
+  void NVM_NodeAllocator::Detach() {
+      for (size_t p = 0; p < pools_.size(); ++p)
+          pools_[p]->Detach();
+  }
+  void NVM_NodeAllocator::Print(int level) {
+      for (size_t p = 0; p < pools_.size(); ++p)
+          pools_[p]->Print(level);
+  }
 
 
   // When Allocator has no space, call master_->ALlocate to obtain a new page.
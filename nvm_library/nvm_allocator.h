@@ -9,114 +9,136 @@
 #include "nvm_directio_manager.h"
 #include <mutex>
 #include <unordered_map>
+#include <vector>
 #include <pthread.h>
 #include "nvm_manager.h"
 
 struct NVM_Manager;
 
-struct MemoryBlock {
-    byte level_;
-    nvAddr addr_offset_;
-    MemoryBlock() : level_(128), addr_offset_(0) {}
-    MemoryBlock(nvAddr addr) : level_(128), addr_offset_(addr) {}
-    MemoryBlock(byte level, nvAddr addr) : level_(level), addr_offset_(addr) {}
-    int compare(const MemoryBlock& b) const {
-        if (level_ != b.level_) return level_ < b.level_ ? -1:1;
-        if (addr_offset_ != b.addr_offset_) return addr_offset_ < b.addr_offset_ ? -1:1;
-        return 0;
-    }
-    std::string ToString() const {
-        static char buf[256] = {};
-        sprintf(buf,"(%d,%llx)",level_,addr_offset_);
-        return std::string(buf);
-    }
-};
-
-struct MemoryBlockComparator {
-  virtual int operator()(const MemoryBlock& a, const MemoryBlock& b) const {
-      return a.compare(b);
-  }
-};
-
-
+// The free blocks of [Begin, End), of 2^level bytes each.  Every level keeps
+// its free blocks in a list, and slot_ finds a block in the list of its
+// level, so that taking a block, splitting it and merging a freed one with
+// its buddy cost O(1) per level.
+//
+// If the pool has a page map, the region records there, for every Page of
+// [Begin, End), level + 1 of the allocated block starting at it and 0
+// elsewhere.  The map is written as blocks are taken and given back, and
+// Restore() rebuilds the free lists from it, after a crash too.  Without a
+// map they can only be restored from what Checkpoint() saved.
 struct NVM_BuddyAllocator : public NVM_Allocator {
-public:
-    typedef DynamicSkipList<MemoryBlock,MemoryBlockComparator> MemoryBlockTable;
 private:
-    //byte* main_;
-    //ull size_;
     NVM_MemoryBlock* main_blocks_;
-    MemoryBlockComparator cmp_;
-    DRAM_MainAllocator dram_allocator_;
-    MemoryBlockTable table_;
+    NVM_Manager* io_;
+    struct Slot {
+        byte level_;
+        size_t index_;
+    };
+    std::vector<std::vector<nvAddr> > free_;
+    std::unordered_map<nvAddr, Slot> slot_;
     std::mutex mutex_;
 
     const byte MaxLevel;
     const size_t Page;
-    const nvAddr BasicOffset;
+    const nvAddr Begin, End;
+    // Where Checkpoint() records its block: [Checkpoint 8][CheckpointLevel 8].
+    const nvAddr Record;
+    // The page map, nvnullptr if there is none.
+    const nvAddr Map;
+    // Block holding the free list saved by Checkpoint(), nvnullptr if the
+    // free list has changed since.
+    nvAddr checkpoint_;
+    byte checkpoint_level_;
     nvAddr Buddy(nvAddr addr, byte level) {
-        if (NV_PAGE(addr) == 0)
-            return ((addr - BasicOffset) ^ (1 << level)) + BasicOffset;
-        else
-            return addr ^ (1 << level);
+        return ((addr - Begin) ^ (1ULL << level)) + Begin;
+    }
+    void Push(byte level, nvAddr addr) {
+        Slot slot = { level, free_[level].size() };
+        slot_[addr] = slot;
+        free_[level].push_back(addr);
     }
+    // Take addr out of the free list of level, if it is there.
+    bool Remove(byte level, nvAddr addr) {
+        auto i = slot_.find(addr);
+        if (i == slot_.end() || i->second.level_ != level)
+            return false;
+        std::vector<nvAddr>& list = free_[level];
+        nvAddr last = list.back();
+        list[i->second.index_] = last;
+        slot_[last].index_ = i->second.index_;
+        list.pop_back();
+        slot_.erase(addr);
+        return true;
+    }
+    // Make [begin, end) free, in the largest blocks it is aligned to.
+    void Free(nvAddr begin, nvAddr end);
+    void DropCheckpoint_();
 public:
-    NVM_BuddyAllocator(const NVM_Options& option) :
-        //main_(option.main),
-        //size_(option.main_size),
+    // Manage [begin, end) of the region, with the page map at map unless it
+    // is nvnullptr.  If format is false the free list starts empty, and is
+    // expected to be loaded by Restore().
+    NVM_BuddyAllocator(const NVM_Options& option, NVM_Manager* io,
+                       nvAddr begin, nvAddr end, nvAddr record, nvAddr map, bool format) :
         main_blocks_(option.block),
-        // the first space of nvAddr records address of name_book.
-        // this is why nvAddr couldn't be zero, why zero is an invalid address.
-        cmp_(),
-        dram_allocator_(),
-        table_(cmp_,&dram_allocator_),
+        io_(io),
+        free_(option.max_level),
+        slot_(),
         MaxLevel(option.max_level),
         Page(option.page_size),
-        BasicOffset(option.basic_offset),
+        Begin(begin), End(end), Record(record), Map(map),
+        checkpoint_(nvnullptr), checkpoint_level_(0),
         Allocator()
     {
+        if (!format) return;
+        Free(Begin, End);
+    }
 
-        for (size_t block = 0; block < main_blocks_->block_num_; ++block) {
-            ull offset = block == 0 ? BasicOffset : 0;
-            byte* main_ = main_blocks_->block_[block].main_;
-            ull size_ = main_blocks_->block_[block].size_ - offset;
-            //ull page_part = (1ULL * block) << 32;
-            for (char l = log2_downfit(size_); l >= 0; l--) {
-                //printf("%d ",l);
-                ull i = pow2(1, l);
-                if (i & size_) {
-                    //ull check = basic_offset & (i-1);
-                    //assert(check == 0);
-                    table_.Insert(MemoryBlock(static_cast<byte>(l), reinterpret_cast<nvAddr>(main_ + offset)));
-                    offset += i;
-                }
-            }
-        }
+    // The bytes of the page map of [begin, end).
+    static ull MapBytes(nvAddr begin, nvAddr end, size_t page) { return (end - begin) / page; }
+
+    // Save the free list into NVM and record it at Record, so that Restore()
+    // can rebuild it after the region is mapped again.  The record is
+    // dropped by the next Allocate() or Dispose().  Not needed, and not
+    // done, with a page map.
+    void Checkpoint();
+    bool Restore();
+    // Stop maintaining the record and the page map, e.g. while the region
+    // is being unmapped.
+    void Detach() {
+        std::lock_guard<std::mutex> guard(mutex_);
+        checkpoint_ = nvnullptr;
+        io_ = nullptr;
     }
 
+    bool Contains(nvAddr addr) const { return Begin <= addr && addr < End; }
+    bool HasMap() const { return Map != nvnullptr; }
+    // Record in the page map that a block of level starts at addr, or with
+    // level < 0 that none does any more.  The block must be the caller's.
+    void SetMap(nvAddr addr, int level);
+
+    // nvnullptr if there is no free block large enough.
     virtual nvAddr Allocate(size_t size){
         assert(Page <= size);
+        byte level = log2_upfit(size);
         mutex_.lock();
-        nvAddr result = Allocate_(log2_upfit(size));
+        if (checkpoint_ != nvnullptr) DropCheckpoint_();
+        nvAddr result = Allocate_(level);
+        if (result != nvnullptr) SetMap(result, level);
         mutex_.unlock();
         return result;
     }
     nvAddr Allocate_(byte level){
-        if (level >= MaxLevel){
-            printf("Error : Space not enough in NVM-Buddy-Allocator.\n");
-            assert(false);
+        byte l = level;
+        while (l < MaxLevel && free_[l].empty())
+            ++l;
+        if (l >= MaxLevel)
             return nvnullptr;
+        nvAddr result = free_[l].back();
+        Remove(l, result);
+        // Give back the upper halves down to the level asked for.
+        while (l > level) {
+            --l;
+            Push(l, result + (1ULL << l));
         }
-        MemoryBlock user_key(level,nvnullptr);
-        MemoryBlockTable::Iterator iter(&table_);
-        iter.Seek(user_key);
-        if (!iter.Valid() || iter.key().level_ != level){
-            nvAddr high_block = Allocate_(level + 1);
-            table_.Insert(MemoryBlock(level, high_block + (1ULL<<level)));
-            return high_block;
-        }
-        nvAddr result = iter.key().addr_offset_;
-        table_.Delete(iter.key());
         return result;
     }
 
@@ -124,28 +146,28 @@ public:
         assert(ptr != nvnullptr && size > 0);
         byte level = log2_upfit(size);
         mutex_.lock();
+        if (checkpoint_ != nvnullptr) DropCheckpoint_();
+        SetMap(ptr, -1);
         Dispose_(ptr, level);
         mutex_.unlock();
     }
     void Dispose_(nvAddr ptr, byte level){
-        nvAddr buddy = Buddy(ptr,level);
-        //mutex_.lock();
-        if (table_.Delete(MemoryBlock(level,buddy)))
-            Dispose_((buddy < ptr ? buddy : ptr) , level + 1);
-            //table_.Insert(MemoryBlock(level+1,(buddy < ptr ? buddy : ptr)));
-        else
-            //assert(static_cast<int>(ptr & (pow2(1,level)-1)) == 0);
-            table_.Insert(MemoryBlock(level,ptr));
-        //mutex_.unlock();
+        while (level + 1 < MaxLevel) {
+            nvAddr buddy = Buddy(ptr, level);
+            if (!Remove(level, buddy))
+                break;
+            ptr = (buddy < ptr ? buddy : ptr);
+            ++level;
+        }
+        Push(level, ptr);
     }
 
     virtual void Print(int level = 0){
         printbyte(' ',level);printf("NVM Buddy Allocator:\n");
         printbyte(' ',level + 2);
-        MemoryBlockTable::Iterator iter(&table_);
-        for (iter.SeekToFirst();iter.Valid();iter.Next()) {
-            printf("%s,",iter.key().ToString().c_str());
-        }
+        for (byte l = 0; l < MaxLevel; ++l)
+            for (size_t i = 0; i < free_[l].size(); ++i)
+                printf("(%d,%llx),", l, free_[l][i]);
         printf("\n");
     }
 
@@ -154,6 +176,68 @@ public:
     void operator=(const NVM_BuddyAllocator&) = delete;
 };
 
+// The pages of the region, split into one NVM_BuddyAllocator per NUMA node
+// so that each has its own lock.  Allocate() takes from the pool of the
+// calling thread's NVM_Manager::HomeNode(), or else of the node it runs on,
+// and from the next ones once that pool is full.  Dispose() gives back to
+// the pool the address lies in.
+//
+// Regions formatted now give every pool a page map in its first pages.
+// Each thread then also keeps a magazine of the blocks of up to
+// kMagazineMaxLevel it gave back, and takes them again without locking a
+// pool; they count as free in the page map meanwhile.
+//
+// Regions formatted before page maps have no magazines.  Pool 0 of such a
+// region starts at basic_offset and records its checkpoint in the region
+// header, as the single pool always did; pool p > 0 records its own in its
+// first page.  The number of pools and whether they have page maps are kept
+// in the header when the region is formatted.
+struct NVM_NodeAllocator : public NVM_Allocator {
+private:
+    enum { kMagazineMaxLevel = 22, kMagazineRounds = 16 };
+    static const ull kMagazineBytes = 4ULL << 20;   // Per level and thread.
+    struct Magazine {
+        std::mutex mutex_;      // Its thread's, also taken by Drain().
+        std::vector<nvAddr> rounds_[kMagazineMaxLevel + 1];
+    };
+
+    NVM_Manager* io_;
+    const size_t Page;
+    std::vector<NVM_BuddyAllocator*> pools_;
+    bool page_maps_;
+    std::mutex magazines_mutex_;
+    std::unordered_map<pthread_t, Magazine*> magazines_;
+    const ull id_;      // Tells the allocators apart in ThreadMagazine().
+
+    size_t Home() const;
+    NVM_BuddyAllocator* PoolOf(nvAddr addr) const;
+    static size_t Rounds(byte level) {
+        ull n = kMagazineBytes >> level;
+        return n < 1 ? 1 : (n > kMagazineRounds ? kMagazineRounds : n);
+    }
+    Magazine* ThreadMagazine();
+    nvAddr AllocateFromPools(size_t size, size_t home);
+    // Give the blocks of every magazine back to their pools.
+    void Drain();
+public:
+    NVM_NodeAllocator(const NVM_Options& options, NVM_Manager* io, bool format);
+    virtual ~NVM_NodeAllocator();
+
+    virtual nvAddr Allocate(size_t size);
+    virtual void Dispose(nvAddr ptr, size_t size);
+    size_t Pools() const { return pools_.size(); }
+
+    void Checkpoint();
+    // False unless every pool has a page map or a checkpoint to load.
+    bool Restore();
+    void Detach();
+    virtual void Print(int level = 0);
+
+    // No copying allowed
+    NVM_NodeAllocator(const NVM_NodeAllocator&) = delete;
+    void operator=(const NVM_NodeAllocator&) = delete;
+};
+
 struct NVM_PuzzleAllocator : public NVM_Allocator {
 private:
     const size_t Page;
@@ -187,21 +271,21 @@ private:
     NVM_Manager * io_;
     const size_t Page;
     std::mutex mutex_;
-    NVM_BuddyAllocator * large_allocator_;
+    NVM_NodeAllocator * large_allocator_;
     //NVM_PuzzleAllocator * small_allocator_;
     std::unordered_map<pthread_t, NVM_PuzzleAllocator*> thread_allocator_;
     long long used_;
     long long rest_;
 public:
   // StandardAllocator is system allocator. it dispose and allocate by malloc()/free(), not by master.
-  NVM_MainAllocator(const NVM_Options& options, NVM_Manager * io) :
+  NVM_MainAllocator(const NVM_Options& options, NVM_Manager * io, bool format) :
       Allocator(),
       options_(options),io_(io),
       Page(options.page_size),
       mutex_(),
-      large_allocator_(new NVM_BuddyAllocator(options)),
+      large_allocator_(new NVM_NodeAllocator(options, io, format)),
       thread_allocator_(),
-      used_(0), rest_(options.block->Size() - 8)
+      used_(0), rest_(options.block->Size() - options.basic_offset)
       //small_allocator_(new NVM_PuzzleAllocator(large_allocator_, io, options))
   {}
   // When destoryed, Allocator return all pages to it's master.
@@ -221,11 +305,13 @@ public:
       //mutex_.lock();
       if (size < Page){
           pthread_t pid = pthread_self();
+          mutex_.lock();
           auto i = thread_allocator_.find(pid);
           if (i == thread_allocator_.end()){
               thread_allocator_[pid] = new NVM_PuzzleAllocator(large_allocator_, io_, options_);
               i = thread_allocator_.find(pid);
           }
+          mutex_.unlock();
           result = i->second->Allocate(size);
       }
           //result = small_allocator_->Allocate(size);
@@ -246,11 +332,13 @@ public:
       //mutex_.lock();
       if (size < Page){
           pthread_t pid = pthread_self();
+          mutex_.lock();
           auto i = thread_allocator_.find(pid);
           if (i == thread_allocator_.end()){
               thread_allocator_[pid] = new NVM_PuzzleAllocator(large_allocator_, io_, options_);
               i = thread_allocator_.find(pid);
           }
+          mutex_.unlock();
           i->second->Dispose(ptr, size);
       }
           //small_allocator_->Dispose(ptr, size);
@@ -263,6 +351,13 @@ public:
   }
 
   long long StorageUsage() const { return used_; }
+  size_t Pools() const { return large_allocator_->Pools(); }
+
+  // Only pages of the buddy allocator are recorded: the free slots of the
+  // puzzle allocators are lost when the region is mapped again.
+  void Checkpoint() { large_allocator_->Checkpoint(); }
+  bool Restore() { return large_allocator_->Restore(); }
+  void Detach() { large_allocator_->Detach(); }
 
   virtual void Print(int level = 0) {
       printbyte(' ',level);printf("Large Allocator:\n");
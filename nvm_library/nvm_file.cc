@@ -5,6 +5,8 @@ AbstractFile::~AbstractFile() {}
     nvAddr SkiplistFile::NewPage(nvOffset num) {
         nvAddr page = mng_->Allocate(SizePerBlock);
         blocks_.Add(num, page);
+        assert(num == extents_.size());
+        extents_.push_back(page);
         return page;
     }
 
@@ -20,6 +22,8 @@ AbstractFile::~AbstractFile() {}
         assert(false);
     }
     SkiplistFile::~SkiplistFile() {
+        if (detached_)
+            return;
         mng_->delete_name(file_name_);
         clear();
         // size = 0 but first page still exist.
@@ -29,13 +33,14 @@ AbstractFile::~AbstractFile() {}
         mng_(mng), fileinfo_(nvnullptr), blocks_(mng, BlockListSize), file_name_(""),
         last_page_(0), last_used_(FileInfoSize), last_block_(nvnullptr),
         read_page_(0), read_cursor_(FileInfoSize), read_block_(nvnullptr),
-        openType_(UNDEFINED), lock_(false), locker_(0)
+        openType_(UNDEFINED), lock_(false), locker_(0), detached_(false)
     {
         last_block_ = mng_->Allocate(SizePerBlock);
         fileinfo_ = last_block_;
         read_block_ = last_block_;
         blocks_.Add(0, fileinfo_);
-        mng_->write_addr(fileinfo_ + BlockListAddr, blocks_.Head());
+        extents_.push_back(fileinfo_);
+        mng_->write_addr(fileinfo_ + BlockListAddr, blocks_.Main());
         mng_->write_ull(fileinfo_ + LengthAddr, 0);
         //mng_->bind_name(filename, fileinfo_);
     }
@@ -43,30 +48,37 @@ AbstractFile::~AbstractFile() {}
         mng_(mng), fileinfo_(nvnullptr), blocks_(mng, BlockListSize), file_name_(filename),
         last_page_(0), last_used_(FileInfoSize), last_block_(nvnullptr),
         read_page_(0), read_cursor_(FileInfoSize), read_block_(nvnullptr),
-        openType_(UNDEFINED), lock_(false), locker_(0)
+        openType_(UNDEFINED), lock_(false), locker_(0), detached_(false)
     {
         last_block_ = mng_->Allocate(SizePerBlock);
         fileinfo_ = last_block_;
         read_block_ = last_block_;
         blocks_.Add(0, fileinfo_);
-        mng_->write_addr(fileinfo_ + BlockListAddr, blocks_.Head());
+        extents_.push_back(fileinfo_);
+        mng_->write_addr(fileinfo_ + BlockListAddr, blocks_.Main());
         mng_->write_ull(fileinfo_ + LengthAddr, 0);
         mng_->bind_name(filename, fileinfo_);
     }
     SkiplistFile::SkiplistFile(NVM_Manager *mng, nvAddr recover_address) :
-        mng_(mng), fileinfo_(nvnullptr), blocks_(mng, BlockListSize), file_name_(""),
+        mng_(mng), fileinfo_(recover_address),
+        blocks_(mng, mng->read_addr(recover_address + BlockListAddr), BlockListSize), file_name_(""),
         last_page_(0), last_used_(FileInfoSize), last_block_(nvnullptr),
-        read_page_(0), read_cursor_(FileInfoSize), read_block_(nvnullptr),
-        openType_(UNDEFINED), lock_(false), locker_(0)
+        read_page_(0), read_cursor_(FileInfoSize), read_block_(recover_address),
+        openType_(UNDEFINED), lock_(false), locker_(0), detached_(false)
     {
-        last_block_ = mng_->Allocate(SizePerBlock);
-        fileinfo_ = last_block_;
-        read_block_ = last_block_;
-        blocks_.Add(0, fileinfo_);
-        mng_->write_addr(fileinfo_ + BlockListAddr, blocks_.Head());
-        mng_->write_ull(fileinfo_ + LengthAddr, 0);
-        //mng_->bind_name(filename, fileinfo_);
-        assert( false ); // recover is not finished.
+        locate(mng_->read_ull(fileinfo_ + LengthAddr), &last_page_, &last_used_);
+        nvAddr block = nvnullptr;
+        nvOffset iter = blocks_.Get(0, &block);
+        for (nvOffset page = 0; page <= last_page_; ++page) {
+            assert(iter != nulloffset);
+            extents_.push_back(blocks_.IterGet(iter));
+            blocks_.IterNext(&iter);
+        }
+        last_block_ = extents_[last_page_];
+    }
+    void SkiplistFile::Detach() {
+        detached_ = true;
+        blocks_.Detach();
     }
     nvAddr SkiplistFile::location() {
         return fileinfo_;
@@ -158,9 +170,7 @@ AbstractFile::~AbstractFile() {}
 
         nvOffset page, offset;
         locate(from, &page, &offset);
-        nvAddr read_block = nvnullptr;
-        nvOffset iter = blocks_.Get(page, &read_block);
-        assert(iter != nulloffset);
+        nvAddr read_block = extents_[page];
 
         while (total_size > 0) {
             bool full = offset + total_size >= SizePerBlock;
@@ -170,15 +180,23 @@ AbstractFile::~AbstractFile() {}
             dest += size;
             offset += size;
             total_size -= size;
-            if (full) {
-                blocks_.IterNext(&iter);
-                assert(iter != nulloffset);
-                read_block = blocks_.IterGet(iter);
+            if (full && total_size > 0) {
+                read_block = extents_[++page];
                 offset = 0;
             }
         }
         return bytes;
     }      // read data from file.
+    bool SkiplistFile::slice(ull bytes, ull from, leveldb::Slice* result) {
+        if (!isReadable() || from + bytes > totalSize())
+            return false;
+        nvOffset page, offset;
+        locate(from, &page, &offset);
+        if (offset + bytes > SizePerBlock)
+            return false;
+        *result = mng_->GetSlice(extents_[page] + offset, bytes);
+        return true;
+    }
     ull SkiplistFile::read(char* dest, ull bytes) {
         ull from = readCursor();
         ull readin = read(reinterpret_cast<byte*>(dest), bytes, from);
@@ -212,6 +230,7 @@ AbstractFile::~AbstractFile() {}
         }
         last_page_ = page;
         last_used_ = used;
-        assert ( blocks_.Get(page, &last_block_)  != nulloffset );
+        extents_.resize(page + 1);
+        last_block_ = extents_[page];
     }
 
@@ -310,16 +310,30 @@ public:
             nvAddr main_;
             nvOffset total_size_, rest_size_;
             nvOffset node_bound_;
+            bool detached_;
 
             Allocator(NVM_Manager* mng, ul size) :
                 mng_(mng),
                 main_(mng->Allocate(size)),
                 total_size_(size), rest_size_(size),
-                node_bound_(0)
+                node_bound_(0), detached_(false)
+            {
+            }
+            // Attach to an arena left in NVM; SetBound() must follow.
+            Allocator(NVM_Manager* mng, nvAddr main, ul size) :
+                mng_(mng),
+                main_(main),
+                total_size_(size), rest_size_(0),
+                node_bound_(size), detached_(false)
             {
             }
             ~Allocator() {
-                mng_->Dispose(main_, total_size_);
+                if (!detached_)
+                    mng_->Dispose(main_, total_size_);
+            }
+            void SetBound(nvOffset bound) {
+                node_bound_ = bound;
+                rest_size_ = total_size_ - bound;
             }
             nvOffset AllocateNode(nvOffset size) {
                 if (size > rest_size_) return nulloffset;
@@ -374,7 +388,7 @@ public:
             mng_->write_addr(mem() + x + AddrOffset, addr);
         }
         byte GetHeight(nvOffset x) const {
-            mng_->read_byte(mem() + x + HeightOffset);
+            return mng_->read_byte(mem() + x + HeightOffset);
         }
         nvOffset GetNum(nvOffset x) const {
             return mng_->read_ul(mem() + x + NumOffset);
@@ -432,6 +446,20 @@ public:
             for (byte i = 0; i < kMaxHeight; ++i)
                 SetNext(head_, i, nulloffset);
         }
+        // Recover the index whose arena is at main: every node ever added
+        // stays linked on level 0, so the walk finds the arena bound.
+        FileBlockIndexSkiplist(NVM_Manager* mng, nvAddr main, size_t size)
+            : mng_(mng), arena_(mng, main, size), head_(0), max_height_(1), rnd_(0xDEADBEEF) {
+            nvOffset bound = NextOffset + 4 * kMaxHeight;
+            for (nvOffset x = GetNext(head_, 0); x != nulloffset; x = GetNext(x, 0)) {
+                byte height = GetHeight(x);
+                if (height > max_height_)
+                    max_height_ = height;
+                if (x + NextOffset + 4 * height > bound)
+                    bound = x + NextOffset + 4 * height;
+            }
+            arena_.SetBound(bound);
+        }
         virtual ~FileBlockIndexSkiplist() {}
 
       // An iterator is either positioned at a key/value pair, or
@@ -502,6 +530,8 @@ public:
           return GetAddr(iter);
       }
       nvOffset Head() const { return head_; }
+      nvAddr Main() const { return arena_.Main(); }
+      void Detach() { arena_.detached_ = true; }
       ull StorageUsage() const {
           return arena_.StorageUsage();
       }
@@ -524,6 +554,8 @@ public:
       void operator=(const FileBlockIndexSkiplist&) = delete;
     };
     FileBlockIndexSkiplist blocks_;
+    // DRAM copy of blocks_: extents_[n] is the block holding page n.
+    vector<nvAddr> extents_;
     //ull total_size_;
     std::string file_name_;
 
@@ -536,6 +568,7 @@ public:
     OpenType openType_;
     bool lock_;
     pid_t locker_;
+    bool detached_;
 
     static const uint32_t SizePerBlock = 1 * MB;
     static const uint32_t BlockListSize = 20 * 4 * KB;   // Max File Size = 4000 * 1MB = 4GB
@@ -555,6 +588,8 @@ public:
     SkiplistFile(NVM_Manager *mng);
     SkiplistFile(NVM_Manager *mng, const std::string& filename);
     SkiplistFile(NVM_Manager *mng, nvAddr main_address); // recover.
+    // Leave the file in NVM when this object is deleted.
+    void Detach();
 
     nvAddr location();
     string name();                  // get file name
@@ -579,6 +614,9 @@ public:
     ull append(const char* data, ull bytes);
     ull read(byte* dest, ull bytes, ull from);
     ull read(char* dest, ull bytes);
+    // Point *result at [from, from + bytes) in NVM without copying.
+    // Fails if the range is past the end or crosses a block boundary.
+    bool slice(ull bytes, ull from, leveldb::Slice* result);
     void clear();
     void print();
 private:
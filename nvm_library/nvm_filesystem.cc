@@ -1,22 +1,54 @@
 #include "nvm_filesystem.h"
+#include "nvtrie.h"
+
+const char* FakeFS::IndexName = "/index/fakefs.nvTrie";
 
 FakeFS::FakeFS(NVM_Manager * mng) :
     mng_(mng),
     dict_(),
-    info_(new nvFile*[MAX_FILE_COUNT]),
-    id_(1LL) {
+    info_(),
+    id_(1LL),
+    index_(nullptr) {
+    info_[0] = new nvFile*[FilesPerChunk]();
+    nvAddr index = mng_->find_name(IndexName);
+    if (index == nvnullptr) {
+        index_ = new nvTrie(mng_);
+        mng_->bind_name(IndexName, index_->main_);
+        return;
+    }
+    index_ = new nvTrie(mng_, index);
+    index_->ForEach([this](const string& name, nvAddr location) {
+        ull file_id = NewId();
+        slot(file_id) = new nvFile(mng_, location);
+        slot(file_id)->setName(name);
+        dict_[name] = file_id;
+    });
     }
 FakeFS::~FakeFS() {
-    for (ull i = 1;i < id_; ++i) if (info_[i] != nullptr){
-        delete info_[i];
+    // Files in a persistent region outlive this process.
+    bool keep = mng_->main_block_->Persistent();
+    for (ull i = 1;i < id_; ++i) if (slot(i) != nullptr){
+        if (keep)
+            slot(i)->Detach();
+        delete slot(i);
     }
     dict_.clear();
-    delete[] info_;
+    for (ull c = 0; c * FilesPerChunk < id_; ++c)
+        delete[] info_[c];
+    delete index_;
 }
 
 nvFile& FakeFS::refer(ull id){
-    return *(info_[id]);
-    //return info_.at(id);
+    return *slot(id);
+}
+
+ull FakeFS::NewId(){
+    assert(id_ < MAX_FILE_COUNT);
+    ull id = id_;
+    if (id % FilesPerChunk == 0)
+        info_[id / FilesPerChunk] = new nvFile*[FilesPerChunk]();
+    id_ ++;
+    return id;
 }
 
 bool FakeFS::checkFile(const std::string& fname){
@@ -24,28 +56,27 @@ bool FakeFS::checkFile(const std::string& fname){
 }
 
 bool FakeFS::checkFile(ull file_id){
-    return (file_id < id_ && info_[file_id] != nullptr);
-    //return info_.find(file_id) != info_.end();
+    return (file_id < id_ && slot(file_id) != nullptr);
 }
 
 ull FakeFS::newFile(const char* file_name){
     if (checkFile(file_name)){
         deleteFile(dict_[file_name]);
     }
-    ull file_id = id_;
-    id_ ++;
-    info_[file_id] = new nvFile(mng_);
+    ull file_id = NewId();
+    slot(file_id) = new nvFile(mng_);
     dict_[file_name] = file_id;
-    info_[file_id]->setName(file_name);
+    slot(file_id)->setName(file_name);
+    index_->Insert(file_name, slot(file_id)->location());
     return file_id;
 }
 
 bool FakeFS::deleteFile(ull id){
     if (!checkFile(id)) return 0;
-    dict_.erase(info_[id]->name());
-    delete info_[id];
-    info_[id] = nullptr;
-    //info_.erase(id);
+    dict_.erase(slot(id)->name());
+    index_->Delete(slot(id)->name());
+    delete slot(id);
+    slot(id) = nullptr;
     return 1;
     /*
     if (!checkFile(id)) return 0;
@@ -73,9 +104,14 @@ int FakeFS::rename(const char *oldname, const char *newname){
     auto i = dict_.find(oldname);
     if (i == dict_.end()) return -1;
     ull id = i->second;
+    auto j = dict_.find(newname);
+    if (j != dict_.end() && j->second != id)
+        deleteFile(j->second);
     refer(id).setName(newname);
     dict_.erase(oldname);
+    index_->Delete(oldname);
     dict_[newname] = id;
+    index_->Insert(newname, refer(id).location());
     //info_[id].setName(newname);
     return 0;
 }
@@ -154,18 +190,18 @@ nvFileHandle FakeFS::fopen(const char * file_name, const char* mode){
     case 'w':
         if (id != NO_FILE) deleteFile(id);
         id = newFile(file_name);
-        info_[id]->openType_ = nvFile::WRITE_ONLY;
+        slot(id)->openType_ = nvFile::WRITE_ONLY;
         break;
     case 'r':
         if (id == NO_FILE) return NO_FILE;
-        info_[id]->openType_ = nvFile::READ_ONLY;
-        info_[id]->setReadCursor(0);
+        slot(id)->openType_ = nvFile::READ_ONLY;
+        slot(id)->setReadCursor(0);
         break;
     case 'a':
-        info_[id]->openType_ = nvFile::WRITE_APPEND;
+        slot(id)->openType_ = nvFile::WRITE_APPEND;
         break;
     default:
-        info_[id]->openType_ = nvFile::UNDEFINED;
+        slot(id)->openType_ = nvFile::UNDEFINED;
         break;
     }
     return id;
@@ -173,7 +209,7 @@ nvFileHandle FakeFS::fopen(const char * file_name, const char* mode){
 
 int FakeFS::fclose(nvFileHandle stream){
     if (!checkFile(stream)) return -1;
-    info_[stream]->setReadCursor(0);
+    slot(stream)->setReadCursor(0);
     return 0;
 }
 
@@ -183,7 +219,7 @@ int FakeFS::fseek(nvFileHandle stream, long offset, int whence){
     // read only. do not use it for write file, it's not supported.
     switch(whence){
     case SEEK_CUR:
-        a = info_[stream]->readCursor();
+        a = slot(stream)->readCursor();
         break;
     case SEEK_SET:
         a = 0;
@@ -198,7 +234,7 @@ int FakeFS::fseek(nvFileHandle stream, long offset, int whence){
     if (a < 0) a = 0;
     if (a > l) a = l;
     //if (a < 0 || a > fileSize(stream)) return -1;
-    info_[stream]->setReadCursor(a);
+    slot(stream)->setReadCursor(a);
     return 0;
 }
 ul FakeFS::fread_ulkd(void *ptr, ull size, ull count, nvFileHandle stream){
@@ -225,8 +261,8 @@ int FakeFS::AddChildren(const std::string& dir,vector<string>* result){
 }
 void FakeFS::print(){
     printf("Print FakeFS (%llu) \n",id_);
-    for (ull i = 1; i < id_; ++i) if (info_[i] != nullptr){
+    for (ull i = 1; i < id_; ++i) if (slot(i) != nullptr){
         printf("ID = %llu:\n",i);
-        info_[i]->print();
+        slot(i)->print();
     }
 }
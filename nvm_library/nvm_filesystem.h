@@ -3,10 +3,10 @@
 #include "nvfile.h"
 #include <string>
 #include <vector>
-#include <map>
+#include <unordered_map>
 using std::string;
 using std::vector;
-using std::map;
+using std::unordered_map;
 
 /* FakeFS: Fake File System, to provide c-like file management function.
  * it keeps information including "file name", "file id", and other file info that nvfile contains.
@@ -15,22 +15,31 @@ using std::map;
  */
 struct NVM_Manager;
 struct nvFile;
+struct nvTrie;
 using std::string;
 using std::vector;
 struct FakeFS {
     NVM_Manager *mng_;
     static const byte DEFAULT_FILE_LEVEL = 22;
     static const ull MAX_FILE_COUNT = 4000000;
-    map<string, ull> dict_;
-    //map<ull, nvFile> info_;
-    nvFile** info_;
+    // File slots are allocated FilesPerChunk at a time as ids are handed
+    // out, so a slot never moves while readers may be looking at it.
+    static const ull FilesPerChunk = 4096;
+    unordered_map<string, ull> dict_;
+    nvFile** info_[MAX_FILE_COUNT / FilesPerChunk + 1];
     ull id_;
+    // Persistent directory, file name -> file location, bound to IndexName
+    // so that the files are found again when the region is reopened.
+    nvTrie* index_;
+    static const char* IndexName;
 
     FakeFS() = delete;
     FakeFS(NVM_Manager * mng);
     ~FakeFS();
 
     nvFile& refer(ull id);
+    nvFile*& slot(ull id) { return info_[id / FilesPerChunk][id % FilesPerChunk]; }
+    ull NewId();
     bool checkFile(const std::string& fname);
     bool checkFile(ull file_id);
     ull newFile(const char* file_name);
@@ -94,6 +94,10 @@ struct /*NVM_Library_Simulator : public*/ NVM_Library {
     NVM_Library(ull size) :
         mng_(new NVM_Manager(size)),
         nvmfs_(new FakeFS(mng_)) {}
+    // Use a region mapped by sys_nvm_map().
+    NVM_Library(NVM_MemoryBlock* block) :
+        mng_(new NVM_Manager(block)),
+        nvmfs_(new FakeFS(mng_)) {}
     ~NVM_Library(){
         delete nvmfs_;
         delete mng_;
@@ -127,7 +131,7 @@ struct /*NVM_Library_Simulator : public*/ NVM_Library {
     }
     inline int LockOrUnlock(int fd, bool lock){
         nvFileHandle file = static_cast<ull>(fd);
-        if (nvmfs_->info_[file]->setLock(lock))
+        if (nvmfs_->refer(file).setLock(lock))
             return 0;
         else
             return -1;
@@ -154,6 +158,11 @@ struct /*NVM_Library_Simulator : public*/ NVM_Library {
         return nvmfs_->refer(stream).read(
                     reinterpret_cast<byte*>(ptr),count,offset);
     }
+    // Like readWithOffset, but point *result into NVM instead of copying.
+    // Returns false if the range is not stored contiguously.
+    inline bool sliceWithOffset(ull count, ull offset, nvFileHandle stream, leveldb::Slice* result){
+        return nvmfs_->refer(stream).slice(count,offset,result);
+    }
 
     inline int fseek(nvFileHandle stream, long offset, int whence){
         return nvmfs_->fseek(stream,offset,whence);
@@ -2,26 +2,53 @@
 #include "nvtrie.h"
 
 NVM_Manager::NVM_Manager(size_t size) :
-    main_block_(sys_nvm_allocate(size,RecoverFunction)),
+    NVM_Manager(sys_nvm_allocate(size,RecoverFunction))
+{
+}
+
+NVM_Manager::NVM_Manager(NVM_MemoryBlock* block) :
+    main_block_(block),
     options_(main_block_),
     memory_(nullptr),
     //guardian_(new NVM_Guardian(&io_, memory_)),
     index_(nullptr),
     w_delay(options_.write_delay_per_cache_line), r_delay(options_.read_delay_per_cache_line),
     cache_line(options_.cache_line_size), bandwidth(options_.bandwidth / 1000000000), // (byte/s) -> (byte/ns)
-    w_opbase(bandwidth * w_delay), r_opbase(bandwidth * r_delay)
+    w_opbase(bandwidth * w_delay), r_opbase(bandwidth * r_delay),
+    flush_type_(options_.flush_type)
 {
-    memory_ = new NVM_MainAllocator(options_, this);
+    if (main_block_->reopened_ &&
+            read_ull(MagicOffset) == kMagic && read_ull(SizeOffset) == main_block_->Size()) {
+        memory_ = new NVM_MainAllocator(options_, this, false);
+        if (memory_->Restore()) {
+            index_ = new nvTrie(this, read_addr(NameBookAddress()));
+            return;
+        }
+        // Without page maps, and not checkpointed since its last change:
+        // nothing in it can be trusted, so start over.
+        fprintf(stderr, "NVM region was not checkpointed, formatting it.\n");
+        delete memory_;
+    }
+    write_zero(0, options_.basic_offset);
+    memory_ = new NVM_MainAllocator(options_, this, true);
     index_ = new nvTrie(this);
+    write_addr(NameBookAddress(), index_->main_);
 //    index_->openType_ = nvFile::READ_WRITE;
     //bind_name("GUARDIAN",guardian_->Address());
     bind_name("/index/index.nvTrie", index_->main_);
-
+    write_ull(SizeOffset, main_block_->Size());
+    write_ull_barrier(MagicOffset, kMagic);
 }
 
 NVM_Manager::~NVM_Manager() {
     delete index_;
 
+    if (main_block_->Persistent()) {
+        // Keep the state of the region for the next time it is mapped; what
+        // the allocators give back from here on is not recorded.
+        Checkpoint();
+        memory_->Detach();
+    }
     delete memory_;
 
     main_block_->Dispose();
@@ -29,21 +56,25 @@ NVM_Manager::~NVM_Manager() {
     //delete [] main_;
 }
 
+void NVM_Manager::Checkpoint() {
+    if (!main_block_->Persistent()) return;
+    memory_->Checkpoint();
+    main_block_->Sync();
+}
+
 int NVM_Manager::bind_name(std::string name, nvAddr addr){
-    std::string s;
-    s += name;
-    s += '\t';
-    s += std::to_string(addr);
-    s += '\n';
-    //index_->Insert(name, addr);
-//    byte* info = new byte[s.size()];
-//    sprintf((char*)info,"%s",s.c_str())
-//    index_->append(s.c_str(), s.size());
+    std::lock_guard<std::mutex> guard(index_mutex_);
+    index_->Insert(name, addr);
     return 0;
 }
 int NVM_Manager::delete_name(std::string name) {
-    //index_->Delete(name);
-    //return bind_name(name,nvnullptr);
+    std::lock_guard<std::mutex> guard(index_mutex_);
+    index_->Delete(name);
+    return 0;
+}
+nvAddr NVM_Manager::find_name(std::string name) {
+    std::lock_guard<std::mutex> guard(index_mutex_);
+    return index_->Find(name);
 }
 // 4. debug function
 void NVM_Manager::Print(){
@@ -56,3 +87,15 @@ nvAddr NVM_Manager::Allocate(size_t size) {
 void NVM_Manager::Dispose(nvAddr ptr, size_t size) {
     memory_->Dispose(ptr,size);
 }
+
+static __thread int home_node = -1;
+
+int NVM_Manager::Nodes() const {
+    return static_cast<int>(memory_->Pools());
+}
+int NVM_Manager::HomeNode() {
+    return home_node;
+}
+void NVM_Manager::SetHomeNode(int node) {
+    home_node = node;
+}
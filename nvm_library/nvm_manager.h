@@ -11,6 +11,7 @@
 #include "sysnvm.h"
 #include "port/atomic_pointer.h"
 #include "leveldb/slice.h"
+#include <mutex>
 //#include "nvtrie.h"
 
 struct nvFile;
@@ -26,10 +27,12 @@ public:
     NVM_MainAllocator *memory_;
     //nvFile* index_;
     nvTrie* index_;
+    std::mutex index_mutex_;
 
     const ull w_delay, r_delay;
     const ull cache_line, bandwidth;
     const ull w_opbase, r_opbase;
+    const NVM_FlushType flush_type_;
     struct ThreadInfo {
         nvAddr last_cache_line_;
         ull rest_;
@@ -38,11 +41,40 @@ public:
     };
     std::unordered_map<pid_t, ThreadInfo> info_;
 
+    // The first basic_offset bytes of the region:
+    // [NameBook 8][Magic 8][Size 8][Checkpoint 8][CheckpointLevel 8][Pools 8]
+    // [PageMaps 8]
+    // Pools is 0 in regions formatted before it was recorded, with one pool,
+    // and PageMaps is 0 in those formatted before the pools had page maps.
+    enum HeaderOffset {
+        NameBookOffset = 0, MagicOffset = 8, SizeOffset = 16,
+        CheckpointOffset = 24, CheckpointLevelOffset = 32, PoolsOffset = 40,
+        PageMapsOffset = 48, HeaderSize = 56
+    };
+    static const ull kMagic = 0x6e6f69676552766eULL;    // "nvRegion"
+
     static void RecoverFunction(byte* main) {}
     NVM_Manager(size_t size);
+    // Take over block.  A persistent block that was checkpointed before is
+    // reopened with its allocator state and name book, otherwise it is
+    // formatted.
+    NVM_Manager(NVM_MemoryBlock* block);
 
     ~NVM_Manager();
 // 1. IO Management
+    // Write back every cache line of [dest, dest + bytes).  With clwb and
+    // clflushopt this is not ordered with later stores until Fence(), so a
+    // caller may persist several pieces and order them all with one fence.
+    inline void Persist(const byte* dest, ull bytes) {
+        if (flush_type_ == kFlushNone || bytes == 0) return;
+        const uintptr_t end = reinterpret_cast<uintptr_t>(dest) + bytes;
+        for (uintptr_t p = reinterpret_cast<uintptr_t>(dest) & ~(cache_line - 1); p < end; p += cache_line)
+            nvm_flush_line(flush_type_, reinterpret_cast<const void*>(p));
+    }
+    // Order all earlier Persist()ed writes before any later write.
+    inline void Fence() {
+        nvm_fence(flush_type_);
+    }
     inline void readDelay(ull operation, nvAddr addr) {
         static __thread ull rest = 0;
         static __thread ull prev = 0;
@@ -91,33 +123,37 @@ public:
     inline void read(byte* dest, nvAddr src, ull bytes){
 #ifndef NO_READ_DELAY
         readDelay(bytes, src);
-        memcpy(dest, main_block_->Decode(src), bytes);
-#else
-        memcpy(dest, reinterpret_cast<byte*>(src), bytes);
 #endif
+        memcpy(dest, main_block_->Decode(src), bytes);
         //assert(dest != nullptr && src != nvnullptr);
         //return dest;
     }
 
+    // Start loading the cache lines of [src, src + bytes).  The reads that
+    // follow are still charged their read delay.
+    inline void Prefetch(nvAddr src, ull bytes) {
+        const uintptr_t begin = reinterpret_cast<uintptr_t>(main_block_->Decode(src));
+        for (uintptr_t p = begin & ~(cache_line - 1); p < begin + bytes; p += cache_line)
+            __builtin_prefetch(reinterpret_cast<const void*>(p));
+    }
+
     inline leveldb::Slice GetSlice(nvAddr src, ull bytes) {
 #ifndef NO_READ_DELAY
         readDelay(bytes, src);
-        return leveldb::Slice(reinterpret_cast<const char*>(main_block_->Decode(src)), bytes);
-#else
-        return leveldb::Slice(reinterpret_cast<const char*>(src), bytes);
 #endif
+        return leveldb::Slice(reinterpret_cast<const char*>(main_block_->Decode(src)), bytes);
     }
     inline void write(nvAddr dest, const byte* src, ull bytes){
         //assert(dest != nvnullptr && src != nullptr);
         byte* dest_ = reinterpret_cast<byte*>(main_block_->Decode(dest));
         writeDelay(bytes, dest);
         memcpy(dest_, src, bytes);
-        asm_clflush(dest_);
+        Persist(dest_, bytes);
 
         //return dest;
     }
     inline void write_barrier(nvAddr dest, const byte* src, ull bytes){
-        leveldb::port::MemoryBarrier();
+        Fence();
         write(dest, src, bytes);
     }
     inline nvAddr write_zero(nvAddr dest, ull bytes){
@@ -125,7 +161,8 @@ public:
         byte* dest_ = reinterpret_cast<byte*>(main_block_->Decode(dest));
         //writeDelay(bytes, dest);
         memset(dest_, 0, bytes);
-        asm_clflush(dest_);
+        Persist(dest_, bytes);
+        return dest;
     }
     /*
     inline nvAddr nvmcpy(nvAddr dest, nvAddr src, ull bytes){
@@ -138,10 +175,8 @@ public:
     inline ull read_ull(nvAddr src){
 #ifndef NO_READ_DELAY
         readDelay(8, src);
-        return *reinterpret_cast<ull*>(main_block_->Decode(src));
-#else
-        return *reinterpret_cast<ull*>(src);
 #endif
+        return *reinterpret_cast<ull*>(main_block_->Decode(src));
     }
     inline ull read_ull_barrier(nvAddr src) {
         leveldb::port::MemoryBarrier();
@@ -158,62 +193,94 @@ public:
     inline uint32_t read_ul(nvAddr src){
 #ifndef NO_READ_DELAY
         readDelay(4, src);
-        return *reinterpret_cast<ul*>(main_block_->Decode(src));
-#else
-        return *reinterpret_cast<ul*>(src);
 #endif
+        return *reinterpret_cast<ul*>(main_block_->Decode(src));
     }
     inline byte read_byte(nvAddr src) {
 #ifndef NO_READ_DELAY
         readDelay(1, src);
-        return *reinterpret_cast<byte*>(main_block_->Decode(src));
-#else
-        return *reinterpret_cast<byte*>(src);
 #endif
+        return *reinterpret_cast<byte*>(main_block_->Decode(src));
     }
     inline void write_ul(nvAddr dest, const uint32_t number){
         byte* dest_ = reinterpret_cast<byte*>(main_block_->Decode(dest));
         *reinterpret_cast<ul*>(main_block_->Decode(dest)) = number;
         writeDelay(4, dest);
-        asm_clflush(dest_);
+        Persist(dest_, 4);
     }
     inline nvAddr read_addr(nvAddr src){
 #ifndef NO_READ_DELAY
         readDelay(8, src);
-        return *reinterpret_cast<nvAddr*>(main_block_->Decode(src));
-#else
-        return *reinterpret_cast<nvAddr*>(src);
 #endif
+        return *reinterpret_cast<nvAddr*>(main_block_->Decode(src));
     }
     inline void write_ull(nvAddr dest, const ull number){
         byte* dest_ = reinterpret_cast<byte*>(main_block_->Decode(dest));
         *reinterpret_cast<ull*>(main_block_->Decode(dest)) = number;
         writeDelay(8, dest);
-        asm_clflush(dest_);
+        Persist(dest_, 8);
     }
     inline void write_ull_barrier(nvAddr dest, const ull number) {
-        leveldb::port::MemoryBarrier();
+        Fence();
         write_ull(dest, number);
     }
     inline void write_ul_barrier(nvAddr dest, const ul number) {
-        leveldb::port::MemoryBarrier();
+        Fence();
         write_ul(dest, number);
     }
     inline void write_addr(nvAddr dest, const nvAddr addr) {
         writeDelay(8, dest);
         byte* dest_ = reinterpret_cast<byte*>(main_block_->Decode(dest));
         *reinterpret_cast<nvAddr*>(main_block_->Decode(dest)) = addr;
-        asm_clflush(dest_);
+        Persist(dest_, 8);
+    }
+    // Atomically replace the 4-byte word at dest with number if it still
+    // holds expected.  Used to publish links with several writers.
+    inline bool cas_ul(nvAddr dest, const ul expected, const ul number) {
+        byte* dest_ = reinterpret_cast<byte*>(main_block_->Decode(dest));
+        writeDelay(4, dest);
+        if (!__sync_bool_compare_and_swap(reinterpret_cast<ul*>(dest_), expected, number))
+            return false;
+        Persist(dest_, 4);
+        return true;
+    }
+    // Atomically store number at dest and return the previous word.
+    inline ul exchange_ul(nvAddr dest, const ul number) {
+        byte* dest_ = reinterpret_cast<byte*>(main_block_->Decode(dest));
+        writeDelay(4, dest);
+        ul old = __sync_lock_test_and_set(reinterpret_cast<ul*>(dest_), number);
+        Persist(dest_, 4);
+        return old;
     }
 
 // 2. allocate and dispose
     nvAddr Allocate(size_t size);
     void Dispose(nvAddr ptr, size_t size);
+    // The NUMA nodes the region is split over, one allocation pool each.
+    int Nodes() const;
+    // The node whose pool Allocate() uses on the calling thread; -1, the
+    // default, stands for the node the thread runs on.
+    static int HomeNode();
+    static void SetHomeNode(int node);
+    // Make node the home node of the calling thread while it lives.
+    struct NodeScope {
+        int prev_;
+        explicit NodeScope(int node) : prev_(HomeNode()) { SetHomeNode(node); }
+        ~NodeScope() { SetHomeNode(prev_); }
+    };
 
 
 // 3. bind "name" with "address"
+    // Names live in a nvTrie (the name book) whose address is kept in the
+    // first basic_offset bytes of the region, so that the owners of named
+    // objects can find them again after the region is reopened.
     int bind_name(std::string name, nvAddr addr);
     int delete_name(std::string name);
+    nvAddr find_name(std::string name);
+    nvAddr NameBookAddress() const { return NameBookOffset; }
+    // Record the allocator state in the region and write it back, so that it
+    // can be reopened from here.  Cheap if nothing changed since the last one.
+    void Checkpoint();
 // 4. debug function
     void Print();
 // 5. old-type function
@@ -44,6 +44,15 @@ struct NVM_Options {
   ull cache_line_size;
   ull bandwidth;
 
+  // How writes are persisted.
+  // Default: sys_nvm_flush_type()
+  NVM_FlushType flush_type;
+
+  // How many pools the region is split into when it is formatted, pool p
+  // taking its pages from NUMA node p.
+  // Default: sys_nvm_nodes()
+  int numa_nodes;
+
   // Create an Options object with default values for all fields.
   NVM_Options(NVM_MemoryBlock* memblock);
 };
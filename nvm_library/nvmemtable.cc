@@ -14,6 +14,31 @@ nvOffset nvMemTable::FindNode(const Slice& key) {
 void nvMemTable::Update(nvOffset node, SequenceNumber seq, ValueType type, const Slice& value) {
     assert(false);
 }
+bool nvMemTable::PersistentInfo(nvAddr* main, ull* main_size, nvAddr* aux, ull* aux_size) {
+    return false;
+}
+void nvMemTable::Detach() {
+}
+bool nvMemTable::ConcurrentAdd() const {
+    return false;
+}
+bool nvMemTable::Get(const LookupKey& key, PinnableSlice* value, Status* s) {
+    if (!Get(key, value->GetSelf(), s))
+        return false;
+    value->PinSelf();
+    return true;
+}
+void nvMemTable::MultiGet(KeyContext* keys, size_t n) {
+    for (size_t i = 0; i < n; ++i)
+        keys[i].found = Get(*keys[i].key, keys[i].value, keys[i].s);
+}
+bool nvMemTable::GarbageCollectionStep(ull budget) {
+    GarbageCollection();
+    return true;
+}
+bool nvMemTable::GarbageCollectionBlocked() const {
+    return false;
+}
 
 /*
 const L2MemTable::DefaultComparator L2MemTable::cmp_;
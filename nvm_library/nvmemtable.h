@@ -1,6 +1,7 @@
 #ifndef NVMEMTABLE_H
 #define NVMEMTABLE_H
 #include "leveldb/options.h"
+#include "leveldb/pinnable_slice.h"
 #include "nvm_manager.h"
 #include "db/dbformat.h"
 #include "db/memtable.h"
@@ -31,11 +32,24 @@ struct nvMemTable : AbstractMemTable {
              const Slice& key,
              const Slice& value) = 0;
     virtual bool Get(const LookupKey& key, std::string* value, Status* s) = 0;
-
+    // As above, but *value may refer to the value inside this table, which
+    // then holds a reference until value->Reset().  The caller keeps the
+    // table alive for the call.  The default copies.
+    virtual bool Get(const LookupKey& key, PinnableSlice* value, Status* s);
+    // Get() for keys[0,n-1], sorted by user key and all in this table's
+    // range; sets found as Get() returns.  The default calls Get().
+    virtual void MultiGet(KeyContext* keys, size_t n);
 
     virtual nvOffset FindNode(const Slice& key);
     virtual void Update(nvOffset node, SequenceNumber seq, ValueType type, const Slice& value);
 
+    // Where the NVM image of this memtable lives, so that nvMultiTableRoot
+    // can rebuild it after a restart.  Returns false if the type can not be
+    // recovered.
+    virtual bool PersistentInfo(nvAddr* main, ull* main_size, nvAddr* aux, ull* aux_size);
+    // Keep the NVM image when this object is destroyed (clean shutdown).
+    virtual void Detach();
+
     virtual bool Immutable() const = 0;
     virtual void SetImmutable(bool state) = 0;
     virtual ull StorageUsage() const = 0;
@@ -46,6 +60,9 @@ struct nvMemTable : AbstractMemTable {
     virtual ull LowerStorage() const = 0;
 
     virtual bool HasRoomFor(ull size) const = 0;
+    // Whether Add() may run under SharedLock(), several writers at once.
+    // Freezing a full table still takes Lock().
+    virtual bool ConcurrentAdd() const;
     virtual bool HasRoomForWrite(const Slice& key, const Slice& value, bool nearly_full) = 0;
     virtual bool PreWrite(const Slice& key, const Slice& value, bool nearly_full) = 0;
 
@@ -69,6 +86,14 @@ struct nvMemTable : AbstractMemTable {
 
     virtual void Connect(nvMemTable* b, bool reverse) = 0;
     virtual void GarbageCollection() = 0;
+    // Part of GarbageCollection() that moves about budget bytes, so that
+    // writers may add between the steps; true once the collection is done
+    // or blocked.  The caller holds Lock().
+    virtual bool GarbageCollectionStep(ull budget);
+    // Whether a collection that has started waits for readers that may
+    // hold values it freed, so that it would free nothing now.  The default
+    // is false.
+    virtual bool GarbageCollectionBlocked() const;
     virtual double Garbage() const = 0;
 
     virtual std::string& LeftBound() = 0;
@@ -83,6 +83,8 @@ struct nvTrie {
             }
             t = hash;
         }
+        if (pos != nullptr)
+            *pos = l;
         return t;
     }
     nvAddr Find(const string& key) {
@@ -129,7 +131,8 @@ struct nvTrie {
             SetChild(key[0],nvnullptr);
             mng_->write_addr(main_ + ChildNumOffset, --childNum);
         }
-        return childNum == 0;
+        // A node that still holds data must stay, even without children.
+        return childNum == 0 && Data() == nvnullptr;
     }
     void Delete(const string& key) {
         if (key.size() == 0)
@@ -138,7 +141,34 @@ struct nvTrie {
         if (next == nvnullptr)
             return;
         nvTrie child_(mng_, next);
-        child_.Delete_(key.data() + 1);
+        if (child_.Delete_(key.data() + 1)) {
+            byte childNum = ChildNum();
+            mng_->Dispose(child_.main_, TotalLength);
+            SetChild(key[0],nvnullptr);
+            mng_->write_addr(main_ + ChildNumOffset, --childNum);
+        }
+    }
+
+    // Call f(key, data) for every key that holds data.
+    template <typename Function>
+    void ForEach(Function f) {
+        ForEach_(string(), f);
+    }
+    template <typename Function>
+    void ForEach_(const string& key, Function& f) {
+        nvAddr d = Data();
+        if (d != nvnullptr)
+            f(key, d);
+        for (int h = 0; h < 16; ++h) {
+            nvAddr hash = mng_->read_addr(main_ + HashOffset + h * 8);
+            if (hash == nvnullptr) continue;
+            for (int l = 0; l < 16; ++l) {
+                nvAddr n = mng_->read_addr(hash + l * 8);
+                if (n == nvnullptr) continue;
+                nvTrie child(mng_, n);
+                child.ForEach_(key + static_cast<char>(h << 4 | l), f);
+            }
+        }
     }
 
     void Print(const string& key) {
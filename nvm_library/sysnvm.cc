@@ -1,4 +1,21 @@
 #include "sysnvm.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
+#ifdef LEVELDB_NUMA
+#include <numa.h>
+#include <numaif.h>
+#include <sched.h>
+#endif
+
+#ifndef MAP_SHARED_VALIDATE
+#define MAP_SHARED_VALIDATE 0x03
+#endif
 
 struct ArxAllocator {
     typedef void* (*ArxMallocFunction)(uint32_t, uint64_t);
@@ -47,7 +64,92 @@ struct ArxAllocator {
     }
 };
 
+static NVM_FlushType DetectFlushType() {
+    const char* env = getenv("LEVELDB_NVM_FLUSH");
+    if (env != nullptr) {
+        if (strcmp(env, "none") == 0) return kFlushNone;
+        if (strcmp(env, "clflush") == 0) return kFlushClflush;
+        if (strcmp(env, "clflushopt") == 0) return kFlushClflushopt;
+        if (strcmp(env, "clwb") == 0) return kFlushClwb;
+    }
+#if defined(__x86_64__) || defined(__i386__)
+    unsigned int eax, ebx, ecx, edx;
+    if (__get_cpuid_max(0, nullptr) >= 7) {
+        __cpuid_count(7, 0, eax, ebx, ecx, edx);
+        if (ebx & (1u << 24)) return kFlushClwb;
+        if (ebx & (1u << 23)) return kFlushClflushopt;
+    }
+    if (__get_cpuid(1, &eax, &ebx, &ecx, &edx) && (edx & (1u << 19)))
+        return kFlushClflush;
+#endif
+    return kFlushNone;
+}
+
+NVM_FlushType sys_nvm_flush_type() {
+    static const NVM_FlushType type = DetectFlushType();
+    return type;
+}
+
+static int DetectNodes() {
+    const char* env = getenv("LEVELDB_NVM_NODES");
+    if (env != nullptr && atoi(env) > 0)
+        return atoi(env);
+#ifdef LEVELDB_NUMA
+    if (numa_available() >= 0)
+        return numa_num_configured_nodes();
+#endif
+    return 1;
+}
+
+int sys_nvm_nodes() {
+    static const int nodes = DetectNodes();
+    return nodes;
+}
+
+void sys_nvm_bind(void* addr, ull size, int node) {
+#ifdef LEVELDB_NUMA
+    if (numa_available() < 0) return;
+    node %= numa_num_configured_nodes();
+    // mbind() takes whole pages: leave the partial ones at the ends alone.
+    const uintptr_t page = sysconf(_SC_PAGESIZE);
+    uintptr_t begin = (reinterpret_cast<uintptr_t>(addr) + page - 1) & ~(page - 1);
+    uintptr_t end = (reinterpret_cast<uintptr_t>(addr) + size) & ~(page - 1);
+    if (begin >= end) return;
+    unsigned long mask = 1UL << node;
+    mbind(reinterpret_cast<void*>(begin), end - begin, MPOL_PREFERRED, &mask, sizeof(mask) * 8, 0);
+#endif
+}
+
+void sys_nvm_run_on_node(int node) {
+#ifdef LEVELDB_NUMA
+    if (numa_available() < 0) return;
+    numa_run_on_node(node % numa_num_configured_nodes());
+#endif
+}
+
+int sys_nvm_current_node() {
+#ifdef LEVELDB_NUMA
+    if (numa_available() >= 0) {
+        int cpu = sched_getcpu();
+        if (cpu >= 0)
+            return numa_node_of_cpu(cpu);
+    }
+#endif
+    return 0;
+}
+
+void NVM_MemoryBlock::Sync() {
+    if (sync_)
+        msync(global_.main_, global_.size_, MS_SYNC);
+}
+
 void sys_nvm_dispose(NVM_MemoryBlock* block) {
+    if (block->Persistent()) {
+        block->Sync();
+        munmap(block->Main(), block->Size());
+        close(block->fd_);
+        return;
+    }
 #ifdef NVDIMM_ENABLED
     ArxAllocator *arc = new ArxAllocator;
     arc->main_ = block->Main();
@@ -55,8 +157,7 @@ void sys_nvm_dispose(NVM_MemoryBlock* block) {
     arc->DisposeAll();
     delete arc;
 #else
-    for (int i = 0; i < block->block_num_; ++i)
-        delete[] block->block_[i].main_;
+    delete[] block->Main();
 #endif
 }
 
@@ -78,16 +179,63 @@ NVM_MemoryBlock* sys_nvm_allocate(ull size, Cleaner cl) {
     blocks[0].main_ = arc->main_;
     blocks[0].size_ = arc->length_;
 #else
-    size_t block_num = size / MaxBlockSize;
-    size_t rest = size % MaxBlockSize;
-    block_num += (rest > 0);
+    size_t block_num = 1;
     NVM_MemoryBlock::MemoryBlock* blocks = new NVM_MemoryBlock::MemoryBlock[block_num];
-    for (size_t i = 0; i < block_num; ++i) {
-        blocks[i].size_ = ((i == block_num - 1 && rest > 0) ? rest : MaxBlockSize);
-        blocks[i].main_ = new byte[blocks[i].size_];
-    }
+    blocks[0].size_ = size;
+    blocks[0].main_ = new byte[size];
 #endif
     return new NVM_MemoryBlock(blocks, block_num);
     //return static_cast<byte*>(malloc(size));
 }
 
+NVM_MemoryBlock* sys_nvm_map(const char* fname, ull size) {
+    int fd = open(fname, O_RDWR | O_CREAT, 0644);
+    if (fd < 0)
+        return nullptr;
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        int e = errno;
+        close(fd);
+        errno = e;
+        return nullptr;
+    }
+    bool reopened = st.st_size > 0;
+    if (reopened) {
+        size = st.st_size;
+    } else {
+        // Reserve the blocks now, so that a page fault can never fail for
+        // lack of space; fall back to a sparse file where unsupported.
+        int r = posix_fallocate(fd, 0, size);
+        if (r != 0 && ftruncate(fd, size) != 0) {
+            int e = errno;
+            close(fd);
+            errno = e;
+            return nullptr;
+        }
+    }
+    bool sync = false;
+    void* main = MAP_FAILED;
+#ifdef MAP_SYNC
+    main = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED_VALIDATE | MAP_SYNC, fd, 0);
+#endif
+    if (main == MAP_FAILED) {
+        // Not a DAX file system: stores reach the file only through msync().
+        sync = true;
+        main = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    if (main == MAP_FAILED) {
+        int e = errno;
+        close(fd);
+        errno = e;
+        return nullptr;
+    }
+    NVM_MemoryBlock::MemoryBlock* blocks = new NVM_MemoryBlock::MemoryBlock[1];
+    blocks[0].main_ = static_cast<byte*>(main);
+    blocks[0].size_ = size;
+    NVM_MemoryBlock* block = new NVM_MemoryBlock(blocks, 1);
+    block->fd_ = fd;
+    block->reopened_ = reopened;
+    block->sync_ = sync;
+    return block;
+}
+
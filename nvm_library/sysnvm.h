@@ -18,6 +18,29 @@ struct NVM_MemoryBlock;
 
 void sys_nvm_dispose(NVM_MemoryBlock* block);
 NVM_MemoryBlock* sys_nvm_allocate(ull size, Cleaner cl);
+// Map fname as the NVM region.  An existing file is mapped with its own
+// size, otherwise it is created with size bytes.  MAP_SYNC is used where the
+// file system supports DAX, else an ordinary shared mapping that is written
+// back by msync().  Returns nullptr and sets errno on failure.
+NVM_MemoryBlock* sys_nvm_map(const char* fname, ull size);
+
+// The flush primitive this process persists NVM writes with: the best one
+// the CPU supports (clwb, then clflushopt, then clflush), picked once.
+// Setting LEVELDB_NVM_FLUSH to none, clflush, clflushopt or clwb overrides
+// it, none being for DRAM emulation.
+NVM_FlushType sys_nvm_flush_type();
+
+// The number of NUMA nodes the region is spread over, one allocation pool
+// each: the nodes of the machine if built with libnuma, else 1.  Setting
+// LEVELDB_NVM_NODES overrides it, e.g. to try several pools on one node;
+// pool p then lives on node p modulo the nodes there are.
+int sys_nvm_nodes();
+// Place the pages of [addr, addr + size) on node, where the kernel can.
+void sys_nvm_bind(void* addr, ull size, int node);
+// Run the calling thread on the CPUs of node only.
+void sys_nvm_run_on_node(int node);
+// The node the calling thread runs on now.
+int sys_nvm_current_node();
 
 struct NVM_MemoryBlock {
     struct MemoryBlock {
@@ -29,28 +52,34 @@ struct NVM_MemoryBlock {
     MemoryBlock *block_;
     //byte** block_;
     size_t block_num_;
+    // Set by sys_nvm_map(): the backing file, whether it already existed,
+    // and whether stores need msync() to reach it (no MAP_SYNC).
+    int fd_;
+    bool reopened_;
+    bool sync_;
 
     MemoryBlock global_;
     ull Size() const { return global_.size_; }
     byte* Main() const { return global_.main_; }
 //    ull size_;
   NVM_MemoryBlock(MemoryBlock* block, size_t block_num)
-      : block_(block), block_num_(block_num), global_(nullptr, 0)
+      : block_(block), block_num_(block_num), fd_(-1), reopened_(false), sync_(false),
+        global_(block[0].main_, block[0].size_)
   {
-      global_.main_ = block_[0].main_;
-      global_.size_ = block_[0].size_;
-#ifdef NVDIMM_ENABLED
+      // nvAddr is an offset from Main(), so the region must be contiguous.
       assert(block_num_ == 1);
-#endif
-      for (ull i = 0; i < block_num; ++i)
-          global_.size_ += block_[i].size_;
   }
+  // nvAddr is relative to the start of the region, so that what is stored
+  // in NVM stays valid when the region is mapped at another address.
   inline void* operator[] (nvAddr addr) {
-      return reinterpret_cast<byte*>(addr);
+      return global_.main_ + addr;
   }
   inline void* Decode(nvAddr addr) {
-      return reinterpret_cast<byte*>(addr);
+      return global_.main_ + addr;
   }
+  bool Persistent() const { return fd_ >= 0; }
+  // Write back the whole region if the mapping is not synchronous.
+  void Sync();
   void Dispose() {
       sys_nvm_dispose(this);
       delete [] block_;
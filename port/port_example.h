@@ -122,6 +122,21 @@ extern bool Snappy_GetUncompressedLength(const char* input, size_t length,
 extern bool Snappy_Uncompress(const char* input_data, size_t input_length,
                               char* output);
 
+// The same three functions for LZ4 and for Zstandard.  The compress
+// functions return false if the codec is not supported by this port.
+extern bool LZ4_Compress(const char* input, size_t input_length,
+                         std::string* output);
+extern bool LZ4_GetUncompressedLength(const char* input, size_t length,
+                                      size_t* result);
+extern bool LZ4_Uncompress(const char* input_data, size_t input_length,
+                           char* output);
+extern bool Zstd_Compress(const char* input, size_t input_length,
+                          std::string* output);
+extern bool Zstd_GetUncompressedLength(const char* input, size_t length,
+                                       size_t* result);
+extern bool Zstd_Uncompress(const char* input_data, size_t input_length,
+                            char* output);
+
 // ------------------ Miscellaneous -------------------
 
 // If heap profiling is not supported, returns false.
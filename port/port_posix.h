@@ -42,6 +42,12 @@
 #ifdef SNAPPY
 #include <snappy.h>
 #endif
+#ifdef LZ4
+#include <lz4.h>
+#endif
+#ifdef ZSTD
+#include <zstd.h>
+#endif
 #include <stdint.h>
 #include <string>
 #include "port/atomic_pointer.h"
@@ -162,6 +168,104 @@ inline bool Snappy_Uncompress(const char* input, size_t length,
 #endif
 }
 
+// LZ4 blocks do not record their size, so a fixed32 little-endian prefix
+// holds the uncompressed length.
+inline bool LZ4_Compress(const char* input, size_t length,
+                         ::std::string* output) {
+#ifdef LZ4
+  if (length > static_cast<size_t>(LZ4_MAX_INPUT_SIZE)) {
+    return false;
+  }
+  output->resize(4 + LZ4_compressBound(static_cast<int>(length)));
+  for (int i = 0; i < 4; i++) {
+    (*output)[i] = static_cast<char>(length >> (8 * i));
+  }
+  int outlen = LZ4_compress_default(input, &(*output)[4],
+                                    static_cast<int>(length),
+                                    static_cast<int>(output->size() - 4));
+  if (outlen <= 0) {
+    return false;
+  }
+  output->resize(4 + outlen);
+  return true;
+#endif
+
+  return false;
+}
+
+inline bool LZ4_GetUncompressedLength(const char* input, size_t length,
+                                      size_t* result) {
+#ifdef LZ4
+  if (length < 4) {
+    return false;
+  }
+  const unsigned char* p = reinterpret_cast<const unsigned char*>(input);
+  *result = static_cast<size_t>(p[0]) | (static_cast<size_t>(p[1]) << 8) |
+            (static_cast<size_t>(p[2]) << 16) |
+            (static_cast<size_t>(p[3]) << 24);
+  return true;
+#else
+  return false;
+#endif
+}
+
+inline bool LZ4_Uncompress(const char* input, size_t length, char* output) {
+#ifdef LZ4
+  size_t ulength;
+  if (!LZ4_GetUncompressedLength(input, length, &ulength)) {
+    return false;
+  }
+  int r = LZ4_decompress_safe(input + 4, output, static_cast<int>(length - 4),
+                              static_cast<int>(ulength));
+  return r >= 0 && static_cast<size_t>(r) == ulength;
+#else
+  return false;
+#endif
+}
+
+inline bool Zstd_Compress(const char* input, size_t length,
+                          ::std::string* output) {
+#ifdef ZSTD
+  output->resize(ZSTD_compressBound(length));
+  size_t outlen = ZSTD_compress(&(*output)[0], output->size(), input, length,
+                                ZSTD_CLEVEL_DEFAULT);
+  if (ZSTD_isError(outlen)) {
+    return false;
+  }
+  output->resize(outlen);
+  return true;
+#endif
+
+  return false;
+}
+
+inline bool Zstd_GetUncompressedLength(const char* input, size_t length,
+                                       size_t* result) {
+#ifdef ZSTD
+  unsigned long long size = ZSTD_getFrameContentSize(input, length);
+  if (size == ZSTD_CONTENTSIZE_UNKNOWN || size == ZSTD_CONTENTSIZE_ERROR) {
+    return false;
+  }
+  *result = static_cast<size_t>(size);
+  return true;
+#else
+  return false;
+#endif
+}
+
+inline bool Zstd_Uncompress(const char* input, size_t length, char* output) {
+#ifdef ZSTD
+  size_t ulength;
+  if (!Zstd_GetUncompressedLength(input, length, &ulength)) {
+    return false;
+  }
+  size_t r = ZSTD_decompress(output, ulength, input, length);
+  return !ZSTD_isError(r) && r == ulength;
+#else
+  return false;
+#endif
+}
+
 inline bool GetHeapProfile(void (*func)(void*, const char*, int), void* arg) {
   return false;
 }
@@ -62,6 +62,93 @@ static inline bool HaveSSE42() {
 #endif
 }
 
+#if defined(_M_X64) || defined(__x86_64__)
+
+// The crc32 instruction has a latency of three cycles but a throughput of
+// one per cycle, so long buffers are cut into three streams that are
+// checksummed side by side and then combined.  Combining a stream's crc
+// with the next one means appending that many zero bytes to it, which is
+// a linear map over GF(2) applied here through byte-wise tables.
+static const size_t kLongStream = 1024;
+static const size_t kShortStream = 128;
+static const uint32_t kPoly = 0x82f63b78;  // Reflected CRC-32C polynomial.
+
+static uint32_t long_zeros[4][256];
+static uint32_t short_zeros[4][256];
+
+static uint32_t MatrixTimes(const uint32_t* mat, uint32_t vec) {
+  uint32_t sum = 0;
+  for (; vec; vec >>= 1, mat++) {
+    if (vec & 1) {
+      sum ^= *mat;
+    }
+  }
+  return sum;
+}
+
+static void MatrixSquare(uint32_t* square, const uint32_t* mat) {
+  for (int n = 0; n < 32; n++) {
+    square[n] = MatrixTimes(mat, mat[n]);
+  }
+}
+
+// Fill zeros[][] with the operator that appends len zero bytes to a crc.
+// len must be a power of two.
+static void BuildZeros(uint32_t zeros[][256], size_t len) {
+  uint32_t even[32], odd[32];
+  odd[0] = kPoly;  // Operator for one zero bit.
+  for (int n = 1; n < 32; n++) {
+    odd[n] = 1u << (n - 1);
+  }
+  MatrixSquare(even, odd);  // Two zero bits.
+  MatrixSquare(odd, even);  // Four zero bits.
+  uint32_t* op = odd;
+  for (size_t bits = len * 8; bits > 4; bits >>= 1) {
+    uint32_t* next = (op == odd) ? even : odd;
+    MatrixSquare(next, op);
+    op = next;
+  }
+  for (uint32_t n = 0; n < 256; n++) {
+    zeros[0][n] = MatrixTimes(op, n);
+    zeros[1][n] = MatrixTimes(op, n << 8);
+    zeros[2][n] = MatrixTimes(op, n << 16);
+    zeros[3][n] = MatrixTimes(op, n << 24);
+  }
+}
+
+static bool BuildZeroTables() {
+  BuildZeros(long_zeros, kLongStream);
+  BuildZeros(short_zeros, kShortStream);
+  return true;
+}
+
+static inline uint32_t Shift(uint32_t zeros[][256], uint32_t crc) {
+  return zeros[0][crc & 0xff] ^ zeros[1][(crc >> 8) & 0xff] ^
+         zeros[2][(crc >> 16) & 0xff] ^ zeros[3][crc >> 24];
+}
+
+// Process three streams of len bytes at a time while 3 * len bytes remain.
+static inline const uint8_t* ThreeWay(uint32_t* crc, const uint8_t* p,
+                                      const uint8_t* e, size_t len,
+                                      uint32_t zeros[][256]) {
+  uint64_t l0 = *crc;
+  while (static_cast<size_t>(e - p) >= 3 * len) {
+    uint64_t l1 = 0, l2 = 0;
+    for (const uint8_t* end = p + len; p < end; p += 8) {
+      l0 = _mm_crc32_u64(l0, LE_LOAD64(p));
+      l1 = _mm_crc32_u64(l1, LE_LOAD64(p + len));
+      l2 = _mm_crc32_u64(l2, LE_LOAD64(p + 2 * len));
+    }
+    l0 = Shift(zeros, static_cast<uint32_t>(l0)) ^ l1;
+    l0 = Shift(zeros, static_cast<uint32_t>(l0)) ^ l2;
+    p += 2 * len;
+  }
+  *crc = static_cast<uint32_t>(l0);
+  return p;
+}
+
+#endif  // defined(_M_X64) || defined(__x86_64__)
+
 #endif  // defined(LEVELDB_PLATFORM_POSIX_SSE)
 
 // For further improvements see Intel publication at:
@@ -99,6 +186,12 @@ uint32_t AcceleratedCRC32C(uint32_t crc, const char* buf, size_t size) {
 
     // _mm_crc32_u64 is only available on x64.
 #if defined(_M_X64) || defined(__x86_64__)
+    if (static_cast<size_t>(e-p) >= 3 * kShortStream) {
+      static bool tables = BuildZeroTables();
+      (void)tables;
+      p = ThreeWay(&l, p, e, kLongStream, long_zeros);
+      p = ThreeWay(&l, p, e, kShortStream, short_zeros);
+    }
     // Process 8 bytes at a time
     while ((e-p) >= 8) {
       STEP8;
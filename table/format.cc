@@ -62,6 +62,34 @@ Status Footer::DecodeFrom(Slice* input) {
   return result;
 }
 
+static bool GetUncompressedLength(CompressionType type, const char* input,
+                                  size_t length, size_t* result) {
+  switch (type) {
+    case kSnappyCompression:
+      return port::Snappy_GetUncompressedLength(input, length, result);
+    case kLZ4Compression:
+      return port::LZ4_GetUncompressedLength(input, length, result);
+    case kZstdCompression:
+      return port::Zstd_GetUncompressedLength(input, length, result);
+    default:
+      return false;
+  }
+}
+
+static bool Uncompress(CompressionType type, const char* input,
+                       size_t length, char* output) {
+  switch (type) {
+    case kSnappyCompression:
+      return port::Snappy_Uncompress(input, length, output);
+    case kLZ4Compression:
+      return port::LZ4_Uncompress(input, length, output);
+    case kZstdCompression:
+      return port::Zstd_Uncompress(input, length, output);
+    default:
+      return false;
+  }
+}
+
 Status ReadBlock(RandomAccessFile* file,
                  const ReadOptions& options,
                  const BlockHandle& handle,
@@ -115,14 +143,17 @@ Status ReadBlock(RandomAccessFile* file,
 
       // Ok
       break;
-    case kSnappyCompression: {
+    case kSnappyCompression:
+    case kLZ4Compression:
+    case kZstdCompression: {
+      const CompressionType type = static_cast<CompressionType>(data[n]);
       size_t ulength = 0;
-      if (!port::Snappy_GetUncompressedLength(data, n, &ulength)) {
+      if (!GetUncompressedLength(type, data, n, &ulength)) {
         delete[] buf;
         return Status::Corruption("corrupted compressed block contents");
       }
       char* ubuf = new char[ulength];
-      if (!port::Snappy_Uncompress(data, n, ubuf)) {
+      if (!Uncompress(type, data, n, ubuf)) {
         delete[] buf;
         delete[] ubuf;
         return Status::Corruption("corrupted compressed block contents");
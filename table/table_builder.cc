@@ -17,6 +17,22 @@
 
 namespace leveldb {
 
+// Store the compression of raw by the given codec in *output.  Returns
+// false if the codec is not supported by this build.
+static bool Compress(CompressionType type, const Slice& raw,
+                     std::string* output) {
+  switch (type) {
+    case kSnappyCompression:
+      return port::Snappy_Compress(raw.data(), raw.size(), output);
+    case kLZ4Compression:
+      return port::LZ4_Compress(raw.data(), raw.size(), output);
+    case kZstdCompression:
+      return port::Zstd_Compress(raw.data(), raw.size(), output);
+    default:
+      return false;
+  }
+}
+
 struct TableBuilder::Rep {
   Options options;
   Options index_block_options;
@@ -147,19 +163,18 @@ void TableBuilder::WriteBlock(BlockBuilder* block, BlockHandle* handle) {
 
   Slice block_contents;
   CompressionType type = r->options.compression;
-  // TODO(postrelease): Support more compression options: zlib?
   switch (type) {
     case kNoCompression:
       block_contents = raw;
       break;
 
-    case kSnappyCompression: {
+    default: {
       std::string* compressed = &r->compressed_output;
-      if (port::Snappy_Compress(raw.data(), raw.size(), compressed) &&
+      if (Compress(type, raw, compressed) &&
           compressed->size() < raw.size() - (raw.size() / 8u)) {
         block_contents = *compressed;
       } else {
-        // Snappy not supported, or compressed less than 12.5%, so just
+        // Codec not supported, or compressed less than 12.5%, so just
         // store uncompressed form
         block_contents = raw;
         type = kNoCompression;
@@ -301,7 +301,10 @@ uint32_t Extend(uint32_t crc, const char* buf, size_t size) {
   if (accelerate) {
     return port::AcceleratedCRC32C(crc, buf, size);
   }
+  return PortableExtend(crc, buf, size);
+}
 
+uint32_t PortableExtend(uint32_t crc, const char* buf, size_t size) {
   const uint8_t *p = reinterpret_cast<const uint8_t *>(buf);
   const uint8_t *e = p + size;
   uint32_t l = crc ^ 0xffffffffu;
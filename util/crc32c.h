@@ -16,6 +16,10 @@ namespace crc32c {
 // crc32c of a stream of data.
 extern uint32_t Extend(uint32_t init_crc, const char* data, size_t n);
 
+// Extend() without the hardware accelerated path, even where the CPU
+// has one.  For benchmarks and tests.
+extern uint32_t PortableExtend(uint32_t init_crc, const char* data, size_t n);
+
 // Return the crc32c of data[0,n-1]
 inline uint32_t Value(const char* data, size_t n) {
   return Extend(0, data, n);
@@ -56,6 +56,25 @@ TEST(CRC, Extend) {
             Extend(Value("hello ", 6), "world", 5));
 }
 
+TEST(CRC, MatchesPortable) {
+  // Cover the accelerated path's interleaved streams, its byte and word
+  // tails, and every start alignment.
+  std::string data;
+  for (int i = 0; i < 20000; i++) {
+    data.push_back(static_cast<char>(i * 131 + (i >> 7)));
+  }
+  for (size_t n = 0; n < data.size() - 8; n = n * 5 / 4 + 1) {
+    for (size_t off = 0; off < 8; off++) {
+      ASSERT_EQ(PortableExtend(0x12345678, data.data() + off, n),
+                Extend(0x12345678, data.data() + off, n));
+    }
+  }
+  for (size_t n = 3 * 128 - 16; n < 3 * 1024 + 16; n++) {
+    ASSERT_EQ(PortableExtend(0, data.data() + 3, n),
+              Extend(0, data.data() + 3, n));
+  }
+}
+
 TEST(CRC, Mask) {
   uint32_t crc = Value("foo", 3);
   ASSERT_NE(crc, Mask(crc));
@@ -11,6 +11,10 @@ Env::~Env() {
 
 NVM_Library* NVM_Env() { return nullptr; }
 
+Status Env::UseNVMFile(const std::string& fname, uint64_t size) {
+  return Status::NotSupported("UseNVMFile", fname);
+}
+
 Status Env::NewAppendableFile(const std::string& fname, WritableFile** result) {
   return Status::NotSupported("NewAppendableFile", fname);
 }
@@ -323,7 +323,12 @@ class NvramSequentialFile: public SequentialFile {
     return Status::OK();
   }
 };
-// mmap() based random-access
+// NVM based random-access.  Like PosixMmapReadableFile, reads return
+// slices that point into NVM, so ReadBlock() neither copies nor caches
+// the blocks.  Only a read that crosses a file block boundary is copied.
+// NewRandomAccessFile() comes here for files that exist in NVM, but only
+// MANIFEST files are created there (NewWritableNVMFile()): table files are
+// still read through PosixRandomAccessFile or PosixMmapReadableFile.
 class NvramReadableFile: public RandomAccessFile {
  private:
   nvFileHandle f_;
@@ -332,7 +337,6 @@ class NvramReadableFile: public RandomAccessFile {
   std::string filename_;
 
  public:
-  // base[0,length-1] contains the mmapped contents of the file.
   NvramReadableFile(nvFileHandle f, NVM_Library* lib, const std::string& filename)
       : f_(f), lib_(lib), length_(lib->fileSize(f)), filename_(filename) {
   }
@@ -347,11 +351,9 @@ class NvramReadableFile: public RandomAccessFile {
     if (offset + n > length_) {
       *result = Slice();
       s = IOError(filename_, EINVAL);
-    } else {
-      //nvlib->fseek(f,offset,SEEK_SET);
-      //nvlib->fread(str,1,n,f);
+    } else if (!lib_->sliceWithOffset(n, offset, f_, result)) {
       ul r = lib_->readWithOffset(scratch, n, offset, f_);
-      *result = Slice(scratch, (r < 0 ? 0 : r));
+      *result = Slice(scratch, r);
     }
     return s;
   }
@@ -443,24 +445,59 @@ class PosixLockTable {
 
 class PosixEnv : public Env {
 private:
-  NVM_Library* nvlib;
+  // Created by the first NVM_Env() or UseNVMFile(), whichever comes first.
+  port::AtomicPointer nvlib_;
+  port::Mutex nvlib_mu_;
+  std::string nvm_file_;      // Guarded by nvlib_mu_
  public:
   PosixEnv();
   virtual ~PosixEnv() {
     char msg[] = "Destroying Env::Default()\n";
     fwrite(msg, 1, sizeof(msg), stderr);
-    delete nvlib;
+    delete reinterpret_cast<NVM_Library*>(nvlib_.NoBarrier_Load());
     abort();
   }
 
   NVM_Library* NVM_Env() {
-      return nvlib;
+    NVM_Library* lib = reinterpret_cast<NVM_Library*>(nvlib_.Acquire_Load());
+    if (lib == NULL) {
+      MutexLock l(&nvlib_mu_);
+      lib = reinterpret_cast<NVM_Library*>(nvlib_.NoBarrier_Load());
+      if (lib == NULL) {
+#ifdef NVDIMM_ENABLED
+        lib = new NVM_Library(32ULL * GB);
+#else
+        lib = new NVM_Library(1500ULL * MB);
+#endif
+        nvlib_.Release_Store(lib);
+      }
+    }
+    return lib;
+  }
+
+  virtual Status UseNVMFile(const std::string& fname, uint64_t size) {
+    MutexLock l(&nvlib_mu_);
+    if (nvlib_.NoBarrier_Load() != NULL) {
+      if (nvm_file_ == fname) {
+        return Status::OK();
+      }
+      return Status::InvalidArgument(
+          fname, "NVM region is already in use, backed by " +
+                 (nvm_file_.empty() ? std::string("anonymous memory") : nvm_file_));
+    }
+    NVM_MemoryBlock* block = sys_nvm_map(fname.c_str(), size);
+    if (block == NULL) {
+      return IOError(fname, errno);
+    }
+    nvm_file_ = fname;
+    nvlib_.Release_Store(new NVM_Library(block));
+    return Status::OK();
   }
   virtual Status NewSequentialFile(const std::string& fname,
                                    SequentialFile** result) {
     debugf("HDD SEQ : [%s]\n",fname.c_str());
 #ifdef NVM_FILE_ENABLED_1
-      if (nvlib->fileExist(fname)){
+      if (NVM_Env()->fileExist(fname)){
         return NewSequentialNVMFile(fname,result);
       }
 #endif
@@ -477,13 +514,13 @@ private:
   virtual Status NewSequentialNVMFile(const std::string& fname,
                                    SequentialFile** result) {
     debugf("NVM SEQ : [%s]\n",fname.c_str());
-    nvFileHandle f = nvlib->fopen(fname.c_str(), "r");
+    nvFileHandle f = NVM_Env()->fopen(fname.c_str(), "r");
     //nvlib->print();
     if (f == NO_FILE) {
       *result = NULL;
       return IOError(fname, errno);
     } else {
-      *result = new NvramSequentialFile(fname, f, nvlib);
+      *result = new NvramSequentialFile(fname, f, NVM_Env());
       return Status::OK();
     }
   }
@@ -494,7 +531,7 @@ private:
     *result = NULL;
     Status s;
 #ifdef NVM_FILE_ENABLED_1
-      if (nvlib->fileExist(fname)){
+      if (NVM_Env()->fileExist(fname)){
         return NewRandomAccessNVMFile(fname,result);
       }
 #endif
@@ -525,18 +562,18 @@ private:
                                      RandomAccessFile** result) {
       debugf("NVM RAND: [%s]\n",fname.c_str());
       Status s;
-      nvFileHandle f = nvlib->fopen(fname.c_str(),"r");
+      nvFileHandle f = NVM_Env()->fopen(fname.c_str(),"r");
       if (f == NO_FILE) {
           return IOError(fname, errno);
       }
-      *result = new NvramReadableFile(f, nvlib, fname);
+      *result = new NvramReadableFile(f, NVM_Env(), fname);
       return s;
   }
 
   virtual Status NewWritableFile(const std::string& fname,
                                  WritableFile** result) {
 #ifdef NVM_FILE_ENABLED_1
-    if (nvlib->remove(fname.c_str()))
+    if (NVM_Env()->remove(fname.c_str()))
         debugf("NVM DEL by CREATE HDD WRT FILE : [%s]\n",fname.c_str());
 #endif
     debugf("HDD WRT: [%s]\n",fname.c_str());
@@ -555,13 +592,13 @@ private:
                                  WritableFile** result) {
       debugf("NVM WRT: [%s]\n",fname.c_str());
       Status s;
-      nvFileHandle  f = nvlib->fopen(fname.c_str(), "w");
+      nvFileHandle  f = NVM_Env()->fopen(fname.c_str(), "w");
       //FILE* f = fopen(fname.c_str(), "w");
       if (f == NO_FILE) {
         *result = NULL;
         s = IOError(fname, errno);
       } else {
-        *result = new NvramWritableFile(fname, f, nvlib);
+        *result = new NvramWritableFile(fname, f, NVM_Env());
       }
       return s;
   }
@@ -570,7 +607,7 @@ private:
                                    WritableFile** result) {
     debugf("HDD APD : [%s]\n",fname.c_str());
 #ifdef NVM_FILE_ENABLED_1
-    if (nvlib->fileExist(fname)){
+    if (NVM_Env()->fileExist(fname)){
         return NewAppendableNVMFile(fname,result);
     }
     //if (nvlib->remove(fname.c_str()))
@@ -590,18 +627,18 @@ private:
                                      WritableFile** result){
       Status s;
       debugf("NVM APD : [%s]\n",fname.c_str());
-      nvFileHandle f = nvlib->fopen(fname.c_str(), "a");
+      nvFileHandle f = NVM_Env()->fopen(fname.c_str(), "a");
       if (f == NO_FILE) {
         *result = NULL;
         s = IOError(fname, errno);
       } else {
-        *result = new NvramWritableFile(fname, f, nvlib);
+        *result = new NvramWritableFile(fname, f, NVM_Env());
       }
       return s;
   }
 
   virtual bool FileExists(const std::string& fname) {
-    bool nvm_exist = nvlib->fileExist(fname.c_str());
+    bool nvm_exist = NVM_Env()->fileExist(fname.c_str());
     //debugf("File exist = %d: [%s]\n",nvm_exist,fname.c_str());
 #ifdef NVM_FILE_ENABLED_1
     if (nvm_exist){
@@ -626,7 +663,7 @@ private:
     closedir(d);
 #ifdef NVM_FILE_ENABLED_1
     unsigned long total0 = result->size();
-    if (nvlib->AddChildren(dir,result)) {
+    if (NVM_Env()->AddChildren(dir,result)) {
         unsigned long total1 = result->size();
         //debugf("NVM file included by \"GetChildren(%s)\".\n",dir.c_str());
         //for (unsigned long i=total0; i < total1; ++i){debugf("%d : [%s]\n",i,(*result)[i].c_str());}
@@ -640,9 +677,9 @@ private:
     bool deleted = 0;
     debugf("DELETE FILE: [%s]\n",fname.c_str());
 #ifdef NVM_FILE_ENABLED_1
-    if (nvlib->fileExist(fname)){
+    if (NVM_Env()->fileExist(fname)){
         debugf("NVM DEL : [%s]\n",fname.c_str());
-        if (nvlib->remove(fname.c_str()))
+        if (NVM_Env()->remove(fname.c_str()))
             deleted = 1;
     }
 #endif
@@ -673,7 +710,7 @@ private:
     Status s;
     //debugf("Get file size: [%s]\n",fname.c_str());
 #ifdef NVM_FILE_ENABLED_1
-    long a = nvlib->fileSize(fname.c_str());
+    long a = NVM_Env()->fileSize(fname.c_str());
     if (a != -1) {
         //debugf("Get NVM file size = %ld: [%s]\n",a, fname.c_str());
         *size = a;
@@ -694,11 +731,11 @@ private:
     Status result;
 #ifdef NVM_FILE_ENABLED_1
     debugf("RENAME FILE : [%s] -> [%s]\n",src.c_str(),target.c_str());
-    bool nvm_src_exist = nvlib->fileExist(src);
+    bool nvm_src_exist = NVM_Env()->fileExist(src);
     bool hdd_target_exist = FileExists(target);
     if (nvm_src_exist){
         if (hdd_target_exist) DeleteFile(target);
-        if (nvlib->rename(src.c_str(), target.c_str()) == -1)
+        if (NVM_Env()->rename(src.c_str(), target.c_str()) == -1)
             debugf("Error : Rename failed!\n");
         debugf("NVM FILE RENAMED.\n");
     }
@@ -709,8 +746,8 @@ private:
 #endif
         result = IOError(src, errno);
     } else {
-        if (nvlib->fileExist(target))
-            nvlib->remove(target.c_str());
+        if (NVM_Env()->fileExist(target))
+            NVM_Env()->remove(target.c_str());
     }
     return result;
   }
@@ -720,15 +757,15 @@ private:
     Status result;
 
 #ifdef NVM_FILE_ENABLED_1
-    if (nvlib->fileExist(fname)) {
+    if (NVM_Env()->fileExist(fname)) {
         debugf("Lock file : [%s]\n",fname.c_str());
-        int fd = static_cast<int>(nvlib->fileHandle(fname));
-        if (nvlib->LockOrUnlock(fd, true) == -1) {
+        int fd = static_cast<int>(NVM_Env()->fileHandle(fname));
+        if (NVM_Env()->LockOrUnlock(fd, true) == -1) {
             result = IOError("lock " + fname, errno);
         } else {
             PosixFileLock* my_lock = new PosixFileLock;
             my_lock->ft_ = PosixFileLock::NVMFILE;
-            my_lock->fd_ = nvlib->fopen(fname.c_str(),"r");
+            my_lock->fd_ = NVM_Env()->fopen(fname.c_str(),"r");
             my_lock->name_ = fname;
             *lock = my_lock;
             return result;
@@ -762,10 +799,10 @@ private:
 #ifdef NVM_FILE_ENABLED_1
     if (my_lock->ft_ == PosixFileLock::NVMFILE){
         debugf("Unlock file : [%d]\n",my_lock->fd_);
-        if (nvlib->LockOrUnlock(my_lock->fd_, false) == -1){
+        if (NVM_Env()->LockOrUnlock(my_lock->fd_, false) == -1){
             result = IOError("unlock", errno);
         }
-        nvlib->fclose(my_lock->fd_);
+        NVM_Env()->fclose(my_lock->fd_);
         locks_.Remove(my_lock->name_);
         delete my_lock;
         return result;
@@ -814,12 +851,12 @@ private:
       *result = new PosixLogger(f, &PosixEnv::gettid);
       return Status::OK();
     }*/
-      nvFileHandle f = nvlib->fopen(fname.c_str(), "w");
+      nvFileHandle f = NVM_Env()->fopen(fname.c_str(), "w");
       if (f == NO_FILE) {
         *result = NULL;
         return IOError(fname, errno);
       } else {
-        *result = new PosixLogger(f, &PosixEnv::gettid, nvlib);
+        *result = new PosixLogger(f, &PosixEnv::gettid, NVM_Env());
         return Status::OK();
       }
   }
@@ -893,13 +930,7 @@ static intptr_t MaxOpenFiles() {
 }
 
 PosixEnv::PosixEnv()
-    : nvlib(
-          #ifdef NVDIMM_ENABLED
-              new NVM_Library(32ULL * GB)
-          #else
-              new NVM_Library(1500ULL * MB)
-          #endif
-          ),
+    : nvlib_(NULL),
       //nvlib( new NVM_Library_Basedon_TMPFS("/tmp/nvm")),
       started_bgthread_(false),
       mmap_limit_(MaxMmaps()),
@@ -54,6 +54,8 @@ Options::Options()
       TEST_pop_limit(0.9),
       TEST_key_hash(0), TEST_write_thread(8),
       TEST_no_double_level0(true),
+      TEST_flush_threads(1),
+      TEST_level0_filter_bits_per_key(10),
       TEST_nvskiplist_type(kTypePureSkiplist),
       TEST_background_lock_free(true),
       TEST_hdd_cache_size(256 * MB),
@@ -67,7 +69,18 @@ Options::Options()
           100 * MB
           #endif
           ),
-      TEST_hash_full_limit(0.5)
+      TEST_hash_full_limit(0.5),
+      TEST_dram_hash_mirror(false),
+      TEST_group_commit(true),
+      TEST_numa_home_ranges(false),
+      TEST_nvm_file_path(),
+      TEST_nvm_file_size(
+          #ifdef NVDIMM_ENABLED
+          32ULL * GB
+          #else
+          1500ULL * MB
+          #endif
+          )
 { }
 
 }  // namespace leveldb